@@ -0,0 +1,266 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+//
+// Stress test for ConcurrentDictionary and the epoch
+// reclamation under it. Reader threads look up, count and
+// walk the dictionary while writer threads set and remove
+// keys. Every value knows the key it was stored under, so a
+// reader that gets a wrong or freed value notices. Build with
+// -fsanitize=address or -fsanitize=thread to let the
+// sanitizers watch the reclamation as well.
+//
+//   make bench && ./bench/concurrentdictionary [seconds]
+//
+
+#include "utils/object.h"
+#include "utils/concurrentdictionary.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define kStressReaders 4
+#define kStressWriters 2
+#define kStressKeys 256
+#define kStressKeyLength 16
+#define kStressDefaultSeconds 5
+
+DECLARE_CLASS(StressValue);
+
+DEFINE_CLASS(StressValue,
+	uint32_t key;
+);
+
+static ConcurrentDictionary StressDictionary;
+static char StressKeys[kStressKeys][kStressKeyLength];
+static bool StressStop;
+
+static uint64_t StressCreated;
+static uint64_t StressDeallocated;
+static uint64_t StressLookups;
+static uint64_t StressWalks;
+static uint64_t StressWrites;
+static uint64_t StressErrors;
+
+static __thread const char* StressLastKey;
+
+static StressValue StressValueCreate(uint32_t key);
+static void StressValueDealloc(void* ptr);
+static void* StressRead(void* ptr);
+static void* StressWrite(void* ptr);
+static void StressCheckEntry(const char* key, void* value);
+static uint32_t StressRandom(uint32_t* state);
+
+int main(int argc, char** argv)
+{
+	pthread_t readers[kStressReaders];
+	pthread_t writers[kStressWriters];
+	uint32_t seeds[kStressReaders + kStressWriters];
+	unsigned int seconds = kStressDefaultSeconds;
+	uint64_t pending;
+	
+	if (argc > 1)
+		seconds = (unsigned int)strtoul(argv[1], NULL, 10);
+	
+	ObjectRuntimeInit();
+	
+	StressDictionary = ConcurrentDictionaryCreate();
+	
+	if (StressDictionary == NULL) {
+		printf("Could not create dictionary.\n");
+		return EXIT_FAILURE;
+	}
+	
+	for (uint32_t i = 0; i < kStressKeys; i++)
+		snprintf(StressKeys[i], kStressKeyLength, "nick%03u", i);
+	
+	for (uint32_t i = 0; i < kStressReaders; i++) {
+		seeds[i] = i + 1;
+		pthread_create(&readers[i], NULL, StressRead, &seeds[i]);
+	}
+	
+	for (uint32_t i = 0; i < kStressWriters; i++) {
+		seeds[kStressReaders + i] = 1000 + i;
+		pthread_create(&writers[i], NULL, StressWrite, &seeds[kStressReaders + i]);
+	}
+	
+	sleep(seconds);
+	__atomic_store_n(&StressStop, true, __ATOMIC_RELAXED);
+	
+	for (uint32_t i = 0; i < kStressReaders; i++)
+		pthread_join(readers[i], NULL);
+	for (uint32_t i = 0; i < kStressWriters; i++)
+		pthread_join(writers[i], NULL);
+	
+	// Retired memory is only reclaimed by later writes,
+	// so push the epoch past everything retired so far
+	for (uint32_t i = 0; i < 4; i++) {
+		StressValue value = StressValueCreate(0);
+		
+		ConcurrentDictionarySet(StressDictionary, StressKeys[0], value);
+		Release(value);
+	}
+	
+	Release(StressDictionary);
+	
+	// The last retirements wait for a write that never comes
+	pending = StressCreated - StressDeallocated;
+	
+	printf("%llu lookups, %llu walks, %llu writes\n", (unsigned long long)StressLookups, (unsigned long long)StressWalks, (unsigned long long)StressWrites);
+	printf("%llu values created, %llu still waiting for reclamation\n", (unsigned long long)StressCreated, (unsigned long long)pending);
+	
+	if (StressErrors > 0 || pending > 2) {
+		printf("FAILED: %llu errors\n", (unsigned long long)StressErrors);
+		return EXIT_FAILURE;
+	}
+	
+	printf("OK\n");
+	
+	return EXIT_SUCCESS;
+}
+
+static StressValue StressValueCreate(uint32_t key)
+{
+	StressValue value = malloc(sizeof(struct _StressValue));
+	
+	if (value == NULL) {
+		perror("malloc");
+		abort();
+	}
+	
+	memset(value, 0, sizeof(struct _StressValue));
+	ObjectInit(value, StressValueDealloc);
+	value->key = key;
+	
+	__sync_add_and_fetch(&StressCreated, 1);
+	
+	return value;
+}
+
+static void StressValueDealloc(void* ptr)
+{
+	StressValue value = ptr;
+	
+	// Makes a use after reclamation visible even
+	// without a sanitizer
+	value->key = UINT32_MAX;
+	free(value);
+	
+	__sync_add_and_fetch(&StressDeallocated, 1);
+}
+
+static void* StressRead(void* ptr)
+{
+	uint32_t* seed = ptr;
+	uint64_t lookups = 0;
+	uint64_t walks = 0;
+	
+	while (!__atomic_load_n(&StressStop, __ATOMIC_RELAXED)) {
+		uint32_t key = StressRandom(seed) % kStressKeys;
+		StressValue value = (StressValue)ConcurrentDictionaryGet(StressDictionary, StressKeys[key]);
+		
+		if (value) {
+			if (value->key != key)
+				__sync_add_and_fetch(&StressErrors, 1);
+			
+			Release(value);
+		}
+		
+		lookups++;
+		
+		// Now and then walk everything, like /list does
+		if ((lookups & 255) == 0) {
+			StressLastKey = NULL;
+			ConcurrentDictionaryForEach(StressDictionary, ^(const char* entryKey, void* entryValue) {
+				StressCheckEntry(entryKey, entryValue);
+			});
+			
+			if (ConcurrentDictionaryGetCount(StressDictionary) > kStressKeys)
+				__sync_add_and_fetch(&StressErrors, 1);
+			
+			walks++;
+		}
+	}
+	
+	__sync_add_and_fetch(&StressLookups, lookups);
+	__sync_add_and_fetch(&StressWalks, walks);
+	
+	return NULL;
+}
+
+static void* StressWrite(void* ptr)
+{
+	uint32_t* seed = ptr;
+	uint64_t writes = 0;
+	
+	while (!__atomic_load_n(&StressStop, __ATOMIC_RELAXED)) {
+		uint32_t key = StressRandom(seed) % kStressKeys;
+		
+		// Renames and joins set, quits remove
+		if (StressRandom(seed) % 3 == 0)
+			ConcurrentDictionaryRemove(StressDictionary, StressKeys[key]);
+		else {
+			StressValue value = StressValueCreate(key);
+			
+			if (!ConcurrentDictionarySet(StressDictionary, StressKeys[key], value))
+				__sync_add_and_fetch(&StressErrors, 1);
+			
+			Release(value);
+		}
+		
+		writes++;
+	}
+	
+	__sync_add_and_fetch(&StressWrites, writes);
+	
+	return NULL;
+}
+
+//
+// Entries of a walk must be sorted and hold the value
+// of their key
+//
+static void StressCheckEntry(const char* key, void* value)
+{
+	StressValue stressValue = value;
+	
+	if (StressLastKey && strcmp(StressLastKey, key) >= 0)
+		__sync_add_and_fetch(&StressErrors, 1);
+	
+	if (strcmp(StressKeys[stressValue->key], key) != 0)
+		__sync_add_and_fetch(&StressErrors, 1);
+	
+	StressLastKey = key;
+}
+
+static uint32_t StressRandom(uint32_t* state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	
+	return *state;
+}
@@ -23,6 +23,8 @@
 #include "poll.h"
 #include "utils/queue.h"
 #include "utils/helper.h"
+#include "utils/probes.h"
+#include "utils/slab.h"
 
 #include <string.h>
 #include <pthread.h>
@@ -70,6 +72,8 @@ DEFINE_CLASS(PollDescriptor,
 	// the pollfd in pollInfos
 );
 
+DEFINE_SLAB(PollDescriptor, sizeof(struct _PollDescriptor));
+
 static void* PollThread(void* ptr);
 static void PollDealloc(void* ptr);
 static void PollApplyUpdates(Poll poll);
@@ -192,7 +196,9 @@ static void* PollThread(void* ptr)
 		// Update the poll before to ensure we get all
 		PollApplyUpdates(p);
 		
+		PROBE2(poll__wait, p, p->numOfPolls);
 		socksToHandle = poll(p->polls, p->numOfPolls, 1000);
+		PROBE2(poll__wakeup, p, socksToHandle);
 		
 		// Update after to not notify deleted poll requests
 		PollApplyUpdates(p);
@@ -346,15 +352,13 @@ static void PollDealloc(void* ptr)
 
 static PollDescriptor PollDescriptorCreate(Poll poll)
 {
-	PollDescriptor pd = malloc(sizeof(struct _PollDescriptor));
+	PollDescriptor pd = SlabAlloc(PollDescriptorSlab);
 	
 	if (pd == NULL) {
-		perror("malloc");
+		perror("SlabAlloc");
 		return NULL;
 	}
 	
-	memset(pd, 0, sizeof(struct _PollDescriptor));
-	
 	ObjectInit(pd, PollDescriptorDealloc);
 	pd->poll = poll;
 	
@@ -365,5 +369,5 @@ static void PollDescriptorDealloc(void* ptr)
 {
 	PollDescriptor pd = ptr;
 	
-	free(pd);
+	SlabFree(PollDescriptorSlab, pd);
 }
@@ -23,7 +23,9 @@
 #include "client.h"
 
 #include "utils/helper.h"
-#include "utils/str_helper.h"
+#include "utils/probes.h"
+#include "utils/slice.h"
+#include "utils/slab.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -55,6 +57,8 @@ DEFINE_CLASS(Client,
 	uint32_t outBufferFilled;
 );
 
+DEFINE_SLAB(Client, sizeof(struct _Client));
+
 static int my_asprintf(char **strp, const char *fmt, ...)
 {
     int len;
@@ -81,7 +85,7 @@ static void ClientDealloc(void* ptr);
 static bool ClientSetNickname(Client client, char* nickname);
 static void ClientDoRead(Client client);
 static void ClientDoWrite(Client client);
-static void ClientHandleLine(Client client, char* line);
+static void ClientHandleLine(Client client, char* line, size_t length);
 
 static void ClientHandleNickCommand(Client client, char* arg);
 static void ClientHandleMsgCommand(Client client, char* arg);
@@ -101,15 +105,13 @@ struct CommandDef CommandDefs[] = {
 
 Client ClientCreate(Listener listener, int socket, struct sockaddr_in6 addrInfo)
 {
-	Client client = malloc(sizeof(struct _Client));
+	Client client = SlabAlloc(ClientSlab);
 	
 	if (client == NULL) {
-		perror("malloc");
+		perror("SlabAlloc");
 		return NULL;
 	}
 	
-	memset(client, 0, sizeof(struct _Client));
-	
 	ObjectInit(client, ClientDealloc);
 	client->listener = listener;
 	client->socket = socket;
@@ -163,13 +165,13 @@ Client ClientCreate(Listener listener, int socket, struct sockaddr_in6 addrInfo)
 
 static void ClientDealloc(void* ptr)
 {
-	free(ptr);
+	SlabFree(ClientSlab, ptr);
 }
 
 void ClientDisconnect(Client client, char* reason)
 {
 	printf("Disconnected client %p:%s: %s\n", client, client->addrInfoLine, reason);
-	DictionaryRemove(ServerGetClients(ListenerGetServer(client->listener)), client->nickname);
+	ConcurrentDictionaryRemove(ServerGetClients(ListenerGetServer(client->listener)), client->nickname);
 	{
 		char* msg;
 		
@@ -216,10 +218,15 @@ static void ClientDoRead(Client client)
 	}
 	else {
 		client->inBufferFilled += len;
-
-		// Do we have a \n?
-		char* newlineSeparator = strchr(client->inBuffer, '\n');
-		if (newlineSeparator) { // Yes, handle line
+		
+		uint32_t start = 0;
+		size_t newlineSeparator;
+		
+		// Handle every complete line we got, only searching
+		// the bytes not yet consumed
+		while ((newlineSeparator = SliceFind(SliceMake(client->inBuffer + start, client->inBufferFilled - start), '\n')) != kSliceNotFound) {
+			char* line = client->inBuffer + start;
+			
 			//
 			// The Contract with ClientHandleLine
 			//
@@ -227,20 +234,24 @@ static void ClientDoRead(Client client)
 			// do any thing with that line as long it stays before the \0
 			// If it need to preserve anything, it has to copy it.
 			//
-			*newlineSeparator = '\0';
-			ClientHandleLine(client, client->inBuffer);
-			
-			// Do we have anything after that \n we found
-			if (strlen(newlineSeparator + 1) > 0) {// Yes move it to the beginning of the buffer
-				client->inBufferFilled -= newlineSeparator + 1 - client->inBuffer; // Deaccount for the full line
-				memmove(client->inBuffer, newlineSeparator + 1, client->inBufferFilled); // Move remaining to beginning
-				memset(client->inBuffer+client->inBufferFilled, 0, client->inBufferLength - client->inBufferFilled); // Clear rest
-			}
-			else { // No, discard the buffer
-				client->inBufferFilled = client->inBufferLength = 0;
-				free(client->inBuffer);
-				client->inBuffer = NULL;
-			}
+			line[newlineSeparator] = '\0';
+			start += (uint32_t)newlineSeparator + 1;
+			ClientHandleLine(client, line, newlineSeparator);
+		}
+		
+		// Do we have anything after the last \n we found
+		if (start == 0) {
+			// No complete line yet
+		}
+		else if (start < client->inBufferFilled) { // Yes move it to the beginning of the buffer
+			client->inBufferFilled -= start; // Deaccount for the full lines
+			memmove(client->inBuffer, client->inBuffer + start, client->inBufferFilled); // Move remaining to beginning
+			client->inBuffer[client->inBufferFilled] = '\0';
+		}
+		else { // No, discard the buffer
+			client->inBufferFilled = client->inBufferLength = 0;
+			free(client->inBuffer);
+			client->inBuffer = NULL;
 		}
 	}
 }
@@ -250,6 +261,7 @@ static void ClientDoWrite(Client client)
 	ssize_t len;
 	
 	len = send(client->socket, client->outBuffer, client->outBufferFilled, 0);
+	PROBE3(client__send, client, client->outBufferFilled, len);
 	
 	if (len < 0) {
 		perror("send");
@@ -275,21 +287,26 @@ static void ClientDoWrite(Client client)
 	}
 }
 
-static void ClientHandleLine(Client client, char* line)
+static void ClientHandleLine(Client client, char* line, size_t length)
 {
 	// Ignore empty lines
-	if (strlen(line) == 0)
+	if (length == 0)
 		return;
 	
 	// Is a command
 	if (*line == '/') {
-		line++; // 'remove' the /
-		char* command = strsep(&line, " ");
-		char* args = line;
+		Slice command = SliceMake(line + 1, length - 1); // 'remove' the /
+		size_t separator = SliceFind(command, ' ');
+		char* args = NULL;
 		bool foundCommand = false;
 		
+		if (separator != kSliceNotFound) {
+			args = line + 1 + separator + 1;
+			command = SliceTo(command, separator);
+		}
+		
 		for (uint32_t i = 0; CommandDefs[i].name != NULL; i++) {
-			if (strcmp(CommandDefs[i].name, command) == 0) {
+			if (SliceEqualsString(command, CommandDefs[i].name)) {
 				CommandDefs[i].handler(client, args);
 				foundCommand = true;
 				break;
@@ -314,41 +331,51 @@ static void ClientHandleLine(Client client, char* line)
 
 static bool ClientSetNickname(Client client, char* _nick)
 {
-	// Copy nick
-	char* nickname = malloc(strlen(_nick) + 1 /* \0 */);
-	if (nickname == NULL) {
-		perror("malloc");
-		return false;
-	}
-	strcpy(nickname, _nick);
-	// Normalize nickname
-	nickname = strtrim(nickname);
+	// Normalize nickname, only the first word is used
+	Slice nick = SliceTrim(SliceFromString(_nick));
+	size_t separator = SliceFind(nick, ' ');
+	
+	if (separator != kSliceNotFound)
+		nick = SliceTo(nick, separator);
 	
-	if (nickname == NULL || strlen(nickname) == 0) {
+	if (nick.length == 0) {
 		return false;
 	}
 	
 	// Is already set?
-	if (client->nickname && strcmp(client->nickname, nickname) == 0) {
+	if (client->nickname && SliceEqualsString(nick, client->nickname)) {
 		return true; // Silently succeed
 	}
 	
-	Dictionary clients = ServerGetClients(ListenerGetServer(client->listener));
+	// Copy nick
+	char* nickname = SliceCopy(nick);
+	if (nickname == NULL) {
+		return false;
+	}
+	
+	ConcurrentDictionary clients = ServerGetClients(ListenerGetServer(client->listener));
+	Object existing;
 	
+	// Only writers take the lock, it makes check
+	// and set atomic
 	Lock(clients);
-	if (DictionaryGet(clients, nickname) != NULL) {
+	existing = ConcurrentDictionaryGet(clients, nickname);
+	if (existing != NULL) {
+		Release(existing);
 		Unlock(clients);
+		free(nickname);
 		
 		return false;
 	}
 	
 	if (client->nickname) {
-		DictionaryRemove(clients, client->nickname);
+		// Readers got their own copy of the key
+		ConcurrentDictionaryRemove(clients, client->nickname);
 		free(client->nickname);	
 	}
 
 	client->nickname = nickname;
-	DictionarySet(clients, client->nickname, client);
+	ConcurrentDictionarySet(clients, client->nickname, client);
 	Unlock(clients);
 	
 	return true;
@@ -356,8 +383,15 @@ static bool ClientSetNickname(Client client, char* _nick)
 
 void ClientWriteLine(Client client, char* line)
 {
-	if (client->outBufferLength - client->outBufferFilled < strlen(line) + 1 /* \n */) {
-		client->outBufferLength += strlen(line) + 1 /* \n */;
+	ClientWriteSlice(client, SliceFromString(line));
+}
+
+void ClientWriteSlice(Client client, Slice line)
+{
+	PROBE2(client__write, client, line.length);
+	
+	if (client->outBufferLength - client->outBufferFilled < line.length + 1 /* \n */) {
+		client->outBufferLength += (uint32_t)line.length + 1 /* \n */;
 		client->outBuffer = realloc(client->outBuffer, client->outBufferLength);
 		if (client->outBuffer == NULL) {
 			perror("realloc");
@@ -365,8 +399,8 @@ void ClientWriteLine(Client client, char* line)
 			return;
 		}
 	}
-	memcpy(client->outBuffer+client->outBufferFilled, line, strlen(line));
-	client->outBufferFilled += strlen(line);
+	memcpy(client->outBuffer+client->outBufferFilled, line.data, line.length);
+	client->outBufferFilled += (uint32_t)line.length;
 	client->outBuffer[client->outBufferFilled++] = '\n';
 	
 	// Inform that we want to send, if we're not already sending
@@ -404,20 +438,24 @@ static void ClientHandleMsgCommand(Client client, char* arg)
 		return;
 	}
 	
-	char* name = strsep_ext(&arg, " ");
-	char* message = arg;
+	Slice message = SliceFromString(arg);
+	Slice name;
 	
-	if (name == NULL || strlen(name) == 0) {
+	if (!SliceNextToken(&message, ' ', &name)) {
 		ClientWriteLine(client, "-> /msg <name> <message>");
 		return;
 	}
 	
-	if (message == NULL || strlen(message) == 0) {
+	if (message.length == 0) {
 		ClientWriteLine(client, "-> /msg <name> <message>");
 		return;
 	}
 	
-	Client recpt = DictionaryGet(ServerGetClients(ListenerGetServer(client->listener)), name);
+	// Terminate the name in place, the message starts
+	// behind the separator
+	arg[name.data - arg + (ptrdiff_t)name.length] = '\0';
+	
+	Client recpt = (Client)ConcurrentDictionaryGet(ServerGetClients(ListenerGetServer(client->listener)), name.data);
 	
 	if (recpt == NULL) {
 		ClientWriteLine(client, "-> Recipient unkown");
@@ -427,26 +465,33 @@ static void ClientHandleMsgCommand(Client client, char* arg)
 	{
 		char* msg;
 		
-		if (my_asprintf(&msg, "%s->%s: %s", client->nickname, recpt->nickname, message) >= 0) {
+		// The recipient may change its nickname (and free
+		// the old one) meanwhile, use the name we looked up
+		if (my_asprintf(&msg, "%s->%s: %s", client->nickname, name.data, message.data) >= 0) {
 			ClientWriteLine(client, msg);
 			ClientWriteLine(recpt, msg);
 			free(msg);
 		}
 	}
+	
+	Release(recpt);
 }
 
 static void ClientHandleListCommand(Client client, char* arg)
 {
 	#pragma unused(arg)
-	Dictionary clients = ServerGetClients(ListenerGetServer(client->listener));
-	
-	DictionaryIterator iter;
-	
-	iter = DictionaryGetIterator(clients);
+	ConcurrentDictionary clients = ServerGetClients(ListenerGetServer(client->listener));
 	char* currentLine = calloc(255 /* max line length for this command */, sizeof(char));
 	
-	while (DictionaryIteratorGetKey(iter) != NULL) {
-		char* name = ((Client)DictionaryIteratorGetValue(iter))->nickname;
+	if (currentLine == NULL) {
+		perror("calloc");
+		return;
+	}
+	
+	// Listed by nickname. The key is the copy of the snapshot,
+	// the nickname of the client may change meanwhile.
+	ConcurrentDictionaryForEach(clients, ^(const char* name, void* value) {
+		#pragma unused(value)
 		size_t length = strlen(name) + 3 /* []  */;
 		
 		if (254 - strlen(currentLine) < length) {
@@ -457,9 +502,7 @@ static void ClientHandleListCommand(Client client, char* arg)
 		strcat(currentLine, "[");
 		strcat(currentLine, name);
 		strcat(currentLine, "] ");
-		
-		DictionaryIteratorNext(iter);
-	}
+	});
 	
 	if (strlen(currentLine) > 0)
 		ClientWriteLine(client, currentLine);
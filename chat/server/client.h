@@ -25,6 +25,7 @@
 
 #include "utils/object.h"
 #include "server/listener.h"
+#include "utils/slice.h"
 
 DECLARE_CLASS(Client);
 
@@ -47,4 +48,9 @@ void ClientDisconnect(Client client, char* reason);
 //
 void ClientWriteLine(Client client, char* line);
 
+//
+// Same as ClientWriteLine for a line of known length
+//
+void ClientWriteSlice(Client client, Slice line);
+
 #endif // _CLIENT_H_
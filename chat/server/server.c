@@ -22,7 +22,8 @@
 
 #include "server.h"
 #include "listener.h"
-#include "utils/dictionary.h"
+#include "utils/concurrentdictionary.h"
+#include "utils/probes.h"
 #include "client.h"
 
 #include <stdlib.h>
@@ -37,9 +38,10 @@ DEFINE_CLASS(Server,
 	uint16_t numberOfListeners;
 	
 	//
-	// Dictionary that holds all known clients
+	// Dictionary that holds all known clients,
+	// sorted by nickname. Read without locking.
 	//
-	Dictionary clients;
+	ConcurrentDictionary clients;
 	
 	//
 	// 
@@ -65,7 +67,7 @@ Server ServerCreate(const char* port)
 	server->keepRunning = true;
 	
 	server->poll = PollCreate();
-	server->clients = DictionaryCreate();
+	server->clients = ConcurrentDictionaryCreate();
 	
 	if (!ServerCreateListeners(server, port)) {
 		Release(server);
@@ -135,21 +137,21 @@ Poll ServerGetPoll(Server server)
 	return server->poll;
 }
 
-Dictionary ServerGetClients(Server server)
+ConcurrentDictionary ServerGetClients(Server server)
 {
 	return server->clients;
 }
 
 void ServerSendChannelMessage(Server server, char* msg)
 {
-	DictionaryIterator iter;
+	PROBE1(channel__message__start, msg);
 	
-	iter = DictionaryGetIterator(server->clients);
+	// Walks a snapshot, clients joining or leaving
+	// meanwhile do not wait for us
+	ConcurrentDictionaryForEach(server->clients, ^(const char* nickname, void* client) {
+		#pragma unused(nickname)
+		ClientWriteLine(client, msg);
+	});
 	
-	while (DictionaryIteratorGetKey(iter) != NULL) {
-		Client c = DictionaryIteratorGetValue(iter);
-		ClientWriteLine(c, msg);
-		
-		DictionaryIteratorNext(iter);
-	}
+	PROBE1(channel__message__done, msg);
 }
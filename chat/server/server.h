@@ -24,7 +24,7 @@
 #define _SERVER_H_
 
 #include "utils/object.h"
-#include "utils/dictionary.h"
+#include "utils/concurrentdictionary.h"
 #include "net/poll.h"
 
 DECLARE_CLASS(Server);
@@ -44,8 +44,9 @@ void ServerMain(Server server);
 //
 // Get a dictionary with all the clients,
 // the key is the nick of the client
+// (iterated in nickname order)
 //
-Dictionary ServerGetClients(Server server);
+ConcurrentDictionary ServerGetClients(Server server);
 
 //
 // Get the poll object for the for the server
@@ -0,0 +1,276 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "concurrentdictionary.h"
+#include "epoch.h"
+#include "slab.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+struct _ConcurrentDictionaryEntry {
+	const char* key;
+	void* value;
+};
+
+//
+// An immutable snapshot. The copies of the keys
+// follow right after the entries.
+//
+struct _ConcurrentDictionaryVersion {
+	size_t count;
+	struct _ConcurrentDictionaryEntry entries[];
+};
+
+DEFINE_CLASS(ConcurrentDictionary,
+	//
+	// Replaced as a whole by writers, NULL
+	// until the first write
+	//
+	struct _ConcurrentDictionaryVersion* current;
+);
+
+DEFINE_SLAB(ConcurrentDictionary, sizeof(struct _ConcurrentDictionary));
+
+static void ConcurrentDictionaryDealloc(void* ptr);
+static bool ConcurrentDictionaryFind(struct _ConcurrentDictionaryVersion* version, const char* key, size_t* index);
+static bool ConcurrentDictionaryPublish(ConcurrentDictionary dict, const char* key, void* value);
+static void ConcurrentDictionaryCopyEntry(struct _ConcurrentDictionaryVersion* version, char** keys, const char* key, void* value);
+static void ConcurrentDictionaryReleaseValue(void* value);
+
+ConcurrentDictionary ConcurrentDictionaryCreate()
+{
+	ConcurrentDictionary dict = SlabAlloc(ConcurrentDictionarySlab);
+	
+	if (dict == NULL) {
+		perror("SlabAlloc");
+		return NULL;
+	}
+	
+	ObjectInit(dict, ConcurrentDictionaryDealloc);
+	
+	return dict;
+}
+
+Object ConcurrentDictionaryGet(ConcurrentDictionary dict, const char* key)
+{
+	struct _ConcurrentDictionaryVersion* version;
+	Object value = NULL;
+	size_t index;
+	
+	EpochEnter();
+	
+	version = __atomic_load_n(&dict->current, __ATOMIC_ACQUIRE);
+	
+	// The dictionary keeps its reference at least until
+	// our read section ends, so retaining is safe
+	if (version && ConcurrentDictionaryFind(version, key, &index))
+		value = Retain((Object)version->entries[index].value);
+	
+	EpochExit();
+	
+	return value;
+}
+
+bool ConcurrentDictionarySet(ConcurrentDictionary dict, const char* key, void* value)
+{
+	bool success;
+	
+	assert(value != NULL);
+	
+	Lock(dict);
+	success = ConcurrentDictionaryPublish(dict, key, value);
+	Unlock(dict);
+	
+	return success;
+}
+
+void ConcurrentDictionaryRemove(ConcurrentDictionary dict, const char* key)
+{
+	Lock(dict);
+	ConcurrentDictionaryPublish(dict, key, NULL);
+	Unlock(dict);
+}
+
+size_t ConcurrentDictionaryGetCount(ConcurrentDictionary dict)
+{
+	struct _ConcurrentDictionaryVersion* version;
+	size_t count;
+	
+	EpochEnter();
+	version = __atomic_load_n(&dict->current, __ATOMIC_ACQUIRE);
+	count = version ? version->count : 0;
+	EpochExit();
+	
+	return count;
+}
+
+void ConcurrentDictionaryForEach(ConcurrentDictionary dict, void (^block)(const char* key, void* value))
+{
+	struct _ConcurrentDictionaryVersion* version;
+	
+	EpochEnter();
+	
+	version = __atomic_load_n(&dict->current, __ATOMIC_ACQUIRE);
+	
+	if (version) {
+		for (size_t i = 0; i < version->count; i++)
+			block(version->entries[i].key, version->entries[i].value);
+	}
+	
+	EpochExit();
+}
+
+static void ConcurrentDictionaryDealloc(void* ptr)
+{
+	ConcurrentDictionary dict = ptr;
+	struct _ConcurrentDictionaryVersion* version = dict->current;
+	
+	// Nobody can read anymore
+	if (version) {
+		for (size_t i = 0; i < version->count; i++)
+			Release(version->entries[i].value);
+		
+		free(version);
+	}
+	
+	SlabFree(ConcurrentDictionarySlab, dict);
+}
+
+//
+// Binary search, index is where key is or
+// would have to be inserted
+//
+static bool ConcurrentDictionaryFind(struct _ConcurrentDictionaryVersion* version, const char* key, size_t* index)
+{
+	size_t low = 0;
+	size_t high = version->count;
+	
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		int cmp = strcmp(version->entries[middle].key, key);
+		
+		if (cmp == 0) {
+			*index = middle;
+			return true;
+		}
+		else if (cmp < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	
+	*index = low;
+	
+	return false;
+}
+
+//
+// Publishes a copy of the current version with key set to
+// value, or removed when value is NULL. Must be called with
+// the dictionary locked.
+//
+static bool ConcurrentDictionaryPublish(ConcurrentDictionary dict, const char* key, void* value)
+{
+	struct _ConcurrentDictionaryVersion* old = dict->current;
+	struct _ConcurrentDictionaryVersion* version;
+	size_t oldCount = old ? old->count : 0;
+	size_t index = 0;
+	size_t skip;
+	size_t count;
+	size_t size;
+	bool exists = false;
+	char* keys;
+	
+	if (old)
+		exists = ConcurrentDictionaryFind(old, key, &index);
+	
+	// Nothing to remove
+	if (!exists && value == NULL)
+		return true;
+	
+	// The old entry at index is dropped when it is
+	// replaced or removed
+	skip = exists ? 1 : 0;
+	count = oldCount - skip + (value ? 1 : 0);
+	
+	size = sizeof(struct _ConcurrentDictionaryVersion) + count * sizeof(struct _ConcurrentDictionaryEntry);
+	for (size_t i = 0; i < oldCount; i++) {
+		if (i != index || !exists)
+			size += strlen(old->entries[i].key) + 1;
+	}
+	if (value)
+		size += strlen(key) + 1;
+	
+	version = malloc(size);
+	
+	if (version == NULL) {
+		perror("malloc");
+		return false;
+	}
+	
+	version->count = 0;
+	keys = (char*)&version->entries[count];
+	
+	for (size_t i = 0; i < index; i++)
+		ConcurrentDictionaryCopyEntry(version, &keys, old->entries[i].key, old->entries[i].value);
+	
+	if (value)
+		ConcurrentDictionaryCopyEntry(version, &keys, key, Retain((Object)value));
+	
+	for (size_t i = index + skip; i < oldCount; i++)
+		ConcurrentDictionaryCopyEntry(version, &keys, old->entries[i].key, old->entries[i].value);
+	
+	assert(version->count == count);
+	assert(keys == (char*)version + size);
+	
+	__atomic_store_n(&dict->current, version, __ATOMIC_RELEASE);
+	
+	// Readers may still be walking the old version
+	// or use the old value
+	if (exists)
+		EpochRetire(old->entries[index].value, ConcurrentDictionaryReleaseValue);
+	if (old)
+		EpochRetire(old, free);
+	
+	return true;
+}
+
+static void ConcurrentDictionaryCopyEntry(struct _ConcurrentDictionaryVersion* version, char** keys, const char* key, void* value)
+{
+	size_t length = strlen(key) + 1;
+	
+	memcpy(*keys, key, length);
+	
+	version->entries[version->count].key = *keys;
+	version->entries[version->count].value = value;
+	version->count++;
+	
+	*keys += length;
+}
+
+static void ConcurrentDictionaryReleaseValue(void* value)
+{
+	Release(value);
+}
@@ -0,0 +1,81 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _CONCURRENTDICTIONARY_H_
+#define _CONCURRENTDICTIONARY_H_
+
+#include "utils/object.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+//
+// A dictionary for read-mostly data shared between threads.
+// Readers never lock: they walk an immutable snapshot, sorted
+// by key. Writers are serialized, copy the snapshot with their
+// change and publish it with a pointer swap. Old snapshots are
+// reclaimed by epoch (see utils/epoch.h).
+//
+// Keys are copied, values must be objects and are retained
+// by the dictionary.
+//
+// To make a sequence of writes atomic (e.g. check and set)
+// hold Lock(dict) around it, readers are not affected.
+//
+DECLARE_CLASS(ConcurrentDictionary);
+
+//
+// Creates a new empty dictionary
+//
+OBJECT_RETURNS_RETAINED
+ConcurrentDictionary ConcurrentDictionaryCreate();
+
+//
+// Gets the value associated with key, retained. Release
+// it when done. Returns NULL if there is none.
+//
+OBJECT_RETURNS_RETAINED
+Object ConcurrentDictionaryGet(ConcurrentDictionary dict, const char* key);
+
+//
+// Sets the value associated with key, replacing the
+// previous one. Returns false if no memory is left.
+//
+bool ConcurrentDictionarySet(ConcurrentDictionary dict, const char* key, void* value);
+
+//
+// Removes a given key
+//
+void ConcurrentDictionaryRemove(ConcurrentDictionary dict, const char* key);
+
+//
+// Returns the number of keys in the dictionary
+//
+size_t ConcurrentDictionaryGetCount(ConcurrentDictionary dict);
+
+//
+// Calls block for every key in order, on one snapshot. Writes
+// from within block are allowed but not seen by the walk.
+//
+void ConcurrentDictionaryForEach(ConcurrentDictionary dict, void (^block)(const char* key, void* value));
+
+#endif /* _CONCURRENTDICTIONARY_H_ */
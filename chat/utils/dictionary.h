@@ -26,6 +26,7 @@
 #include "utils/object.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 
 DECLARE_CLASS(Dictionary);
 DECLARE_CLASS(DictionaryIterator);
@@ -54,6 +55,11 @@ void DictionarySet(Dictionary dict, const char* key, const void* value);
 //
 void DictionaryRemove(Dictionary dict, const char* key);
 
+//
+// Returns the number of keys in the dictionary
+//
+size_t DictionaryGetCount(Dictionary dict);
+
 //
 // Gets a iterator. The order which will be iterated
 // is implemation detail.
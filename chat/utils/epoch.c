@@ -0,0 +1,217 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "epoch.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <assert.h>
+
+//
+// Every thread that ever read has a record. The records
+// are never freed, records of exited threads are reused.
+//
+struct _EpochRecord {
+	//
+	// (epoch << 1) | 1 while inside a read
+	// section, 0 otherwise
+	//
+	uint64_t state;
+	
+	//
+	// Only touched by the owning thread
+	//
+	uint32_t nesting;
+	
+	bool inUse;
+	struct _EpochRecord* next;
+};
+
+struct _EpochRetired {
+	void* ptr;
+	void (*reclaim)(void* ptr);
+	uint64_t epoch;
+	struct _EpochRetired* next;
+};
+
+//
+// Memory retired in epoch e is reclaimed when the
+// global epoch reached e + 2
+//
+static uint64_t _EpochGlobal = 2;
+static struct _EpochRecord* _EpochRecords;
+
+static pthread_mutex_t _EpochRetiredLock = PTHREAD_MUTEX_INITIALIZER;
+static struct _EpochRetired* _EpochRetiredList;
+
+static __thread struct _EpochRecord* _EpochCurrentRecord;
+static pthread_key_t _EpochRecordKey;
+static pthread_once_t _EpochRecordKeyOnce = PTHREAD_ONCE_INIT;
+
+static struct _EpochRecord* _EpochGetRecord(void);
+static void _EpochRecordKeyInit(void);
+static void _EpochRecordRelease(void* ptr);
+static void _EpochTryAdvance(void);
+
+void EpochEnter(void)
+{
+	struct _EpochRecord* record = _EpochGetRecord();
+	
+	if (record->nesting++ == 0) {
+		uint64_t epoch = __atomic_load_n(&_EpochGlobal, __ATOMIC_SEQ_CST);
+		
+		// Must be visible before we read anything shared
+		__atomic_store_n(&record->state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	}
+}
+
+void EpochExit(void)
+{
+	struct _EpochRecord* record = _EpochCurrentRecord;
+	
+	assert(record != NULL && record->nesting > 0);
+	
+	if (--record->nesting == 0)
+		__atomic_store_n(&record->state, 0, __ATOMIC_RELEASE);
+}
+
+void EpochRetire(void* ptr, void (*reclaim)(void* ptr))
+{
+	struct _EpochRetired* retired = malloc(sizeof(struct _EpochRetired));
+	struct _EpochRetired* reclaimable = NULL;
+	struct _EpochRetired** link;
+	
+	if (retired == NULL) {
+		// Leaking is the only safe option
+		perror("malloc");
+		return;
+	}
+	
+	retired->ptr = ptr;
+	retired->reclaim = reclaim;
+	
+	pthread_mutex_lock(&_EpochRetiredLock);
+	
+	retired->epoch = __atomic_load_n(&_EpochGlobal, __ATOMIC_SEQ_CST);
+	retired->next = _EpochRetiredList;
+	_EpochRetiredList = retired;
+	
+	_EpochTryAdvance();
+	
+	// Take out what nobody can see anymore
+	link = &_EpochRetiredList;
+	while (*link) {
+		retired = *link;
+		
+		if (retired->epoch + 2 <= __atomic_load_n(&_EpochGlobal, __ATOMIC_SEQ_CST)) {
+			*link = retired->next;
+			retired->next = reclaimable;
+			reclaimable = retired;
+		}
+		else
+			link = &retired->next;
+	}
+	
+	pthread_mutex_unlock(&_EpochRetiredLock);
+	
+	// Reclaim outside of the lock, it may retire again
+	while (reclaimable) {
+		retired = reclaimable;
+		reclaimable = retired->next;
+		
+		retired->reclaim(retired->ptr);
+		free(retired);
+	}
+}
+
+//
+// The epoch can advance once every thread inside a
+// read section has seen the current one
+//
+static void _EpochTryAdvance(void)
+{
+	uint64_t epoch = __atomic_load_n(&_EpochGlobal, __ATOMIC_SEQ_CST);
+	
+	for (struct _EpochRecord* record = __atomic_load_n(&_EpochRecords, __ATOMIC_ACQUIRE); record; record = record->next) {
+		uint64_t state = __atomic_load_n(&record->state, __ATOMIC_SEQ_CST);
+		
+		if ((state & 1) && (state >> 1) != epoch)
+			return;
+	}
+	
+	__sync_bool_compare_and_swap(&_EpochGlobal, epoch, epoch + 1);
+}
+
+static struct _EpochRecord* _EpochGetRecord(void)
+{
+	struct _EpochRecord* record = _EpochCurrentRecord;
+	
+	if (record)
+		return record;
+	
+	// Reuse the record of an exited thread
+	for (record = __atomic_load_n(&_EpochRecords, __ATOMIC_ACQUIRE); record; record = record->next) {
+		if (!record->inUse && __sync_bool_compare_and_swap(&record->inUse, false, true))
+			break;
+	}
+	
+	if (record == NULL) {
+		record = calloc(1, sizeof(struct _EpochRecord));
+		
+		if (record == NULL) {
+			perror("calloc");
+			abort();
+		}
+		
+		record->inUse = true;
+		
+		do {
+			record->next = __atomic_load_n(&_EpochRecords, __ATOMIC_ACQUIRE);
+		} while (!__sync_bool_compare_and_swap(&_EpochRecords, record->next, record));
+	}
+	
+	pthread_once(&_EpochRecordKeyOnce, _EpochRecordKeyInit);
+	pthread_setspecific(_EpochRecordKey, record);
+	
+	_EpochCurrentRecord = record;
+	
+	return record;
+}
+
+static void _EpochRecordKeyInit(void)
+{
+	if (pthread_key_create(&_EpochRecordKey, _EpochRecordRelease) != 0)
+		perror("pthread_key_create");
+}
+
+static void _EpochRecordRelease(void* ptr)
+{
+	struct _EpochRecord* record = ptr;
+	
+	record->nesting = 0;
+	__atomic_store_n(&record->state, 0, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&record->inUse, false, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,61 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _EPOCH_H_
+#define _EPOCH_H_
+
+//
+// Epoch based reclamation. Readers wrap their accesses to a
+// shared structure in EpochEnter/EpochExit, which costs no lock.
+// Writers unlink memory and hand it to EpochRetire, it is
+// reclaimed once no reader can still see it.
+//
+// Reclamation only happens inside EpochRetire, there is no
+// background thread. Memory retired by the last write stays
+// until the next write retires something, e.g. the last
+// client that left the registry is only freed when another
+// client joins, leaves or renames.
+//
+
+//
+// Begins a read section on the current thread. Read sections
+// can be nested and must not block for long, as they hold
+// back reclamation.
+//
+void EpochEnter(void);
+
+//
+// Ends the read section
+//
+void EpochExit(void);
+
+//
+// Calls reclaim(ptr) once all read sections that were active
+// at the time of the call have ended. ptr must already be
+// unreachable for new readers.
+//
+// The call happens in a later EpochRetire on any thread,
+// at the earliest two retirements later.
+//
+void EpochRetire(void* ptr, void (*reclaim)(void* ptr));
+
+#endif /* _EPOCH_H_ */
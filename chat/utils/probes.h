@@ -0,0 +1,63 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _PROBES_H_
+#define _PROBES_H_
+
+//
+// Static tracing probes (USDT) for bpftrace, perf or SystemTap.
+// A probe compiles to a single nop plus a note in the binary,
+// so it costs nothing until a tracer attaches to it. The
+// arguments are only read by the tracer, keep them to values
+// that are at hand anyway.
+//
+// The probes are used when <sys/sdt.h> (systemtap-sdt-dev)
+// is available, build with NO_PROBES=1 to leave them out.
+// List them with: bpftrace -l 'usdt:./chat:*'
+//
+
+#if !defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef HAVE_PROBES
+
+#include <sys/sdt.h>
+
+#define PROBE0(name) DTRACE_PROBE(chat, name)
+#define PROBE1(name, a) DTRACE_PROBE1(chat, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(chat, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(chat, name, a, b, c)
+
+#else
+
+// sizeof keeps the arguments used without evaluating them
+#define PROBE0(name) do {} while (0)
+#define PROBE1(name, a) do { (void)sizeof(a); } while (0)
+#define PROBE2(name, a, b) do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define PROBE3(name, a, b, c) do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+
+#endif
+
+#endif /* _PROBES_H_ */
@@ -22,6 +22,7 @@
 
 #include "queue.h"
 #include "helper.h"
+#include "slab.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -48,28 +49,27 @@ DEFINE_CLASS(Queue,
 	struct _QueueElement* tail;
 );
 
+DEFINE_SLAB(Queue, sizeof(struct _Queue));
+DEFINE_SLAB(QueueElement, sizeof(struct _QueueElement));
+
 Queue QueueCreate() {
-	Queue queue = malloc(sizeof(struct _Queue));
+	Queue queue = SlabAlloc(QueueSlab);
 	
 	if (queue == NULL) {
-		perror("malloc");
+		perror("SlabAlloc");
 		return NULL;
 	}
 	
-	memset(queue, 0, sizeof(struct _Queue));
-	
 	ObjectInit(queue, (void (*)(void *))QueueDestroy);
 	
-	struct _QueueElement* node = malloc(sizeof(struct _QueueElement));
+	struct _QueueElement* node = SlabAlloc(QueueElementSlab);
 	
 	if (node == NULL) {
-		perror("malloc");
+		perror("SlabAlloc");
 		Release(queue);
 		return NULL;
 	}
 	
-	memset(node, 0, sizeof(struct _QueueElement));
-	
 	queue->head = node;
 	queue->tail = node;
 	
@@ -81,24 +81,22 @@ void QueueDestroy(Queue queue) {
 	while (element != NULL) {
 		struct _QueueElement* old = element;
 		element = old->next;
-		free(old);
+		SlabFree(QueueElementSlab, old);
 	}
 	
-	free(queue);
+	SlabFree(QueueSlab, queue);
 }
 
 void QueueEnqueue(Queue queue, void* e) {
-	struct _QueueElement* node = malloc(sizeof(struct _QueueElement));
+	struct _QueueElement* node = SlabAlloc(QueueElementSlab);
 	struct _QueueElement* tail;
 	struct _QueueElement* next;
 	
 	if (node == NULL) {
-		perror("malloc");
+		perror("SlabAlloc");
 		return;
 	}
 	
-	memset(node, 0, sizeof(struct _QueueElement));
-	
 	node->element = e;
 	node->dequeued = false;
 	
@@ -155,6 +153,6 @@ void* QueueDrain(Queue queue)
 	}
 	assert(next->dequeued == false);
 	next->dequeued = true;
-	free(head);
+	SlabFree(QueueElementSlab, head);
 	return element;
 }
@@ -0,0 +1,408 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "slab.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <errno.h>
+#include <assert.h>
+
+//
+// Objects per magazine
+//
+#define kSlabMagazineSize 32
+
+//
+// New objects are carved out of chunks of this size
+// (or one magazine worth of objects if they are larger)
+//
+#define kSlabChunkSize (64 * 1024)
+
+//
+// Maximum number of slabs in a process
+//
+#define kSlabMaxSlabs 64
+
+#define kSlabAlignment 16
+
+struct _SlabMagazine {
+	struct _SlabMagazine* next;
+	uint32_t count;
+	void* objects[kSlabMagazineSize];
+};
+
+struct _Slab {
+	const char* name;
+	size_t size;
+	uint32_t index;
+	
+	//
+	// The depot, everything below is protected by the lock
+	//
+	pthread_mutex_t lock;
+	struct _SlabMagazine* fullMagazines;
+	struct _SlabMagazine* emptyMagazines;
+	
+	//
+	// Chunk new objects are carved from
+	//
+	char* chunk;
+	size_t chunkLeft;
+	size_t chunkSize;
+	
+	uint64_t allocations;
+	uint64_t frees;
+	uint64_t peak;
+};
+
+//
+// The magazines of a thread for one slab. When both are
+// empty (or full) the thread goes to the depot.
+//
+struct _SlabCache {
+	struct _SlabMagazine* loaded;
+	struct _SlabMagazine* previous;
+	
+	//
+	// Counted locally and added to the slab
+	// when visiting the depot
+	//
+	uint64_t allocations;
+	uint64_t frees;
+};
+
+static struct _Slab* _SlabRegistry[kSlabMaxSlabs];
+static uint32_t _SlabRegistryCount;
+static pthread_mutex_t _SlabRegistryLock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct _SlabCache _SlabCaches[kSlabMaxSlabs];
+static __thread bool _SlabCachesRegistered;
+static pthread_key_t _SlabCachesKey;
+static pthread_once_t _SlabCachesKeyOnce = PTHREAD_ONCE_INIT;
+
+static struct _SlabCache* _SlabGetCache(Slab slab);
+static void _SlabCachesKeyInit(void);
+static void _SlabCachesFlush(void* ptr);
+static void _SlabFlushCounters(Slab slab, struct _SlabCache* cache);
+static void _SlabPushMagazine(Slab slab, struct _SlabMagazine* magazine);
+static struct _SlabMagazine* _SlabPopEmptyMagazine(Slab slab);
+static void _SlabRefill(Slab slab, struct _SlabCache* cache);
+static void _SlabExchange(Slab slab, struct _SlabCache* cache);
+
+Slab SlabCreate(const char* name, size_t size)
+{
+	Slab slab;
+	
+	assert(size > 0);
+	
+	slab = malloc(sizeof(struct _Slab));
+	
+	if (slab == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+	
+	memset(slab, 0, sizeof(struct _Slab));
+	
+	slab->name = name;
+	slab->size = (size + kSlabAlignment - 1) & ~(size_t)(kSlabAlignment - 1);
+	slab->chunkSize = kSlabChunkSize;
+	if (slab->chunkSize < slab->size * kSlabMagazineSize)
+		slab->chunkSize = slab->size * kSlabMagazineSize;
+	pthread_mutex_init(&slab->lock, NULL);
+	
+	pthread_mutex_lock(&_SlabRegistryLock);
+	
+	if (_SlabRegistryCount == kSlabMaxSlabs) {
+		pthread_mutex_unlock(&_SlabRegistryLock);
+		printf("Too many slabs.\n");
+		pthread_mutex_destroy(&slab->lock);
+		free(slab);
+		return NULL;
+	}
+	
+	slab->index = _SlabRegistryCount;
+	_SlabRegistry[_SlabRegistryCount++] = slab;
+	
+	pthread_mutex_unlock(&_SlabRegistryLock);
+	
+	return slab;
+}
+
+void* SlabAlloc(Slab slab)
+{
+	struct _SlabCache* cache = _SlabGetCache(slab);
+	void* object;
+	
+	if (cache->loaded == NULL || cache->loaded->count == 0) {
+		if (cache->previous && cache->previous->count > 0) {
+			struct _SlabMagazine* magazine = cache->loaded;
+			
+			cache->loaded = cache->previous;
+			cache->previous = magazine;
+		}
+		else {
+			_SlabRefill(slab, cache);
+			
+			if (cache->loaded == NULL || cache->loaded->count == 0) {
+				errno = ENOMEM;
+				return NULL;
+			}
+		}
+	}
+	
+	object = cache->loaded->objects[--cache->loaded->count];
+	cache->allocations++;
+	
+	memset(object, 0, slab->size);
+	
+	return object;
+}
+
+void SlabFree(Slab slab, void* object)
+{
+	struct _SlabCache* cache;
+	
+	if (object == NULL)
+		return;
+	
+	cache = _SlabGetCache(slab);
+	
+	if (cache->loaded == NULL || cache->loaded->count == kSlabMagazineSize) {
+		if (cache->previous && cache->previous->count < kSlabMagazineSize) {
+			struct _SlabMagazine* magazine = cache->loaded;
+			
+			cache->loaded = cache->previous;
+			cache->previous = magazine;
+		}
+		else {
+			_SlabExchange(slab, cache);
+		}
+	}
+	
+	cache->loaded->objects[cache->loaded->count++] = object;
+	cache->frees++;
+}
+
+uint32_t SlabCopyStats(SlabStats* stats, uint32_t max)
+{
+	uint32_t count;
+	
+	pthread_mutex_lock(&_SlabRegistryLock);
+	
+	count = _SlabRegistryCount < max ? _SlabRegistryCount : max;
+	
+	for (uint32_t i = 0; i < count; i++) {
+		Slab slab = _SlabRegistry[i];
+		
+		pthread_mutex_lock(&slab->lock);
+		stats[i].name = slab->name;
+		stats[i].objectSize = slab->size;
+		stats[i].allocations = slab->allocations;
+		stats[i].frees = slab->frees;
+		stats[i].live = slab->allocations > slab->frees ? slab->allocations - slab->frees : 0;
+		stats[i].peak = slab->peak;
+		pthread_mutex_unlock(&slab->lock);
+	}
+	
+	pthread_mutex_unlock(&_SlabRegistryLock);
+	
+	return count;
+}
+
+static struct _SlabCache* _SlabGetCache(Slab slab)
+{
+	// Give the magazines back when the thread exits
+	if (!_SlabCachesRegistered) {
+		pthread_once(&_SlabCachesKeyOnce, _SlabCachesKeyInit);
+		pthread_setspecific(_SlabCachesKey, _SlabCaches);
+		_SlabCachesRegistered = true;
+	}
+	
+	return &_SlabCaches[slab->index];
+}
+
+static void _SlabCachesKeyInit(void)
+{
+	if (pthread_key_create(&_SlabCachesKey, _SlabCachesFlush) != 0)
+		perror("pthread_key_create");
+}
+
+static void _SlabCachesFlush(void* ptr)
+{
+	struct _SlabCache* caches = ptr;
+	uint32_t count;
+	
+	pthread_mutex_lock(&_SlabRegistryLock);
+	count = _SlabRegistryCount;
+	pthread_mutex_unlock(&_SlabRegistryLock);
+	
+	for (uint32_t i = 0; i < count; i++) {
+		Slab slab = _SlabRegistry[i];
+		struct _SlabCache* cache = &caches[i];
+		
+		pthread_mutex_lock(&slab->lock);
+		_SlabFlushCounters(slab, cache);
+		if (cache->loaded)
+			_SlabPushMagazine(slab, cache->loaded);
+		if (cache->previous)
+			_SlabPushMagazine(slab, cache->previous);
+		pthread_mutex_unlock(&slab->lock);
+		
+		cache->loaded = NULL;
+		cache->previous = NULL;
+	}
+}
+
+//
+// Must be called with the lock held
+//
+static void _SlabFlushCounters(Slab slab, struct _SlabCache* cache)
+{
+	slab->allocations += cache->allocations;
+	slab->frees += cache->frees;
+	cache->allocations = 0;
+	cache->frees = 0;
+	
+	if (slab->allocations > slab->frees && slab->allocations - slab->frees > slab->peak)
+		slab->peak = slab->allocations - slab->frees;
+}
+
+//
+// Must be called with the lock held
+//
+static void _SlabPushMagazine(Slab slab, struct _SlabMagazine* magazine)
+{
+	if (magazine->count > 0) {
+		magazine->next = slab->fullMagazines;
+		slab->fullMagazines = magazine;
+	}
+	else {
+		magazine->next = slab->emptyMagazines;
+		slab->emptyMagazines = magazine;
+	}
+}
+
+//
+// Must be called with the lock held
+//
+static struct _SlabMagazine* _SlabPopEmptyMagazine(Slab slab)
+{
+	struct _SlabMagazine* magazine = slab->emptyMagazines;
+	
+	if (magazine) {
+		slab->emptyMagazines = magazine->next;
+		return magazine;
+	}
+	
+	magazine = malloc(sizeof(struct _SlabMagazine));
+	
+	if (magazine == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+	
+	magazine->count = 0;
+	
+	return magazine;
+}
+
+//
+// Both magazines are empty, get a full one from the
+// depot or carve new objects
+//
+static void _SlabRefill(Slab slab, struct _SlabCache* cache)
+{
+	struct _SlabMagazine* magazine;
+	
+	pthread_mutex_lock(&slab->lock);
+	
+	_SlabFlushCounters(slab, cache);
+	
+	magazine = slab->fullMagazines;
+	
+	if (magazine) {
+		slab->fullMagazines = magazine->next;
+		
+		if (cache->loaded)
+			_SlabPushMagazine(slab, cache->loaded);
+		cache->loaded = magazine;
+	}
+	else {
+		magazine = cache->loaded ? cache->loaded : _SlabPopEmptyMagazine(slab);
+		
+		if (magazine) {
+			cache->loaded = magazine;
+			
+			while (magazine->count < kSlabMagazineSize) {
+				if (slab->chunkLeft < slab->size) {
+					slab->chunk = malloc(slab->chunkSize);
+					
+					if (slab->chunk == NULL) {
+						perror("malloc");
+						slab->chunkLeft = 0;
+						break;
+					}
+					
+					slab->chunkLeft = slab->chunkSize;
+				}
+				
+				magazine->objects[magazine->count++] = slab->chunk;
+				slab->chunk += slab->size;
+				slab->chunkLeft -= slab->size;
+			}
+		}
+	}
+	
+	pthread_mutex_unlock(&slab->lock);
+}
+
+//
+// Both magazines are full, give one to the depot
+// and continue with an empty one
+//
+static void _SlabExchange(Slab slab, struct _SlabCache* cache)
+{
+	struct _SlabMagazine* magazine;
+	
+	pthread_mutex_lock(&slab->lock);
+	
+	_SlabFlushCounters(slab, cache);
+	
+	if (cache->previous)
+		_SlabPushMagazine(slab, cache->previous);
+	
+	cache->previous = cache->loaded;
+	magazine = _SlabPopEmptyMagazine(slab);
+	
+	pthread_mutex_unlock(&slab->lock);
+	
+	// Nothing sensible we can do
+	if (magazine == NULL)
+		abort();
+	
+	cache->loaded = magazine;
+}
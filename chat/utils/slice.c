@@ -0,0 +1,166 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "slice.h"
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+
+//
+// The searches are built on memchr/memcmp, which the C
+// library implements with SIMD
+//
+
+Slice SliceMake(const char* data, size_t length)
+{
+	Slice slice = { data, length };
+	
+	return slice;
+}
+
+Slice SliceFromString(const char* string)
+{
+	return SliceMake(string, strlen(string));
+}
+
+Slice SliceFrom(Slice slice, size_t start)
+{
+	if (start > slice.length)
+		start = slice.length;
+	
+	return SliceMake(slice.data + start, slice.length - start);
+}
+
+Slice SliceTo(Slice slice, size_t length)
+{
+	if (length > slice.length)
+		length = slice.length;
+	
+	return SliceMake(slice.data, length);
+}
+
+Slice SliceTrim(Slice slice)
+{
+	while (slice.length > 0 && isspace((unsigned char)slice.data[0])) {
+		slice.data++;
+		slice.length--;
+	}
+	
+	while (slice.length > 0 && isspace((unsigned char)slice.data[slice.length - 1]))
+		slice.length--;
+	
+	return slice;
+}
+
+size_t SliceFind(Slice slice, char c)
+{
+	const char* match = memchr(slice.data, c, slice.length);
+	
+	if (match == NULL)
+		return kSliceNotFound;
+	
+	return (size_t)(match - slice.data);
+}
+
+size_t SliceFindSlice(Slice slice, Slice needle)
+{
+	size_t offset = 0;
+	
+	if (needle.length == 0)
+		return 0;
+	
+	// Jump from one candidate first byte to the next
+	while (slice.length - offset >= needle.length) {
+		const char* match = memchr(slice.data + offset, needle.data[0], slice.length - offset - needle.length + 1);
+		
+		if (match == NULL)
+			break;
+		
+		offset = (size_t)(match - slice.data);
+		
+		if (memcmp(match, needle.data, needle.length) == 0)
+			return offset;
+		
+		offset++;
+	}
+	
+	return kSliceNotFound;
+}
+
+bool SliceNextToken(Slice* rest, char delimiter, Slice* token)
+{
+	while (rest->length > 0) {
+		size_t index = SliceFind(*rest, delimiter);
+		
+		if (index == kSliceNotFound)
+			index = rest->length;
+		
+		*token = SliceTo(*rest, index);
+		*rest = SliceFrom(*rest, index + 1);
+		
+		if (token->length > 0)
+			return true;
+	}
+	
+	return false;
+}
+
+int SliceCompare(Slice a, Slice b)
+{
+	int cmp = memcmp(a.data, b.data, a.length < b.length ? a.length : b.length);
+	
+	if (cmp != 0)
+		return cmp;
+	
+	if (a.length == b.length)
+		return 0;
+	
+	return a.length < b.length ? -1 : 1;
+}
+
+bool SliceEqualsString(Slice slice, const char* string)
+{
+	return strncmp(slice.data, string, slice.length) == 0 && string[slice.length] == '\0';
+}
+
+bool SliceEqualsCaseInsensitive(Slice a, Slice b)
+{
+	return a.length == b.length && strncasecmp(a.data, b.data, a.length) == 0;
+}
+
+char* SliceCopy(Slice slice)
+{
+	char* copy = malloc(slice.length + 1);
+	
+	if (copy == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+	
+	memcpy(copy, slice.data, slice.length);
+	copy[slice.length] = '\0';
+	
+	return copy;
+}
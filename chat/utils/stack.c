@@ -21,6 +21,7 @@
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "stack.h"
+#include "slab.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -34,18 +35,19 @@ DEFINE_CLASS(Stack,
 	uint32_t slots;
 );
 
+DEFINE_SLAB(Stack, sizeof(struct _Stack));
+
 static void StackDealloc(void* ptr);
 
 Stack StackCreate()
 {
-	Stack stack = malloc(sizeof(struct _Stack));
+	Stack stack = SlabAlloc(StackSlab);
 	
 	if (stack == NULL) {
-		perror("malloc");
+		perror("SlabAlloc");
 		return NULL;
 	}
 	
-	memset(stack, 0, sizeof(struct _Stack));
 	ObjectInit(stack, StackDealloc);
 	
 	stack->uppermostObject = -1;
@@ -87,5 +89,5 @@ static void StackDealloc(void* ptr)
 	
 	if (stack->stack)
 		free(stack->stack);
-	free(stack);
+	SlabFree(StackSlab, stack);
 }
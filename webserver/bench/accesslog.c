@@ -0,0 +1,256 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+//
+// Measures the CPU time the access log costs at a fixed
+// request rate. Producer threads append records on a
+// schedule like workers would, the time of the writer
+// thread is what the process used beyond the producers.
+// Afterwards the log stays idle for a while to show what
+// the writer costs without traffic.
+//
+//   make bench && ./bench/accesslog [rate] [seconds] [threads]
+//
+// Segments are written to a temporary directory that is
+// removed at the end.
+//
+
+#include "http/httpaccesslog.h"
+#include "utils/helper.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#define kBenchDefaultRate 200000.0
+#define kBenchDefaultSeconds 5.0
+#define kBenchDefaultThreads 4
+#define kBenchSegmentSize (64 * 1024 * 1024)
+#define kBenchIdleSeconds 2
+
+//
+// Distinct paths requested, like the files of a site
+//
+#define kBenchPaths 64
+
+//
+// Records appended between looks at the clock
+//
+#define kBenchBatch 16
+
+typedef struct {
+	pthread_t thread;
+	uint32_t index;
+	uint64_t records;
+	
+	//
+	// CPU time of the appends and of the whole thread
+	// in seconds
+	//
+	double appendTime;
+	double threadTime;
+} BenchProducer;
+
+static double BenchRate = kBenchDefaultRate;
+static double BenchSeconds = kBenchDefaultSeconds;
+static uint32_t BenchThreads = kBenchDefaultThreads;
+
+static double BenchCPUTime(clockid_t clock);
+static void* BenchProducerRun(void* ptr);
+static void BenchRemoveSegments(const char* directory);
+
+int main(int argc, char** argv)
+{
+	char directory[] = "/tmp/accesslog.XXXXXX";
+	char path[64];
+	BenchProducer* producers;
+	uint64_t records = 0;
+	double appendTime = 0;
+	double producerTime = 0;
+	double start;
+	double busy;
+	double idle;
+	
+	if (argc > 1)
+		BenchRate = strtod(argv[1], NULL);
+	if (argc > 2)
+		BenchSeconds = strtod(argv[2], NULL);
+	if (argc > 3)
+		BenchThreads = (uint32_t)strtoul(argv[3], NULL, 10);
+	
+	if (BenchRate <= 0 || BenchSeconds <= 0 || BenchThreads < 1) {
+		printf("Usage: %s [rate] [seconds] [threads]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	
+	if (mkdtemp(directory) == NULL) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+	
+	snprintf(path, sizeof(path), "%s/log", directory);
+	
+	producers = calloc(BenchThreads, sizeof(BenchProducer));
+	
+	if (producers == NULL) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+	
+	start = BenchCPUTime(CLOCK_PROCESS_CPUTIME_ID);
+	
+	if (!HTTPAccessLogOpen(path, kBenchSegmentSize))
+		return EXIT_FAILURE;
+	
+	for (uint32_t i = 0; i < BenchThreads; i++) {
+		producers[i].index = i;
+		
+		if (pthread_create(&producers[i].thread, NULL, BenchProducerRun, &producers[i]) != 0) {
+			perror("pthread_create");
+			return EXIT_FAILURE;
+		}
+	}
+	
+	for (uint32_t i = 0; i < BenchThreads; i++) {
+		pthread_join(producers[i].thread, NULL);
+		records += producers[i].records;
+		appendTime += producers[i].appendTime;
+		producerTime += producers[i].threadTime;
+	}
+	
+	// Let the writer catch up
+	usleep(100000);
+	busy = BenchCPUTime(CLOCK_PROCESS_CPUTIME_ID) - start - producerTime;
+	
+	start = BenchCPUTime(CLOCK_PROCESS_CPUTIME_ID);
+	sleep(kBenchIdleSeconds);
+	idle = BenchCPUTime(CLOCK_PROCESS_CPUTIME_ID) - start;
+	
+	printf("%.0f records/s for %.1f s from %u threads, %llu records, %llu dropped\n", BenchRate, BenchSeconds, BenchThreads, (unsigned long long)records, (unsigned long long)HTTPAccessLogGetDropped());
+	printf("append    %8.1f ns per record\n", appendTime * 1e9 / (double)records);
+	printf("writer    %8.1f ns per record, %.2f%% of a core\n", busy * 1e9 / (double)records, busy * 100.0 / BenchSeconds);
+	printf("idle      %8.3f%% of a core\n", idle * 100.0 / kBenchIdleSeconds);
+	
+	BenchRemoveSegments(directory);
+	free(producers);
+	
+	return EXIT_SUCCESS;
+}
+
+static double BenchCPUTime(clockid_t clock)
+{
+	struct timespec now;
+	
+	clock_gettime(clock, &now);
+	
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+//
+// Only the appends are timed, the pacing and the setup
+// of the records are left out
+//
+static void* BenchProducerRun(void* ptr)
+{
+	BenchProducer* producer = ptr;
+	HTTPAccessLogRecord* records = calloc(kBenchPaths, sizeof(HTTPAccessLogRecord));
+	uint64_t interval = (uint64_t)(1e9 * BenchThreads / BenchRate);
+	uint64_t begin = monotonicTime();
+	uint64_t end = begin + (uint64_t)(BenchSeconds * 1e9);
+	
+	if (records == NULL) {
+		perror("calloc");
+		return NULL;
+	}
+	
+	for (uint32_t i = 0; i < kBenchPaths; i++) {
+		records[i].status = 200;
+		records[i].bytes = 1024;
+		records[i].duration = 50000;
+		records[i].address.sin6_family = AF_INET6;
+		snprintf(records[i].path, sizeof(records[i].path), "/static/file%u.html", i);
+	}
+	
+	for (;;) {
+		uint64_t now = monotonicTime();
+		uint64_t due;
+		
+		if (now >= end)
+			break;
+		
+		// Catch up with the schedule in batches
+		due = (now - begin) / interval;
+		
+		if (producer->records >= due) {
+			struct timespec wait;
+			uint64_t next = begin + (producer->records + kBenchBatch) * interval - now;
+			
+			wait.tv_sec = (time_t)(next / 1000000000ull);
+			wait.tv_nsec = (long)(next % 1000000000ull);
+			nanosleep(&wait, NULL);
+			continue;
+		}
+		
+		double start = BenchCPUTime(CLOCK_THREAD_CPUTIME_ID);
+		
+		for (; producer->records < due; producer->records++) {
+			HTTPAccessLogRecord* record = &records[(producer->records * 7 + producer->index) % kBenchPaths];
+			
+			record->time = wallClockTime();
+			HTTPAccessLogAppend(record);
+		}
+		
+		producer->appendTime += BenchCPUTime(CLOCK_THREAD_CPUTIME_ID) - start;
+	}
+	
+	producer->threadTime = BenchCPUTime(CLOCK_THREAD_CPUTIME_ID);
+	free(records);
+	
+	return NULL;
+}
+
+static void BenchRemoveSegments(const char* directory)
+{
+	DIR* dir = opendir(directory);
+	struct dirent* entry;
+	char path[512];
+	
+	if (dir == NULL) {
+		perror("opendir");
+		return;
+	}
+	
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		
+		snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+		unlink(path);
+	}
+	
+	closedir(dir);
+	rmdir(directory);
+}
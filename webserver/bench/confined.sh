@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# Compares the request path with and without confined objects.
+# Builds the webserver twice, once with NO_CONFINED=1, and runs
+# bench/httpload.sh against each build with the same options.
+#
+#   ./bench/confined.sh [httpload options]
+#
+# Small files keep the time in the request path rather than
+# in sendfile, e.g. NOMIX=1 ./bench/confined.sh -u /1k -c 64 -d 30
+#
+
+set -e
+
+run() {
+	# Only object.c depends on the flag
+	touch utils/object.c
+	make "$@" webserver bench > /dev/null
+}
+
+echo "== confined"
+run
+./bench/httpload.sh "$@"
+
+echo
+echo "== NO_CONFINED=1"
+run NO_CONFINED=1
+./bench/httpload.sh "$@"
+
+# Leave the default build behind
+run
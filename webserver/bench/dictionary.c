@@ -0,0 +1,132 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+//
+// Measures the dictionary with 10 up to 1M keys. The keys
+// are inserted in sorted order, like the nicknames of the
+// chat server.
+//
+//   make bench && ./bench/dictionary
+//
+
+#include "utils/object.h"
+#include "utils/dictionary.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define kBenchMaxKeys 1000000
+#define kBenchLookups 1000000
+#define kBenchKeyLength 16
+
+static double BenchNow(void);
+static void BenchRun(size_t count, char** keys, char** missingKeys);
+
+int main(void)
+{
+	char** keys = malloc(sizeof(char*) * kBenchMaxKeys);
+	char** missingKeys = malloc(sizeof(char*) * kBenchMaxKeys);
+	
+	if (keys == NULL || missingKeys == NULL) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	
+	ObjectRuntimeInit();
+	
+	for (size_t i = 0; i < kBenchMaxKeys; i++) {
+		keys[i] = malloc(kBenchKeyLength);
+		missingKeys[i] = malloc(kBenchKeyLength);
+		
+		if (keys[i] == NULL || missingKeys[i] == NULL) {
+			perror("malloc");
+			return EXIT_FAILURE;
+		}
+		
+		snprintf(keys[i], kBenchKeyLength, "Derp%zu", i);
+		snprintf(missingKeys[i], kBenchKeyLength, "Nope%zu", i);
+	}
+	
+	printf("%10s %12s %12s %12s %12s\n", "keys", "insert ns", "hit ns", "miss ns", "remove ns");
+	
+	for (size_t count = 10; count <= kBenchMaxKeys; count *= 10)
+		BenchRun(count, keys, missingKeys);
+	
+	for (size_t i = 0; i < kBenchMaxKeys; i++) {
+		free(keys[i]);
+		free(missingKeys[i]);
+	}
+	free(keys);
+	free(missingKeys);
+	
+	return EXIT_SUCCESS;
+}
+
+static double BenchNow(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+}
+
+static void BenchRun(size_t count, char** keys, char** missingKeys)
+{
+	Dictionary dict = DictionaryCreate();
+	double insert, hit, miss, remove;
+	double start;
+	size_t found = 0;
+	
+	if (dict == NULL) {
+		printf("Could not create dictionary.\n");
+		return;
+	}
+	
+	start = BenchNow();
+	for (size_t i = 0; i < count; i++)
+		DictionarySet(dict, keys[i], keys[i]);
+	insert = (BenchNow() - start) / (double)count;
+	
+	start = BenchNow();
+	for (size_t i = 0; i < kBenchLookups; i++)
+		found += DictionaryGet(dict, keys[i % count]) != NULL;
+	hit = (BenchNow() - start) / kBenchLookups;
+	
+	start = BenchNow();
+	for (size_t i = 0; i < kBenchLookups; i++)
+		found += DictionaryGet(dict, missingKeys[i % count]) != NULL;
+	miss = (BenchNow() - start) / kBenchLookups;
+	
+	start = BenchNow();
+	for (size_t i = 0; i < count; i++)
+		DictionaryRemove(dict, keys[i]);
+	remove = (BenchNow() - start) / (double)count;
+	
+	if (found != kBenchLookups || DictionaryGetCount(dict) != 0)
+		printf("Dictionary is broken (%zu found).\n", found);
+	
+	printf("%10zu %12.1f %12.1f %12.1f %12.1f\n", count, insert, hit, miss, remove);
+	
+	Release(dict);
+}
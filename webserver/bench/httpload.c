@@ -0,0 +1,1151 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+//
+// HTTP load generator for the webserver.
+//
+// Closed loop (the default) every connection sends its next
+// request as soon as a response arrived. Open loop (-R) the
+// requests are sent at a fixed total rate, no matter how fast
+// the server answers. The latency of a request is then taken
+// from the time it should have been sent, so a stalled server
+// shows up in the percentiles instead of just slowing down
+// the measurement (coordinated omission).
+//
+// Latencies go to HdrHistogram style histograms with three
+// significant digits.
+//
+//   make bench && ./bench/httpload -c 64 -d 10 -R 20000 127.0.0.1 8080
+//
+// See bench/httpload.sh for a complete run.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+//
+// Histogram layout: values below 2^kLoadHistogramSubBits
+// microseconds are exact, above that every power of two is
+// split into 2^(kLoadHistogramSubBits - 1) buckets, which
+// keeps three significant digits
+//
+#define kLoadHistogramSubBits 11
+#define kLoadHistogramSubCount (1 << kLoadHistogramSubBits)
+#define kLoadHistogramHalfCount (kLoadHistogramSubCount / 2)
+#define kLoadHistogramBuckets 24
+#define kLoadHistogramCounts ((kLoadHistogramBuckets + 1) * kLoadHistogramHalfCount)
+
+//
+// Most requests in flight on one connection (-p)
+//
+#define kLoadMaxPipelineDepth 64
+
+//
+// Longest response header that is accepted
+//
+#define kLoadMaxHeaderLength 8192
+
+#define kLoadReadBufferSize (64 * 1024)
+#define kLoadMaxPaths 1024
+#define kLoadMaxThreads 256
+
+typedef struct {
+	uint64_t counts[kLoadHistogramCounts];
+	uint64_t total;
+	uint64_t max;
+	double sum;
+	double sumOfSquares;
+} LoadHistogram;
+
+typedef struct {
+	const char* path;
+	uint32_t weight;
+	char* request;
+	size_t requestLength;
+} LoadPath;
+
+typedef enum {
+	kLoadParseHeader,
+	kLoadParseBody,
+	kLoadParseBodyUntilClose
+} LoadParseState;
+
+//
+// A request that was sent and waits for its response
+//
+typedef struct {
+	uint64_t intendedTime;
+	uint64_t sendTime;
+} LoadPending;
+
+typedef struct {
+	int fd;
+	bool connected;
+	
+	//
+	// Requests that were sent, oldest first
+	//
+	LoadPending pending[kLoadMaxPipelineDepth];
+	uint32_t firstPending;
+	uint32_t numOfPending;
+	
+	//
+	// Bytes of requests that did not fit into the socket
+	//
+	char* out;
+	size_t outLength;
+	size_t outCapacity;
+	
+	//
+	// Events registered with epoll
+	//
+	uint32_t events;
+	
+	//
+	// Response parsing
+	//
+	LoadParseState state;
+	char header[kLoadMaxHeaderLength];
+	size_t headerLength;
+	uint32_t status;
+	uint64_t bodyLeft;
+	bool closeAfterResponse;
+} LoadConnection;
+
+typedef struct {
+	pthread_t thread;
+	uint32_t index;
+	int epoll;
+	
+	LoadConnection* connections;
+	uint32_t numOfConnections;
+	
+	//
+	// Open loop: request n of this thread is due at
+	// start + n * interval
+	//
+	uint64_t start;
+	uint64_t interval;
+	uint64_t sent;
+	
+	uint64_t random;
+	
+	//
+	// Results, reset when the warmup ends
+	//
+	LoadHistogram latency;
+	LoadHistogram serviceTime;
+	uint64_t responses;
+	uint64_t bytes;
+	uint64_t status[6];
+	uint64_t connectErrors;
+	uint64_t readErrors;
+	uint64_t writeErrors;
+	uint64_t parseErrors;
+	uint64_t lost;
+	uint64_t connects;
+} LoadWorker;
+
+//
+// Options, set once before the workers start
+//
+static struct addrinfo* LoadAddress;
+static LoadPath LoadPaths[kLoadMaxPaths];
+static uint32_t LoadNumOfPaths;
+static uint32_t LoadTotalWeight;
+static uint32_t LoadConnections = 16;
+static uint32_t LoadThreads = 1;
+static uint32_t LoadDepth = 1;
+static bool LoadKeepAlive;
+static double LoadRate;
+static uint64_t LoadDuration = 10 * 1000000000ull;
+static uint64_t LoadWarmup;
+static uint64_t LoadEndTime;
+static uint64_t LoadMeasureStart;
+static bool LoadSpectrum;
+
+static uint64_t LoadNow(void);
+static bool LoadParseOptions(int argc, char** argv);
+static bool LoadReadMix(const char* file);
+static bool LoadAddPath(const char* path, uint32_t weight);
+static bool LoadBuildRequests(const char* host);
+static void* LoadWorkerRun(void* ptr);
+static void LoadWorkerReset(LoadWorker* worker);
+static void LoadConnect(LoadWorker* worker, LoadConnection* connection);
+static void LoadDisconnect(LoadWorker* worker, LoadConnection* connection, bool failed);
+static void LoadFill(LoadWorker* worker, LoadConnection* connection, uint64_t now);
+static void LoadSend(LoadWorker* worker, LoadConnection* connection, uint64_t intendedTime, uint64_t now);
+static void LoadFlush(LoadWorker* worker, LoadConnection* connection);
+static void LoadUpdateEvents(LoadWorker* worker, LoadConnection* connection);
+static void LoadRead(LoadWorker* worker, LoadConnection* connection);
+static size_t LoadParse(LoadWorker* worker, LoadConnection* connection, const char* data, size_t length);
+static bool LoadParseHeader(LoadConnection* connection);
+static void LoadRecord(LoadWorker* worker, LoadConnection* connection);
+static void LoadComplete(LoadWorker* worker, LoadConnection* connection);
+static uint64_t LoadRandom(LoadWorker* worker);
+static void LoadHistogramRecord(LoadHistogram* histogram, uint64_t value);
+static void LoadHistogramAdd(LoadHistogram* to, const LoadHistogram* from);
+static uint64_t LoadHistogramValueAt(const LoadHistogram* histogram, uint32_t index);
+static uint64_t LoadHistogramPercentile(const LoadHistogram* histogram, double percentile);
+static void LoadHistogramPrint(const char* title, const LoadHistogram* histogram);
+static void LoadHistogramPrintSpectrum(const LoadHistogram* histogram);
+static bool LoadReport(LoadWorker* workers);
+static void LoadUsage(const char* name);
+
+int main(int argc, char** argv)
+{
+	LoadWorker* workers;
+	
+	if (!LoadParseOptions(argc, argv))
+		return EXIT_FAILURE;
+	
+	workers = calloc(LoadThreads, sizeof(LoadWorker));
+	
+	if (workers == NULL) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+	
+	printf("%u threads, %u connections, %s, pipeline depth %u, ", LoadThreads, LoadConnections, LoadKeepAlive ? "keep-alive" : "one request per connection", LoadDepth);
+	if (LoadRate > 0)
+		printf("open loop at %.0f requests/s\n", LoadRate);
+	else
+		printf("closed loop\n");
+	
+	LoadMeasureStart = LoadNow() + LoadWarmup;
+	LoadEndTime = LoadMeasureStart + LoadDuration;
+	
+	for (uint32_t i = 0; i < LoadThreads; i++) {
+		LoadWorker* worker = &workers[i];
+		
+		worker->index = i;
+		worker->numOfConnections = LoadConnections / LoadThreads + (i < LoadConnections % LoadThreads ? 1 : 0);
+		worker->random = 0x9e3779b97f4a7c15ull * (i + 1);
+		
+		if (LoadRate > 0)
+			worker->interval = (uint64_t)(1e9 * LoadThreads / LoadRate);
+		
+		if (pthread_create(&worker->thread, NULL, LoadWorkerRun, worker) != 0) {
+			perror("pthread_create");
+			return EXIT_FAILURE;
+		}
+	}
+	
+	for (uint32_t i = 0; i < LoadThreads; i++)
+		pthread_join(workers[i].thread, NULL);
+	
+	// Lets scripts tell a run against a server that
+	// was not there apart
+	return LoadReport(workers) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static uint64_t LoadNow(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static bool LoadParseOptions(int argc, char** argv)
+{
+	const char* host;
+	const char* port = "8080";
+	const char* mix = NULL;
+	struct addrinfo hints;
+	int error;
+	int c;
+	
+	while ((c = getopt(argc, argv, "c:t:p:kR:d:w:u:f:sh")) != -1) {
+		switch (c) {
+			case 'c':
+				LoadConnections = (uint32_t)strtoul(optarg, NULL, 10);
+				break;
+			case 't':
+				LoadThreads = (uint32_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'p':
+				LoadDepth = (uint32_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'k':
+				LoadKeepAlive = true;
+				break;
+			case 'R':
+				LoadRate = strtod(optarg, NULL);
+				break;
+			case 'd':
+				LoadDuration = (uint64_t)(strtod(optarg, NULL) * 1e9);
+				break;
+			case 'w':
+				LoadWarmup = (uint64_t)(strtod(optarg, NULL) * 1e9);
+				break;
+			case 'u':
+				if (!LoadAddPath(optarg, 1))
+					return false;
+				break;
+			case 'f':
+				mix = optarg;
+				break;
+			case 's':
+				LoadSpectrum = true;
+				break;
+			default:
+				LoadUsage(argv[0]);
+				return false;
+		}
+	}
+	
+	if (optind >= argc) {
+		LoadUsage(argv[0]);
+		return false;
+	}
+	
+	host = argv[optind];
+	if (optind + 1 < argc)
+		port = argv[optind + 1];
+	
+	if (mix && !LoadReadMix(mix))
+		return false;
+	
+	if (LoadNumOfPaths == 0 && !LoadAddPath("/", 1))
+		return false;
+	
+	if (LoadThreads < 1 || LoadThreads > kLoadMaxThreads) {
+		printf("Threads must be between 1 and %d\n", kLoadMaxThreads);
+		return false;
+	}
+	
+	if (LoadConnections < LoadThreads) {
+		printf("Need at least one connection per thread\n");
+		return false;
+	}
+	
+	if (LoadDepth < 1 || LoadDepth > kLoadMaxPipelineDepth) {
+		printf("Pipeline depth must be between 1 and %d\n", kLoadMaxPipelineDepth);
+		return false;
+	}
+	
+	// Without keep-alive the server closes after the
+	// first response, everything behind it would be lost
+	if (!LoadKeepAlive && LoadDepth > 1) {
+		printf("Pipelining needs keep-alive (-k)\n");
+		return false;
+	}
+	
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	
+	error = getaddrinfo(host, port, &hints, &LoadAddress);
+	if (error != 0) {
+		printf("%s: %s\n", host, gai_strerror(error));
+		return false;
+	}
+	
+	return LoadBuildRequests(host);
+}
+
+//
+// Every line of the mix is "weight path", lines
+// starting with # are ignored
+//
+static bool LoadReadMix(const char* file)
+{
+	FILE* f = fopen(file, "r");
+	char line[1024];
+	
+	if (f == NULL) {
+		perror(file);
+		return false;
+	}
+	
+	while (fgets(line, sizeof(line), f)) {
+		char path[1024];
+		unsigned int weight;
+		
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		
+		if (sscanf(line, "%u %1023s", &weight, path) != 2) {
+			printf("%s: can not parse %s", file, line);
+			fclose(f);
+			return false;
+		}
+		
+		if (!LoadAddPath(path, weight)) {
+			fclose(f);
+			return false;
+		}
+	}
+	
+	fclose(f);
+	
+	return true;
+}
+
+static bool LoadAddPath(const char* path, uint32_t weight)
+{
+	if (LoadNumOfPaths >= kLoadMaxPaths) {
+		printf("Too many paths, at most %d\n", kLoadMaxPaths);
+		return false;
+	}
+	
+	if (weight == 0)
+		return true;
+	
+	LoadPaths[LoadNumOfPaths].path = strdup(path);
+	LoadPaths[LoadNumOfPaths].weight = weight;
+	LoadNumOfPaths++;
+	LoadTotalWeight += weight;
+	
+	return true;
+}
+
+static bool LoadBuildRequests(const char* host)
+{
+	const char* connection = LoadKeepAlive ? "keep-alive" : "close";
+	
+	for (uint32_t i = 0; i < LoadNumOfPaths; i++) {
+		size_t size = strlen(LoadPaths[i].path) + strlen(host) + strlen(connection) + 64;
+		int length;
+		
+		LoadPaths[i].request = malloc(size);
+		if (LoadPaths[i].request == NULL) {
+			perror("malloc");
+			return false;
+		}
+		
+		length = snprintf(LoadPaths[i].request, size, "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n", LoadPaths[i].path, host, connection);
+		LoadPaths[i].requestLength = (size_t)length;
+	}
+	
+	return true;
+}
+
+static void* LoadWorkerRun(void* ptr)
+{
+	LoadWorker* worker = ptr;
+	struct epoll_event events[256];
+	bool measuring = false;
+	
+	worker->epoll = epoll_create1(0);
+	if (worker->epoll < 0) {
+		perror("epoll_create1");
+		return NULL;
+	}
+	
+	worker->connections = calloc(worker->numOfConnections, sizeof(LoadConnection));
+	if (worker->connections == NULL) {
+		perror("calloc");
+		return NULL;
+	}
+	
+	// Spread the threads over one interval, so they
+	// do not all send at the same moment
+	worker->start = LoadNow() + worker->interval * worker->index / LoadThreads;
+	
+	for (uint32_t i = 0; i < worker->numOfConnections; i++) {
+		worker->connections[i].fd = -1;
+		LoadConnect(worker, &worker->connections[i]);
+	}
+	
+	for (;;) {
+		uint64_t now = LoadNow();
+		int timeout = 100;
+		int count;
+		
+		if (now >= LoadEndTime)
+			break;
+		
+		if (!measuring && now >= LoadMeasureStart) {
+			LoadWorkerReset(worker);
+			measuring = true;
+		}
+		
+		// Also reconnects connections that failed to connect
+		for (uint32_t i = 0; i < worker->numOfConnections; i++)
+			LoadFill(worker, &worker->connections[i], now);
+		
+		// Open loop: sleep until the next request is due
+		if (worker->interval) {
+			uint64_t due = worker->start + worker->sent * worker->interval;
+			
+			timeout = due > now ? (int)((due - now + 999999) / 1000000) : 0;
+		}
+		
+		count = epoll_wait(worker->epoll, events, 256, timeout);
+		
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+			
+			perror("epoll_wait");
+			break;
+		}
+		
+		for (int i = 0; i < count; i++) {
+			LoadConnection* connection = events[i].data.ptr;
+			
+			if (!connection->connected && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+				int error = 0;
+				socklen_t length = sizeof(error);
+				
+				getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+				
+				if (error != 0) {
+					worker->connectErrors++;
+					LoadDisconnect(worker, connection, false);
+					LoadConnect(worker, connection);
+					continue;
+				}
+				
+				connection->connected = true;
+				LoadFill(worker, connection, LoadNow());
+				LoadUpdateEvents(worker, connection);
+				continue;
+			}
+			
+			if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+				LoadRead(worker, connection);
+			
+			if (connection->fd >= 0 && (events[i].events & EPOLLOUT))
+				LoadFlush(worker, connection);
+		}
+	}
+	
+	for (uint32_t i = 0; i < worker->numOfConnections; i++) {
+		if (worker->connections[i].fd >= 0)
+			close(worker->connections[i].fd);
+		free(worker->connections[i].out);
+	}
+	free(worker->connections);
+	close(worker->epoll);
+	
+	return NULL;
+}
+
+static void LoadWorkerReset(LoadWorker* worker)
+{
+	memset(&worker->latency, 0, sizeof(worker->latency));
+	memset(&worker->serviceTime, 0, sizeof(worker->serviceTime));
+	worker->responses = 0;
+	worker->bytes = 0;
+	memset(worker->status, 0, sizeof(worker->status));
+	worker->connectErrors = 0;
+	worker->readErrors = 0;
+	worker->writeErrors = 0;
+	worker->parseErrors = 0;
+	worker->lost = 0;
+	worker->connects = 0;
+}
+
+static void LoadConnect(LoadWorker* worker, LoadConnection* connection)
+{
+	struct epoll_event event;
+	int fd = socket(LoadAddress->ai_family, LoadAddress->ai_socktype | SOCK_NONBLOCK, LoadAddress->ai_protocol);
+	static const int kOn = 1;
+	
+	connection->connected = false;
+	connection->state = kLoadParseHeader;
+	connection->headerLength = 0;
+	connection->outLength = 0;
+	connection->closeAfterResponse = false;
+	
+	if (fd < 0) {
+		perror("socket");
+		worker->connectErrors++;
+		return;
+	}
+	
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &kOn, sizeof(kOn));
+	
+	if (connect(fd, LoadAddress->ai_addr, LoadAddress->ai_addrlen) < 0 && errno != EINPROGRESS) {
+		worker->connectErrors++;
+		close(fd);
+		return;
+	}
+	
+	connection->fd = fd;
+	worker->connects++;
+	
+	event.events = EPOLLOUT;
+	event.data.ptr = connection;
+	connection->events = EPOLLOUT;
+	
+	if (epoll_ctl(worker->epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+		perror("epoll_ctl");
+		close(fd);
+		connection->fd = -1;
+	}
+}
+
+//
+// Closes the connection. Requests still waiting for their
+// response are lost, unless the close ends a response that
+// has no length.
+//
+static void LoadDisconnect(LoadWorker* worker, LoadConnection* connection, bool failed)
+{
+	if (connection->fd < 0)
+		return;
+	
+	if (connection->connected && connection->state == kLoadParseBodyUntilClose && !failed)
+		LoadRecord(worker, connection);
+	
+	worker->lost += connection->numOfPending;
+	
+	connection->numOfPending = 0;
+	connection->firstPending = 0;
+	
+	close(connection->fd);
+	connection->fd = -1;
+	connection->connected = false;
+}
+
+//
+// Sends as many requests as the connection can take,
+// closed loop up to the depth, open loop only those
+// that are due
+//
+static void LoadFill(LoadWorker* worker, LoadConnection* connection, uint64_t now)
+{
+	if (connection->fd < 0) {
+		LoadConnect(worker, connection);
+		return;
+	}
+	
+	if (!connection->connected || connection->closeAfterResponse)
+		return;
+	
+	while (connection->numOfPending < LoadDepth) {
+		uint64_t intendedTime = now;
+		
+		// Without keep-alive every connection gets
+		// exactly one request
+		if (!LoadKeepAlive && connection->numOfPending > 0)
+			break;
+		
+		if (worker->interval) {
+			intendedTime = worker->start + worker->sent * worker->interval;
+			
+			if (intendedTime > now)
+				break;
+		}
+		
+		if (now >= LoadEndTime)
+			break;
+		
+		worker->sent++;
+		LoadSend(worker, connection, intendedTime, now);
+		
+		if (connection->fd < 0)
+			break;
+	}
+	
+	LoadFlush(worker, connection);
+}
+
+static void LoadSend(LoadWorker* worker, LoadConnection* connection, uint64_t intendedTime, uint64_t now)
+{
+	uint32_t pick = (uint32_t)(LoadRandom(worker) % LoadTotalWeight);
+	uint32_t index = (connection->firstPending + connection->numOfPending) % kLoadMaxPipelineDepth;
+	LoadPath* path = LoadPaths;
+	
+	while (pick >= path->weight) {
+		pick -= path->weight;
+		path++;
+	}
+	
+	if (connection->outLength + path->requestLength > connection->outCapacity) {
+		size_t capacity = connection->outLength + path->requestLength + 4096;
+		char* out = realloc(connection->out, capacity);
+		
+		if (out == NULL) {
+			perror("realloc");
+			worker->writeErrors++;
+			LoadDisconnect(worker, connection, true);
+			return;
+		}
+		
+		connection->out = out;
+		connection->outCapacity = capacity;
+	}
+	
+	memcpy(connection->out + connection->outLength, path->request, path->requestLength);
+	connection->outLength += path->requestLength;
+	
+	connection->pending[index].intendedTime = intendedTime;
+	connection->pending[index].sendTime = now;
+	connection->numOfPending++;
+}
+
+static void LoadFlush(LoadWorker* worker, LoadConnection* connection)
+{
+	if (connection->fd < 0)
+		return;
+	
+	while (connection->outLength > 0) {
+		ssize_t sent = send(connection->fd, connection->out, connection->outLength, MSG_NOSIGNAL);
+		
+		if (sent < 0) {
+			if (errno == EAGAIN)
+				break;
+			
+			worker->writeErrors++;
+			LoadDisconnect(worker, connection, true);
+			return;
+		}
+		
+		memmove(connection->out, connection->out + sent, connection->outLength - (size_t)sent);
+		connection->outLength -= (size_t)sent;
+	}
+	
+	LoadUpdateEvents(worker, connection);
+}
+
+static void LoadUpdateEvents(LoadWorker* worker, LoadConnection* connection)
+{
+	struct epoll_event event;
+	uint32_t events = EPOLLIN;
+	
+	if (connection->fd < 0 || !connection->connected)
+		return;
+	
+	if (connection->outLength > 0)
+		events |= EPOLLOUT;
+	
+	if (events == connection->events)
+		return;
+	
+	event.events = events;
+	event.data.ptr = connection;
+	epoll_ctl(worker->epoll, EPOLL_CTL_MOD, connection->fd, &event);
+	
+	connection->events = events;
+}
+
+static void LoadRead(LoadWorker* worker, LoadConnection* connection)
+{
+	char buffer[kLoadReadBufferSize];
+	
+	for (;;) {
+		ssize_t length = recv(connection->fd, buffer, sizeof(buffer), 0);
+		size_t offset = 0;
+		
+		if (length == 0) {
+			LoadDisconnect(worker, connection, false);
+			LoadFill(worker, connection, LoadNow());
+			return;
+		}
+		
+		if (length < 0) {
+			if (errno == EAGAIN)
+				return;
+			
+			worker->readErrors++;
+			LoadDisconnect(worker, connection, true);
+			LoadFill(worker, connection, LoadNow());
+			return;
+		}
+		
+		worker->bytes += (uint64_t)length;
+		
+		while (offset < (size_t)length && connection->fd >= 0) {
+			size_t used = LoadParse(worker, connection, buffer + offset, (size_t)length - offset);
+			
+			if (used == SIZE_MAX) {
+				worker->parseErrors++;
+				LoadDisconnect(worker, connection, true);
+				LoadFill(worker, connection, LoadNow());
+				return;
+			}
+			
+			offset += used;
+		}
+		
+		if (connection->fd < 0)
+			return;
+		
+		// Do not wait for the server to close, all
+		// responses are in
+		if (connection->closeAfterResponse && connection->state == kLoadParseHeader && connection->numOfPending == 0) {
+			LoadDisconnect(worker, connection, false);
+			LoadFill(worker, connection, LoadNow());
+			return;
+		}
+	}
+}
+
+//
+// Feeds data to the response parser, returns how much of it
+// was used or SIZE_MAX if the response is broken
+//
+static size_t LoadParse(LoadWorker* worker, LoadConnection* connection, const char* data, size_t length)
+{
+	if (connection->state == kLoadParseHeader) {
+		size_t used = 0;
+		
+		// Byte by byte until the end of the header, the
+		// header is small compared to the body
+		while (used < length) {
+			if (connection->headerLength >= kLoadMaxHeaderLength - 1)
+				return SIZE_MAX;
+			
+			connection->header[connection->headerLength++] = data[used++];
+			
+			if (connection->headerLength >= 4 && memcmp(connection->header + connection->headerLength - 4, "\r\n\r\n", 4) == 0)
+				break;
+		}
+		
+		if (connection->headerLength < 4 || memcmp(connection->header + connection->headerLength - 4, "\r\n\r\n", 4) != 0)
+			return used;
+		
+		connection->header[connection->headerLength] = '\0';
+		
+		if (connection->numOfPending == 0 || !LoadParseHeader(connection))
+			return SIZE_MAX;
+		
+		if (connection->state == kLoadParseBody && connection->bodyLeft == 0)
+			LoadComplete(worker, connection);
+		
+		return used;
+	}
+	
+	if (connection->state == kLoadParseBodyUntilClose)
+		return length;
+	
+	if (length < connection->bodyLeft) {
+		connection->bodyLeft -= length;
+		return length;
+	}
+	
+	length = (size_t)connection->bodyLeft;
+	LoadComplete(worker, connection);
+	
+	return length;
+}
+
+static bool LoadParseHeader(LoadConnection* connection)
+{
+	char* line = connection->header;
+	bool hasLength = false;
+	
+	if (strncmp(line, "HTTP/1.", 7) != 0 || strlen(line) < 12)
+		return false;
+	
+	connection->status = (uint32_t)strtoul(line + 9, NULL, 10);
+	
+	// We asked for the close ourselves without keep-alive
+	connection->closeAfterResponse = !LoadKeepAlive || strncmp(line, "HTTP/1.0", 8) == 0;
+	connection->bodyLeft = 0;
+	
+	for (line = strstr(line, "\r\n"); line && line[2] != '\r'; line = strstr(line, "\r\n")) {
+		line += 2;
+		
+		if (strncasecmp(line, "Content-Length:", 15) == 0) {
+			connection->bodyLeft = strtoull(line + 15, NULL, 10);
+			hasLength = true;
+		}
+		else if (strncasecmp(line, "Connection:", 11) == 0) {
+			char* value = line + 11;
+			
+			while (*value == ' ')
+				value++;
+			
+			if (strncasecmp(value, "close", 5) == 0)
+				connection->closeAfterResponse = true;
+			else if (LoadKeepAlive && strncasecmp(value, "keep-alive", 10) == 0)
+				connection->closeAfterResponse = false;
+		}
+	}
+	
+	// 204 and 304 never have a body
+	if (connection->status == 204 || connection->status == 304)
+		hasLength = true;
+	
+	connection->state = hasLength ? kLoadParseBody : kLoadParseBodyUntilClose;
+	
+	// Without a length the body ends with the connection
+	if (!hasLength)
+		connection->closeAfterResponse = true;
+	
+	return true;
+}
+
+//
+// Records the latency of the oldest pending request
+//
+static void LoadRecord(LoadWorker* worker, LoadConnection* connection)
+{
+	LoadPending* pending = &connection->pending[connection->firstPending];
+	uint64_t now = LoadNow();
+	
+	if (now >= LoadMeasureStart && pending->sendTime >= LoadMeasureStart) {
+		LoadHistogramRecord(&worker->latency, (now - pending->intendedTime) / 1000);
+		LoadHistogramRecord(&worker->serviceTime, (now - pending->sendTime) / 1000);
+		worker->status[connection->status / 100 < 6 ? connection->status / 100 : 0]++;
+		worker->responses++;
+	}
+	
+	connection->firstPending = (connection->firstPending + 1) % kLoadMaxPipelineDepth;
+	connection->numOfPending--;
+	connection->state = kLoadParseHeader;
+	connection->headerLength = 0;
+}
+
+//
+// Finishes a response and refills the connection. One that
+// is about to be closed is left to LoadRead.
+//
+static void LoadComplete(LoadWorker* worker, LoadConnection* connection)
+{
+	LoadRecord(worker, connection);
+	
+	if (!connection->closeAfterResponse)
+		LoadFill(worker, connection, LoadNow());
+}
+
+//
+// xorshift64*
+//
+static uint64_t LoadRandom(LoadWorker* worker)
+{
+	worker->random ^= worker->random >> 12;
+	worker->random ^= worker->random << 25;
+	worker->random ^= worker->random >> 27;
+	
+	return worker->random * 0x2545f4914f6cdd1dull;
+}
+
+static void LoadHistogramRecord(LoadHistogram* histogram, uint64_t value)
+{
+	uint32_t bucket = 64 - (uint32_t)__builtin_clzll(value | (kLoadHistogramSubCount - 1)) - kLoadHistogramSubBits;
+	uint32_t subBucket;
+	uint32_t index;
+	
+	if (bucket >= kLoadHistogramBuckets) {
+		bucket = kLoadHistogramBuckets - 1;
+		subBucket = kLoadHistogramSubCount - 1;
+	}
+	else
+		subBucket = (uint32_t)(value >> bucket);
+	
+	// The lower half of every bucket but the
+	// first is covered by the one before
+	index = bucket == 0 ? subBucket : (bucket + 1) * kLoadHistogramHalfCount + (subBucket - kLoadHistogramHalfCount);
+	
+	histogram->counts[index]++;
+	histogram->total++;
+	histogram->sum += (double)value;
+	histogram->sumOfSquares += (double)value * (double)value;
+	if (value > histogram->max)
+		histogram->max = value;
+}
+
+static void LoadHistogramAdd(LoadHistogram* to, const LoadHistogram* from)
+{
+	for (uint32_t i = 0; i < kLoadHistogramCounts; i++)
+		to->counts[i] += from->counts[i];
+	
+	to->total += from->total;
+	to->sum += from->sum;
+	to->sumOfSquares += from->sumOfSquares;
+	if (from->max > to->max)
+		to->max = from->max;
+}
+
+//
+// Returns the highest value that ends up at index
+//
+static uint64_t LoadHistogramValueAt(const LoadHistogram* histogram, uint32_t index)
+{
+	uint32_t bucket;
+	uint64_t subBucket;
+	
+	if (index < kLoadHistogramSubCount)
+		return index;
+	
+	bucket = index / kLoadHistogramHalfCount - 1;
+	subBucket = index % kLoadHistogramHalfCount + kLoadHistogramHalfCount;
+	
+	uint64_t value = ((subBucket + 1) << bucket) - 1;
+	
+	return value < histogram->max ? value : histogram->max;
+}
+
+static uint64_t LoadHistogramPercentile(const LoadHistogram* histogram, double percentile)
+{
+	uint64_t target = (uint64_t)((double)histogram->total * percentile / 100.0 + 0.5);
+	uint64_t cumulative = 0;
+	
+	if (target < 1)
+		target = 1;
+	
+	for (uint32_t i = 0; i < kLoadHistogramCounts; i++) {
+		cumulative += histogram->counts[i];
+		
+		if (cumulative >= target)
+			return LoadHistogramValueAt(histogram, i);
+	}
+	
+	return histogram->max;
+}
+
+static void LoadHistogramPrint(const char* title, const LoadHistogram* histogram)
+{
+	static const double kPercentiles[] = { 50, 75, 90, 99, 99.9, 99.99, 99.999, 100 };
+	
+	printf("%s (us)\n", title);
+	
+	if (histogram->total == 0) {
+		printf("  no responses\n");
+		return;
+	}
+	
+	printf("  mean %10.1f\n", histogram->sum / (double)histogram->total);
+	
+	for (size_t i = 0; i < sizeof(kPercentiles) / sizeof(kPercentiles[0]); i++)
+		printf("  %7.3f%% %10" PRIu64 "\n", kPercentiles[i], LoadHistogramPercentile(histogram, kPercentiles[i]));
+}
+
+//
+// Prints the percentile spectrum in the .hgrm format of
+// HdrHistogram, which its plotter reads
+//
+static void LoadHistogramPrintSpectrum(const LoadHistogram* histogram)
+{
+	uint64_t cumulative = 0;
+	double mean;
+	double variance;
+	
+	if (histogram->total == 0)
+		return;
+	
+	mean = histogram->sum / (double)histogram->total;
+	variance = histogram->sumOfSquares / (double)histogram->total - mean * mean;
+	
+	printf("%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+	
+	for (uint32_t i = 0; i < kLoadHistogramCounts && cumulative < histogram->total; i++) {
+		uint64_t value;
+		double percentile;
+		
+		if (histogram->counts[i] == 0)
+			continue;
+		
+		value = LoadHistogramValueAt(histogram, i);
+		cumulative += histogram->counts[i];
+		percentile = (double)cumulative / (double)histogram->total;
+		
+		if (cumulative < histogram->total)
+			printf("%12.3f %14.12f %10" PRIu64 " %14.2f\n", (double)value / 1000.0, percentile, cumulative, 1.0 / (1.0 - percentile));
+		else
+			printf("%12.3f %14.12f %10" PRIu64 "\n", (double)value / 1000.0, percentile, cumulative);
+	}
+	
+	printf("#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", mean / 1000.0, sqrt(variance > 0 ? variance : 0) / 1000.0);
+	printf("#[Max     = %12.3f, Total count    = %12" PRIu64 "]\n", (double)histogram->max / 1000.0, histogram->total);
+}
+
+//
+// Returns false if no responses came in or more
+// connects failed than responses came in
+//
+static bool LoadReport(LoadWorker* workers)
+{
+	LoadWorker* total = calloc(1, sizeof(LoadWorker));
+	double seconds = (double)LoadDuration / 1e9;
+	bool success;
+	
+	if (total == NULL) {
+		perror("calloc");
+		return false;
+	}
+	
+	for (uint32_t i = 0; i < LoadThreads; i++) {
+		LoadHistogramAdd(&total->latency, &workers[i].latency);
+		LoadHistogramAdd(&total->serviceTime, &workers[i].serviceTime);
+		total->responses += workers[i].responses;
+		total->bytes += workers[i].bytes;
+		for (uint32_t j = 0; j < 6; j++)
+			total->status[j] += workers[i].status[j];
+		total->connectErrors += workers[i].connectErrors;
+		total->readErrors += workers[i].readErrors;
+		total->writeErrors += workers[i].writeErrors;
+		total->parseErrors += workers[i].parseErrors;
+		total->lost += workers[i].lost;
+		total->connects += workers[i].connects;
+	}
+	
+	printf("\n%" PRIu64 " responses in %.1fs, %.1f requests/s, %.2f MB/s, %" PRIu64 " connects\n", total->responses, seconds, (double)total->responses / seconds, (double)total->bytes / seconds / 1e6, total->connects);
+	printf("status 2xx %" PRIu64 ", 3xx %" PRIu64 ", 4xx %" PRIu64 ", 5xx %" PRIu64 "\n", total->status[2], total->status[3], total->status[4], total->status[5]);
+	printf("errors connect %" PRIu64 ", read %" PRIu64 ", write %" PRIu64 ", parse %" PRIu64 ", lost %" PRIu64 "\n\n", total->connectErrors, total->readErrors, total->writeErrors, total->parseErrors, total->lost);
+	
+	if (LoadRate > 0) {
+		LoadHistogramPrint("Latency from the intended send time", &total->latency);
+		LoadHistogramPrint("Service time from the actual send", &total->serviceTime);
+	}
+	else
+		LoadHistogramPrint("Latency", &total->serviceTime);
+	
+	if (LoadSpectrum) {
+		printf("\nDetailed percentile spectrum (ms)\n");
+		LoadHistogramPrintSpectrum(LoadRate > 0 ? &total->latency : &total->serviceTime);
+	}
+	
+	success = total->responses > 0 && total->connectErrors <= total->responses;
+	free(total);
+	
+	return success;
+}
+
+static void LoadUsage(const char* name)
+{
+	printf("Usage: %s [options] host [port]\n", name);
+	printf("  -c  Connections (default 16)\n");
+	printf("  -t  Threads (default 1)\n");
+	printf("  -k  Keep connections alive\n");
+	printf("  -p  Requests in flight per connection, needs -k (default 1)\n");
+	printf("  -R  Open loop at this many requests/s in total (default closed loop)\n");
+	printf("  -d  Seconds to measure (default 10)\n");
+	printf("  -w  Seconds of warmup before measuring (default 0)\n");
+	printf("  -u  Request this path, may be repeated (default /)\n");
+	printf("  -f  Request mix file, lines of \"weight path\"\n");
+	printf("  -s  Print the detailed percentile spectrum (.hgrm)\n");
+}
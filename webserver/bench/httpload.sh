@@ -0,0 +1,61 @@
+#!/bin/sh
+#
+# Runs bench/httpload against a freshly started webserver that
+# serves a generated docroot of mixed file sizes.
+#
+#   make webserver bench && ./bench/httpload.sh [httpload options]
+#
+# The options are passed to httpload, e.g. -c 64 -R 20000 -d 30.
+# PORT picks the port (default 8089), KEEP=1 keeps the docroot.
+# NOMIX=1 requests only the paths given with -u (e.g. -u /1k).
+#
+
+set -e
+
+PORT=${PORT:-8089}
+DIR=$(mktemp -d /tmp/httpload.XXXXXX)
+DOCROOT="$DIR/docroot"
+MIX="$DIR/mix"
+
+cleanup() {
+	[ -n "$SERVER" ] && kill "$SERVER" 2>/dev/null || true
+	[ -n "$KEEP" ] || rm -rf "$DIR"
+}
+trap cleanup EXIT INT TERM
+
+# Mostly small files, like a typical site, with a few large ones
+mkdir -p "$DOCROOT"
+: > "$MIX"
+while read -r name size weight; do
+	head -c "$size" /dev/urandom > "$DOCROOT/$name"
+	echo "$weight /$name" >> "$MIX"
+done <<FILES
+1k 1024 60
+10k 10240 25
+100k 102400 10
+1m 1048576 4
+10m 10485760 1
+FILES
+
+./webserver -r "$DOCROOT" "$PORT" > "$DIR/webserver.log" 2>&1 &
+SERVER=$!
+
+# Wait for the listener
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	if ./bench/httpload -c 1 -d 0.1 -u /1k 127.0.0.1 "$PORT" > /dev/null 2>&1; then
+		break
+	fi
+	sleep 0.5
+done
+
+if [ -n "$NOMIX" ]; then
+	./bench/httpload -w 2 "$@" 127.0.0.1 "$PORT"
+else
+	./bench/httpload -f "$MIX" -w 2 "$@" 127.0.0.1 "$PORT"
+fi
+
+# The counters of the server after the run
+if command -v curl > /dev/null; then
+	echo
+	curl -s "http://127.0.0.1:$PORT/status" | grep -E "^webserver_(queue_(depth|threads|shed_total|worker_utilization)|objects_live|poll_wakeups_total)" || true
+fi
@@ -0,0 +1,187 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+//
+// Measures Retain/Release pairs on shared (atomic) and
+// confined objects, single threaded and with several
+// threads that either use an object each or all one.
+//
+//   make bench && ./bench/refcount [threads]
+//
+
+#include "utils/object.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#define kBenchPairs 20000000
+#define kBenchDefaultThreads 4
+
+DECLARE_CLASS(BenchObject);
+
+DEFINE_CLASS(BenchObject,
+	uint32_t value;
+);
+
+typedef struct {
+	pthread_t thread;
+	BenchObject object;
+	double nanoseconds;
+} BenchThread;
+
+static double BenchNow(void);
+static BenchObject BenchObjectCreate(bool confined);
+static void BenchObjectDealloc(void* ptr);
+static double BenchPairs(BenchObject object);
+static void* BenchThreadRun(void* ptr);
+static void BenchThreads(const char* name, uint32_t numOfThreads, bool shareObject);
+
+int main(int argc, char** argv)
+{
+	uint32_t numOfThreads = kBenchDefaultThreads;
+	BenchObject shared;
+	BenchObject confined;
+	
+	if (argc > 1)
+		numOfThreads = (uint32_t)strtoul(argv[1], NULL, 10);
+	
+	if (numOfThreads < 1)
+		numOfThreads = 1;
+	
+	ObjectRuntimeInit();
+	
+	shared = BenchObjectCreate(false);
+	confined = BenchObjectCreate(true);
+	
+	if (shared == NULL || confined == NULL)
+		return EXIT_FAILURE;
+	
+	printf("%-48s %12s\n", "case", "ns per pair");
+	printf("%-48s %12.2f\n", "shared, 1 thread", BenchPairs(shared));
+	printf("%-48s %12.2f\n", "confined, 1 thread", BenchPairs(confined));
+	
+	BenchThreads("shared, own object per thread", numOfThreads, false);
+	BenchThreads("shared, one object for all threads", numOfThreads, true);
+	
+	Release(shared);
+	Release(confined);
+	
+	return EXIT_SUCCESS;
+}
+
+static double BenchNow(void)
+{
+	struct timespec now;
+	
+	// CPU time of the thread, so threads that share a
+	// cpu do not count each other
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	
+	return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+}
+
+static BenchObject BenchObjectCreate(bool confined)
+{
+	BenchObject object = malloc(sizeof(struct _BenchObject));
+	
+	if (object == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+	
+	memset(object, 0, sizeof(struct _BenchObject));
+	
+	ObjectInit(object, &BenchObjectClass, BenchObjectDealloc);
+	
+	if (confined)
+		ObjectSetConfined(object);
+	
+	return object;
+}
+
+static void BenchObjectDealloc(void* ptr)
+{
+	free(ptr);
+}
+
+//
+// Returns the time of one Retain/Release pair in ns
+//
+static double BenchPairs(BenchObject object)
+{
+	double start = BenchNow();
+	
+	for (uint32_t i = 0; i < kBenchPairs; i++) {
+		Retain(object);
+		Release(object);
+	}
+	
+	return (BenchNow() - start) / kBenchPairs;
+}
+
+static void* BenchThreadRun(void* ptr)
+{
+	BenchThread* thread = ptr;
+	
+	thread->nanoseconds = BenchPairs(thread->object);
+	
+	return NULL;
+}
+
+static void BenchThreads(const char* name, uint32_t numOfThreads, bool shareObject)
+{
+	BenchThread* threads = calloc(numOfThreads, sizeof(BenchThread));
+	BenchObject object = shareObject ? BenchObjectCreate(false) : NULL;
+	double nanoseconds = 0;
+	char title[64];
+	
+	if (threads == NULL) {
+		perror("calloc");
+		return;
+	}
+	
+	for (uint32_t i = 0; i < numOfThreads; i++) {
+		threads[i].object = shareObject ? Retain(object) : BenchObjectCreate(false);
+		
+		if (threads[i].object == NULL || pthread_create(&threads[i].thread, NULL, BenchThreadRun, &threads[i]) != 0) {
+			printf("Could not start thread.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	
+	for (uint32_t i = 0; i < numOfThreads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		nanoseconds += threads[i].nanoseconds;
+		Release(threads[i].object);
+	}
+	
+	if (object)
+		Release(object);
+	
+	snprintf(title, sizeof(title), "%s, %u threads", name, numOfThreads);
+	printf("%-48s %12.2f\n", title, nanoseconds / numOfThreads);
+	
+	free(threads);
+}
@@ -0,0 +1,633 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "httpaccesslog.h"
+
+#include "utils/helper.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+
+//
+// Records per thread, must be a power of two
+//
+#define kHTTPAccessLogRingSize 1024
+
+//
+// Paths remembered per segment, must be a power of two.
+// The table is kept at most half full, later paths are
+// written again with every request.
+//
+#define kHTTPAccessLogPathTableSize 4096
+
+//
+// Smaller segments are rounded up to this
+//
+#define kHTTPAccessLogMinSegmentSize (64 * 1024)
+
+//
+// How long the writer sleeps between rounds in nanoseconds.
+// A producer whose ring gets a quarter full wakes it earlier,
+// so the interval only bounds how late records reach the
+// file. Every wakeup costs, the fewer the better.
+//
+#define kHTTPAccessLogWriteInterval 10000000ull
+
+typedef enum {
+	kHTTPAccessLogWriterRunning = 0,
+	
+	// Woken by a ring that is a quarter full or by the timeout
+	kHTTPAccessLogWriterSleeping = 1,
+	
+	// Nothing came in for a whole sleep, woken by the
+	// next record
+	kHTTPAccessLogWriterBlocked = 2
+} HTTPAccessLogWriterState;
+
+//
+// How long the writer drops records after a segment could
+// not be started before it tries again in nanoseconds
+//
+#define kHTTPAccessLogRetryDelay 1000000000ull
+
+struct HTTPAccessLogRing {
+	struct HTTPAccessLogRing* next;
+	
+	//
+	// Set while a thread produces into this ring. Rings of
+	// exited threads are taken over by new ones.
+	//
+	int inUse;
+	
+	// Only written by the producer
+	uint32_t head __attribute__((aligned(64)));
+	// Only written by the writer thread
+	uint32_t tail __attribute__((aligned(64)));
+	
+	HTTPAccessLogRecord records[kHTTPAccessLogRingSize];
+};
+
+static bool HTTPAccessLogOpened;
+static uint64_t HTTPAccessLogDropped;
+
+//
+// A producer that finds a reason to wake the writer sets
+// the state back to running and signals
+//
+static int HTTPAccessLogWriterCurrentState;
+static pthread_mutex_t HTTPAccessLogWriterLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t HTTPAccessLogWriterCondition = PTHREAD_COND_INITIALIZER;
+
+//
+// All rings ever created, they are never freed
+//
+static struct HTTPAccessLogRing* HTTPAccessLogRings;
+static __thread struct HTTPAccessLogRing* HTTPAccessLogCurrentRing;
+static pthread_key_t HTTPAccessLogRingKey;
+
+//
+// Only used by the writer thread (and before it started)
+//
+static char* HTTPAccessLogPath;
+static size_t HTTPAccessLogSegmentSize;
+static int HTTPAccessLogFile = -1;
+static char* HTTPAccessLogSegment;
+static size_t HTTPAccessLogSegmentUsed;
+
+//
+// Number the last finished segment was moved to and
+// when to try again after starting a segment failed
+//
+static uint64_t HTTPAccessLogSegmentNumber;
+static uint64_t HTTPAccessLogRetryTime;
+
+struct HTTPAccessLogPathSlot {
+	uint32_t hash;
+	uint32_t id;
+	
+	// Offset of the path entry in the segment,
+	// 0 if the slot is empty
+	size_t offset;
+};
+
+static struct HTTPAccessLogPathSlot HTTPAccessLogPaths[kHTTPAccessLogPathTableSize];
+static uint32_t HTTPAccessLogPathCount;
+static uint32_t HTTPAccessLogNextPathId;
+
+static struct HTTPAccessLogRing* HTTPAccessLogGetRing(void);
+static void HTTPAccessLogReleaseRing(void* ptr);
+static void* HTTPAccessLogWriter(void* context);
+static bool HTTPAccessLogHasRecords(void);
+static void HTTPAccessLogWaitForRecords(HTTPAccessLogWriterState state);
+static void HTTPAccessLogWrite(const HTTPAccessLogRecord* record);
+static uint32_t HTTPAccessLogWritePath(const char* path, size_t length);
+static bool HTTPAccessLogOpenSegment(void);
+static void HTTPAccessLogCloseSegment(void);
+static bool HTTPAccessLogMoveSegment(void);
+static uint64_t HTTPAccessLogFindSegmentNumber(void);
+
+bool HTTPAccessLogOpen(const char* path, size_t segmentSize)
+{
+	pthread_t thread;
+	
+	HTTPAccessLogPath = strdup(path);
+	HTTPAccessLogSegmentSize = segmentSize < kHTTPAccessLogMinSegmentSize ? kHTTPAccessLogMinSegmentSize : segmentSize;
+	
+	if (HTTPAccessLogPath == NULL) {
+		perror("strdup");
+		return false;
+	}
+	
+	// Continue after the segments of earlier runs
+	HTTPAccessLogSegmentNumber = HTTPAccessLogFindSegmentNumber();
+	
+	if (!HTTPAccessLogOpenSegment())
+		return false;
+	
+	if (pthread_key_create(&HTTPAccessLogRingKey, HTTPAccessLogReleaseRing) != 0) {
+		perror("pthread_key_create");
+		return false;
+	}
+	
+	if (pthread_create(&thread, NULL, HTTPAccessLogWriter, NULL) != 0) {
+		perror("pthread_create");
+		return false;
+	}
+	
+	pthread_detach(thread);
+	__atomic_store_n(&HTTPAccessLogOpened, true, __ATOMIC_RELEASE);
+	
+	return true;
+}
+
+void HTTPAccessLogAppend(const HTTPAccessLogRecord* record)
+{
+	struct HTTPAccessLogRing* ring;
+	uint32_t head;
+	int state;
+	
+	if (!__atomic_load_n(&HTTPAccessLogOpened, __ATOMIC_ACQUIRE))
+		return;
+	
+	ring = HTTPAccessLogGetRing();
+	
+	if (ring == NULL) {
+		__sync_add_and_fetch(&HTTPAccessLogDropped, 1);
+		return;
+	}
+	
+	head = ring->head;
+	
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= kHTTPAccessLogRingSize) {
+		__sync_add_and_fetch(&HTTPAccessLogDropped, 1);
+		return;
+	}
+	
+	memcpy(&ring->records[head & (kHTTPAccessLogRingSize - 1)], record, sizeof(HTTPAccessLogRecord));
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	
+	// Pairs with the fence in HTTPAccessLogWaitForRecords,
+	// either we see the writer waiting or it sees our record
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	
+	state = __atomic_load_n(&HTTPAccessLogWriterCurrentState, __ATOMIC_RELAXED);
+	
+	if (((state == kHTTPAccessLogWriterSleeping && head + 1 - __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) >= kHTTPAccessLogRingSize / 4) || state == kHTTPAccessLogWriterBlocked)
+		&& __sync_bool_compare_and_swap(&HTTPAccessLogWriterCurrentState, state, kHTTPAccessLogWriterRunning)) {
+		pthread_mutex_lock(&HTTPAccessLogWriterLock);
+		pthread_cond_signal(&HTTPAccessLogWriterCondition);
+		pthread_mutex_unlock(&HTTPAccessLogWriterLock);
+	}
+}
+
+uint64_t HTTPAccessLogGetDropped(void)
+{
+	return __atomic_load_n(&HTTPAccessLogDropped, __ATOMIC_RELAXED);
+}
+
+static struct HTTPAccessLogRing* HTTPAccessLogGetRing(void)
+{
+	struct HTTPAccessLogRing* ring = HTTPAccessLogCurrentRing;
+	
+	if (ring != NULL)
+		return ring;
+	
+	// Take over the ring of an exited thread
+	for (ring = __atomic_load_n(&HTTPAccessLogRings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+		if (__sync_bool_compare_and_swap(&ring->inUse, 0, 1))
+			break;
+	}
+	
+	if (ring == NULL) {
+		ring = calloc(1, sizeof(struct HTTPAccessLogRing));
+		
+		if (ring == NULL) {
+			perror("calloc");
+			return NULL;
+		}
+		
+		ring->inUse = 1;
+		
+		do {
+			ring->next = HTTPAccessLogRings;
+		} while (!__sync_bool_compare_and_swap(&HTTPAccessLogRings, ring->next, ring));
+	}
+	
+	HTTPAccessLogCurrentRing = ring;
+	
+	// Gives the ring back when the thread exits
+	pthread_setspecific(HTTPAccessLogRingKey, ring);
+	
+	return ring;
+}
+
+static void HTTPAccessLogReleaseRing(void* ptr)
+{
+	struct HTTPAccessLogRing* ring = ptr;
+	
+	__atomic_store_n(&ring->inUse, 0, __ATOMIC_RELEASE);
+}
+
+static void* HTTPAccessLogWriter(void* context)
+{
+#pragma unused(context)
+	bool sleptIdle = false;
+	
+	for (;;) {
+		bool idle = true;
+		
+		for (struct HTTPAccessLogRing* ring = __atomic_load_n(&HTTPAccessLogRings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+			uint32_t tail = ring->tail;
+			uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+			
+			if (tail == head)
+				continue;
+			
+			idle = false;
+			
+			for (; tail != head; tail++)
+				HTTPAccessLogWrite(&ring->records[tail & (kHTTPAccessLogRingSize - 1)]);
+			
+			// The records are written, the producer
+			// may reuse them
+			__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+		}
+		
+		// Nothing came in for a whole sleep
+		if (idle && sleptIdle)
+			HTTPAccessLogWaitForRecords(kHTTPAccessLogWriterBlocked);
+		else
+			HTTPAccessLogWaitForRecords(kHTTPAccessLogWriterSleeping);
+		
+		sleptIdle = idle;
+	}
+	
+	return NULL;
+}
+
+static bool HTTPAccessLogHasRecords(void)
+{
+	for (struct HTTPAccessLogRing* ring = __atomic_load_n(&HTTPAccessLogRings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+		if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail)
+			return true;
+	}
+	
+	return false;
+}
+
+//
+// Sleeps for kHTTPAccessLogWriteInterval or until a ring is
+// a quarter full, or blocks until the next record comes in
+//
+static void HTTPAccessLogWaitForRecords(HTTPAccessLogWriterState state)
+{
+	struct timespec deadline;
+	uint64_t time = wallClockTime() + kHTTPAccessLogWriteInterval;
+	
+	// pthread_cond_timedwait uses the wall clock
+	deadline.tv_sec = (time_t)(time / 1000000000ull);
+	deadline.tv_nsec = (long)(time % 1000000000ull);
+	
+	pthread_mutex_lock(&HTTPAccessLogWriterLock);
+	
+	__atomic_store_n(&HTTPAccessLogWriterCurrentState, (int)state, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	
+	// A record that came in before the state was set
+	// would not wake us
+	if (state == kHTTPAccessLogWriterBlocked && HTTPAccessLogHasRecords())
+		__atomic_store_n(&HTTPAccessLogWriterCurrentState, kHTTPAccessLogWriterRunning, __ATOMIC_RELAXED);
+	
+	// The producer that resets the state signals
+	// while holding the lock
+	while (__atomic_load_n(&HTTPAccessLogWriterCurrentState, __ATOMIC_RELAXED) != kHTTPAccessLogWriterRunning) {
+		if (state == kHTTPAccessLogWriterBlocked)
+			pthread_cond_wait(&HTTPAccessLogWriterCondition, &HTTPAccessLogWriterLock);
+		else if (pthread_cond_timedwait(&HTTPAccessLogWriterCondition, &HTTPAccessLogWriterLock, &deadline) == ETIMEDOUT)
+			__atomic_store_n(&HTTPAccessLogWriterCurrentState, kHTTPAccessLogWriterRunning, __ATOMIC_RELAXED);
+	}
+	
+	pthread_mutex_unlock(&HTTPAccessLogWriterLock);
+}
+
+//
+// Entries are padded to keep them aligned
+//
+static size_t HTTPAccessLogPathEntryLength(size_t length)
+{
+	return (sizeof(HTTPAccessLogPathEntry) + length + 1 + 7) & ~(size_t)7;
+}
+
+static void HTTPAccessLogWrite(const HTTPAccessLogRecord* record)
+{
+	HTTPAccessLogRequestEntry entry;
+	size_t pathLength = strlen(record->path);
+	
+	// Room for the path in case it is new
+	if (HTTPAccessLogSegment != NULL && HTTPAccessLogSegmentUsed + sizeof(entry) + HTTPAccessLogPathEntryLength(pathLength) > HTTPAccessLogSegmentSize)
+		HTTPAccessLogCloseSegment();
+	
+	if (HTTPAccessLogSegment == NULL && !HTTPAccessLogOpenSegment()) {
+		__sync_add_and_fetch(&HTTPAccessLogDropped, 1);
+		return;
+	}
+	
+	memset(&entry, 0, sizeof(entry));
+	entry.type = kHTTPAccessLogEntryRequest;
+	entry.length = sizeof(entry);
+	entry.pathId = pathLength > 0 ? HTTPAccessLogWritePath(record->path, pathLength) : 0;
+	entry.time = record->time;
+	entry.duration = record->duration;
+	entry.bytes = record->bytes;
+	memcpy(&entry.address, &record->address, sizeof(entry.address));
+	entry.status = record->status;
+	entry.method = record->method;
+	entry.version = record->version;
+	
+	memcpy(HTTPAccessLogSegment + HTTPAccessLogSegmentUsed, &entry, sizeof(entry));
+	HTTPAccessLogSegmentUsed += sizeof(entry);
+}
+
+//
+// Returns the id of path in the current segment, writes
+// a path entry if it is not there yet
+//
+static uint32_t HTTPAccessLogWritePath(const char* path, size_t length)
+{
+	HTTPAccessLogPathEntry entry;
+	uint32_t hash = 2166136261u;
+	size_t index;
+	
+	// FNV-1a
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (uint8_t)path[i];
+		hash *= 16777619u;
+	}
+	
+	for (index = hash & (kHTTPAccessLogPathTableSize - 1); HTTPAccessLogPaths[index].offset != 0; index = (index + 1) & (kHTTPAccessLogPathTableSize - 1)) {
+		struct HTTPAccessLogPathSlot* slot = &HTTPAccessLogPaths[index];
+		
+		if (slot->hash == hash && strcmp(HTTPAccessLogSegment + slot->offset + sizeof(entry), path) == 0)
+			return slot->id;
+	}
+	
+	entry.type = kHTTPAccessLogEntryPath;
+	entry.length = (uint16_t)HTTPAccessLogPathEntryLength(length);
+	entry.id = ++HTTPAccessLogNextPathId;
+	
+	if (HTTPAccessLogPathCount < kHTTPAccessLogPathTableSize / 2) {
+		HTTPAccessLogPaths[index].hash = hash;
+		HTTPAccessLogPaths[index].id = entry.id;
+		HTTPAccessLogPaths[index].offset = HTTPAccessLogSegmentUsed;
+		HTTPAccessLogPathCount++;
+	}
+	
+	// The padding is still zero from ftruncate
+	memcpy(HTTPAccessLogSegment + HTTPAccessLogSegmentUsed, &entry, sizeof(entry));
+	memcpy(HTTPAccessLogSegment + HTTPAccessLogSegmentUsed + sizeof(entry), path, length + 1);
+	HTTPAccessLogSegmentUsed += entry.length;
+	
+	return entry.id;
+}
+
+//
+// Moves the segment left at path away and starts a new one.
+// After a failure nothing is tried again for
+// kHTTPAccessLogRetryDelay, records are dropped meanwhile.
+//
+static bool HTTPAccessLogOpenSegment(void)
+{
+	HTTPAccessLogSegmentHeader header;
+	void* segment;
+	int fd;
+	
+	if (HTTPAccessLogRetryTime != 0 && monotonicTime() < HTTPAccessLogRetryTime)
+		return false;
+	
+	// The segment may still be at path if moving it
+	// failed before, O_EXCL keeps us from truncating it
+	if (!HTTPAccessLogMoveSegment()) {
+		HTTPAccessLogRetryTime = monotonicTime() + kHTTPAccessLogRetryDelay;
+		return false;
+	}
+	
+	fd = open(HTTPAccessLogPath, O_RDWR | O_CREAT | O_EXCL, 0644);
+	
+	if (fd < 0) {
+		perror("open");
+		HTTPAccessLogRetryTime = monotonicTime() + kHTTPAccessLogRetryDelay;
+		return false;
+	}
+	
+	// Reserve the whole segment, the pages are only
+	// backed once they are written
+	if (ftruncate(fd, (off_t)HTTPAccessLogSegmentSize) < 0) {
+		perror("ftruncate");
+		close(fd);
+		unlink(HTTPAccessLogPath);
+		HTTPAccessLogRetryTime = monotonicTime() + kHTTPAccessLogRetryDelay;
+		return false;
+	}
+	
+	segment = mmap(NULL, HTTPAccessLogSegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	
+	if (segment == MAP_FAILED) {
+		perror("mmap");
+		close(fd);
+		unlink(HTTPAccessLogPath);
+		HTTPAccessLogRetryTime = monotonicTime() + kHTTPAccessLogRetryDelay;
+		return false;
+	}
+	
+	HTTPAccessLogRetryTime = 0;
+	
+	HTTPAccessLogFile = fd;
+	HTTPAccessLogSegment = segment;
+	
+	header.magic = kHTTPAccessLogMagic;
+	header.version = kHTTPAccessLogVersion;
+	header.time = wallClockTime();
+	memcpy(HTTPAccessLogSegment, &header, sizeof(header));
+	HTTPAccessLogSegmentUsed = sizeof(header);
+	
+	memset(HTTPAccessLogPaths, 0, sizeof(HTTPAccessLogPaths));
+	HTTPAccessLogPathCount = 0;
+	HTTPAccessLogNextPathId = 0;
+	
+	return true;
+}
+
+//
+// Cuts the segment down to what was used
+//
+static void HTTPAccessLogCloseSegment(void)
+{
+	if (HTTPAccessLogSegment == NULL)
+		return;
+	
+	munmap(HTTPAccessLogSegment, HTTPAccessLogSegmentSize);
+	HTTPAccessLogSegment = NULL;
+	
+	if (ftruncate(HTTPAccessLogFile, (off_t)HTTPAccessLogSegmentUsed) < 0)
+		perror("ftruncate");
+	
+	close(HTTPAccessLogFile);
+	HTTPAccessLogFile = -1;
+}
+
+//
+// Moves the segment at path to path.N, N being one more
+// than the number of the last moved segment. Existing
+// files are never replaced. Returns true if nothing is
+// left at path.
+//
+static bool HTTPAccessLogMoveSegment(void)
+{
+	size_t length = strlen(HTTPAccessLogPath);
+	// Room for the dot and a 64 bit number
+	char* moved = malloc(length + 22);
+	
+	if (moved == NULL) {
+		perror("malloc");
+		return false;
+	}
+	
+	// link fails instead of replacing, skip numbers
+	// that are taken already
+	for (;;) {
+		snprintf(moved, length + 22, "%s.%llu", HTTPAccessLogPath, (unsigned long long)++HTTPAccessLogSegmentNumber);
+		
+		if (link(HTTPAccessLogPath, moved) == 0)
+			break;
+		
+		if (errno == EEXIST)
+			continue;
+		
+		// Nothing to move
+		if (errno == ENOENT) {
+			HTTPAccessLogSegmentNumber--;
+			free(moved);
+			return true;
+		}
+		
+		perror("link");
+		HTTPAccessLogSegmentNumber--;
+		free(moved);
+		return false;
+	}
+	
+	free(moved);
+	
+	if (unlink(HTTPAccessLogPath) < 0) {
+		perror("unlink");
+		return false;
+	}
+	
+	return true;
+}
+
+//
+// Returns the highest N of the path.N files in the
+// directory of path, 0 if there are none
+//
+static uint64_t HTTPAccessLogFindSegmentNumber(void)
+{
+	const char* name = strrchr(HTTPAccessLogPath, '/');
+	size_t nameLength;
+	char* directory;
+	DIR* dir;
+	struct dirent* dirEntry;
+	uint64_t number = 0;
+	
+	if (name == NULL) {
+		directory = strdup(".");
+		name = HTTPAccessLogPath;
+	}
+	else {
+		directory = strndup(HTTPAccessLogPath, name == HTTPAccessLogPath ? 1 : (size_t)(name - HTTPAccessLogPath));
+		name++;
+	}
+	
+	if (directory == NULL) {
+		perror("strdup");
+		return 0;
+	}
+	
+	dir = opendir(directory);
+	free(directory);
+	
+	if (dir == NULL) {
+		perror("opendir");
+		return 0;
+	}
+	
+	nameLength = strlen(name);
+	
+	while ((dirEntry = readdir(dir)) != NULL) {
+		const char* suffix = dirEntry->d_name + nameLength + 1;
+		char* end;
+		unsigned long long value;
+		
+		if (strncmp(dirEntry->d_name, name, nameLength) != 0 || dirEntry->d_name[nameLength] != '.')
+			continue;
+		
+		if (*suffix < '0' || *suffix > '9')
+			continue;
+		
+		value = strtoull(suffix, &end, 10);
+		
+		if (*end == '\0' && value > number)
+			number = value;
+	}
+	
+	closedir(dir);
+	
+	return number;
+}
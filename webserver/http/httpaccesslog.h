@@ -0,0 +1,166 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _HTTPACCESSLOG_H_
+#define _HTTPACCESSLOG_H_
+
+#include "http.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+//
+// The access log keeps printf and its stdio lock off the
+// request path. Workers copy a fixed size record into a
+// ring of their own thread (single producer, single
+// consumer), a background thread appends the records in
+// a binary format to a memory mapped segment file.
+//
+// When the ring of a thread is full, records are dropped
+// rather than blocking the worker.
+//
+// Nothing is formatted while serving, logdecode renders
+// the segments in common or combined log format.
+//
+
+//
+// Longer paths are truncated in the log
+//
+#define kHTTPAccessLogPathLength 128
+
+typedef struct {
+	//
+	// Wall clock time the request started at in nanoseconds
+	// since the epoch
+	//
+	uint64_t time;
+	
+	//
+	// Time it took to answer the request in nanoseconds
+	//
+	uint64_t duration;
+	
+	//
+	// Bytes sent to the client
+	//
+	uint64_t bytes;
+	
+	struct sockaddr_in6 address;
+	
+	uint16_t status;
+	uint8_t method;
+	uint8_t version;
+	
+	char path[kHTTPAccessLogPathLength];
+} HTTPAccessLogRecord;
+
+//
+// File format
+//
+// A segment starts with a HTTPAccessLogSegmentHeader followed
+// by entries, each starting with its type and its length
+// (a multiple of 8). Paths are stored once per segment, requests
+// refer to them by id. The unused end of a segment that was not
+// closed properly is zero, an entry of length 0 ends a segment.
+//
+// Values are in the byte order of the machine that wrote them.
+//
+#define kHTTPAccessLogMagic 0x474c4148 /* HALG */
+#define kHTTPAccessLogVersion 1
+
+typedef enum {
+	kHTTPAccessLogEntryEnd = 0,
+	kHTTPAccessLogEntryPath = 1,
+	kHTTPAccessLogEntryRequest = 2
+} HTTPAccessLogEntryType;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	
+	//
+	// Wall clock time the segment was started at
+	//
+	uint64_t time;
+} HTTPAccessLogSegmentHeader;
+
+typedef struct {
+	uint16_t type;
+	uint16_t length;
+	
+	//
+	// Ids start at 1 in every segment
+	//
+	uint32_t id;
+	
+	// Followed by the \0 terminated path
+} HTTPAccessLogPathEntry;
+
+typedef struct {
+	uint16_t type;
+	uint16_t length;
+	
+	//
+	// 0 when the request had no path
+	//
+	uint32_t pathId;
+	
+	uint64_t time;
+	uint64_t duration;
+	uint64_t bytes;
+	
+	struct sockaddr_in6 address;
+	
+	uint16_t status;
+	uint8_t method;
+	uint8_t version;
+} HTTPAccessLogRequestEntry;
+
+//
+// Starts logging to the file at path. A segment holds up
+// to segmentSize bytes, a full segment is renamed to path.N
+// and a new one is started, N counts up from the highest
+// number found next to path. Moved segments are never
+// replaced, removing old ones is left to the operator.
+// A segment left at path by an earlier run is moved
+// right away.
+//
+// Returns false if the file could not be opened or the
+// writer could not be started.
+//
+bool HTTPAccessLogOpen(const char* path, size_t segmentSize);
+
+//
+// Adds a record to the log, never blocks. Does nothing
+// unless the log was opened.
+//
+void HTTPAccessLogAppend(const HTTPAccessLogRecord* record);
+
+//
+// Returns the number of records dropped because
+// the writer did not keep up
+//
+uint64_t HTTPAccessLogGetDropped(void);
+
+#endif /* _HTTPACCESSLOG_H_ */
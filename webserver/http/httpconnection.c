@@ -26,9 +26,17 @@
 
 #include "utils/str_helper.h"
 #include "utils/dictionary.h"
+#include "utils/dispatchqueue.h"
 #include "utils/helper.h"
+#include "utils/fiber.h"
+#include "utils/slab.h"
+#include "utils/arena.h"
+#include "utils/metrics.h"
+#include "utils/trace.h"
+#include "httpaccesslog.h"
 
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -42,13 +50,51 @@
 #include <sys/sendfile.h>
 #endif
 
-// TODO: Not really nice
+//
+// Where files are served from, without a trailing slash.
+// Change it with HTTPConnectionSetDocumentRoot.
+//
 #ifdef DARWIN
-const char* kHTTPDocumentRoot = "/Users/christian/Public/";
+static const char* kHTTPDocumentRoot = "/Users/christian/Public";
 #else
-const char* kHTTPDocumentRoot = "/home/speich/htdocs";
+static const char* kHTTPDocumentRoot = "/home/speich/htdocs";
 #endif
 
+//
+// Sent instead of processing a request when
+// the processing queue is overloaded
+//
+static const char kHTTPServiceUnavailableResponse[] =
+	"HTTP/1.1 503 Service Unavailable\r\n"
+	"Retry-After: 1\r\n"
+	"Content-Length: 0\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+
+//
+// Requests for this path are answered with the metrics
+// of the server in the Prometheus text format
+//
+static const char kHTTPMetricsPath[] = "/status";
+
+//
+// Requests for this path are answered with the lifecycle
+// trace of sampled requests (Chrome trace event format)
+//
+static const char kHTTPTracePath[] = "/status/trace";
+
+//
+// Size of the first chunk of the arena of a connection,
+// which fits a typical request without growing
+//
+#define kHTTPConnectionArenaSize 8192
+
+//
+// The read buffer starts with this size and doubles
+// when it runs full
+//
+#define kHTTPConnectionBufferSize 256
+
 DEFINE_CLASS(HTTPConnection,
 	int socket;
 	
@@ -56,51 +102,161 @@ DEFINE_CLASS(HTTPConnection,
 		
 	struct sockaddr_in6 info;
 	socklen_t infoLength;
-	// This is to identify the client (ip+port)
-	char* clientInfoLine;
+	
+	//
+	// Everything that only lives as long as the current
+	// request (buffer, resolved path, header strings) is
+	// allocated here and freed at once after the response
+	//
+	Arena arena;
 	
 	char* buffer;
 	size_t bufferFilled;
 	size_t bufferLength;
+	
+	//
+	// For the access log, reset with every request
+	//
+	uint64_t requestTime;
+	uint64_t requestStart;
+	uint64_t bytesSent;
+	
+	//
+	// When the current stage of the request started,
+	// for the stage metrics
+	//
+	uint64_t stageStart;
+	
+	//
+	// Id of the request in the trace, 0 if it
+	// is not sampled
+	//
+	uint64_t traceId;
 );
 
-static void HTTPConnectionReadRequest(HTTPConnection connection);
+DEFINE_SLAB(HTTPConnection, sizeof(struct _HTTPConnection));
+
+DEFINE_METRIC(HTTPAcceptedMetric, "webserver_connections_accepted_total", "Connections accepted", kMetricCounter);
+DEFINE_METRIC(HTTPOpenMetric, "webserver_connections_open", "Connections not yet deallocated", kMetricGauge);
+DEFINE_METRIC(HTTPRequestsMetric, "webserver_requests_total", "Requests answered, including rejected ones", kMetricCounter);
+DEFINE_METRIC(HTTPRejectedMetric, "webserver_requests_rejected_total", "Requests rejected because the server was overloaded", kMetricCounter);
+DEFINE_METRIC(HTTPSentBytesMetric, "webserver_sent_bytes_total", "Bytes sent to clients", kMetricCounter);
+DEFINE_METRIC(HTTPReadMetric, "webserver_read_seconds", "Time from the start of a connection until its request was read", kMetricHistogram);
+DEFINE_METRIC(HTTPDispatchMetric, "webserver_dispatch_seconds", "Time a read request waited for the processing queue", kMetricHistogram);
+DEFINE_METRIC(HTTPParseMetric, "webserver_parse_seconds", "Time spent parsing requests", kMetricHistogram);
+DEFINE_METRIC(HTTPProcessMetric, "webserver_process_seconds", "Time from a parsed request until its response was ready", kMetricHistogram);
+DEFINE_METRIC(HTTPSendMetric, "webserver_send_seconds", "Time spent sending responses", kMetricHistogram);
+
+static void HTTPConnectionRun(HTTPConnection connection);
+static bool HTTPConnectionReadRequest(HTTPConnection connection);
 static void HTTPConnectionDealloc(void* ptr);
+
+//
+// Suspends the fiber of the connection until the socket
+// is ready for events. Returns false if the client hung up.
+//
+static bool HTTPConnectionWait(HTTPConnection connection, short events);
+
+//
+// Continues the fiber of the connection on another queue
+//
+static void HTTPConnectionSwitchQueue(HTTPConnection connection, DispatchQueue queue, DispatchQoS qos);
+
+//
+// Returns errno of the calling thread. The fiber of a
+// connection may continue on another thread after
+// HTTPConnectionWait, but __errno_location is declared const
+// and its result may be kept across the wait when it is
+// inlined. Read errno through this right after the call
+// that set it.
+//
+static int HTTPConnectionGetErrno(void) __attribute__((noinline));
+
 static void HTTPProcessRequest(HTTPConnection connection);
-static void HTTPSendResponse(HTTPConnection connection, HTTPResponse response);
+static void HTTPRejectRequest(HTTPConnection connection);
+static void HTTPSendResponse(HTTPConnection connection, HTTPRequest request, HTTPResponse response);
 
 //
-// Resolved a path. Path is to be freed when no longer needed.
+// Answers with the metrics of the server
 //
-static char* HTTPResolvePath(HTTPRequest request, char* path);
+static void HTTPServeMetrics(HTTPConnection connection, HTTPRequest request, HTTPResponse response);
+
+//
+// Answers with the trace of sampled requests
+//
+static void HTTPServeTrace(HTTPConnection connection, HTTPRequest request, HTTPResponse response);
+
+//
+// Answers with text, which is copied. NULL gives a 503.
+//
+static void HTTPServeText(HTTPConnection connection, HTTPRequest request, HTTPResponse response, const char* contentType, const char* text);
+
+//
+// Records the time since the last stage ended
+//
+static void HTTPConnectionEndStage(HTTPConnection connection, Metric metric);
+
+//
+// Hands the finished request to the access log. There
+// is no request if it could not be parsed.
+//
+static void HTTPConnectionLogRequest(HTTPConnection connection, HTTPRequest request, HTTPStatusCode status);
+
+//
+// Resolves a path. The path is allocated in the arena of the
+// connection.
+//
+static char* HTTPResolvePath(HTTPConnection connection, HTTPRequest request, char* path);
 
 HTTPConnection HTTPConnectionCreate(Server server, int socket, struct sockaddr_in6 info)
 {
 	assert(server);
 	
-	HTTPConnection connection = malloc(sizeof(struct _HTTPConnection));
+	HTTPConnection connection = SlabAlloc(HTTPConnectionSlab);
 	
 	if (connection == NULL) {
-		perror("malloc");
+		perror("SlabAlloc");
 		return NULL;
 	}
 	
-	memset(connection, 0, sizeof(struct _HTTPConnection));
+	ObjectInit(connection, &HTTPConnectionClass, HTTPConnectionDealloc);
+	MetricAdd(HTTPAcceptedMetric, 1);
+	MetricAdd(HTTPOpenMetric, 1);
 	
-	ObjectInit(connection, HTTPConnectionDealloc);
+	connection->traceId = TraceSample();
+	TraceEvent(connection->traceId, "accept");
 	
 	connection->server = server;
 	memcpy(&connection->info, &info, sizeof(struct sockaddr_in6));
 	connection->socket = socket;
 	connection->infoLength = sizeof(connection->info);
-	connection->clientInfoLine = stringFromSockaddrIn(&connection->info);
+	connection->arena = ArenaCreate(kHTTPConnectionArenaSize);
+	
+	if (connection->arena == NULL) {
+		printf("Could not create arena.\n");
+		HTTPConnectionClose(connection);
+		return connection;
+	}
 	
 	setBlocking(connection->socket, false);
 	
-	printf("New connection:%p from %s...\n", connection, connection->clientInfoLine);
+	DEBUG_LOG("New connection:%p on socket %d...\n", connection, connection->socket);
+	
+	// Every connection is handled by a fiber of its own, which
+	// suspends whenever the socket would block. Start it right
+	// away to read what is already there.
+	Fiber fiber = FiberCreate(^{
+		HTTPConnectionRun(connection);
+	});
+	
+	if (fiber == NULL) {
+		printf("Could not create fiber.\n");
+		HTTPConnectionClose(connection);
+		return connection;
+	}
 	
-	// Try reading
-	HTTPConnectionReadRequest(connection);
+	FiberResume(fiber);
+	Release(fiber);
 	
 	// No release
 	return connection;
@@ -109,95 +265,205 @@ HTTPConnection HTTPConnectionCreate(Server server, int socket, struct sockaddr_i
 void HTTPConnectionDealloc(void* ptr)
 {
 	HTTPConnection connection = ptr;
-			
-	if (connection->buffer) {
-		free(connection->buffer);
-	}
 	
 	if (connection->socket >= 0) {
-		printf("Close connection:%p from %s...\n", connection, connection->clientInfoLine);
+		DEBUG_LOG("Close connection:%p on socket %d...\n", connection, connection->socket);
 		PollUnregister(ServerGetPoll(connection->server), connection->socket);
 		close(connection->socket);
 	}
 	
-	printf("Dealloc connection:%p:%s\n", connection, connection->clientInfoLine);
-	if (connection->clientInfoLine)
-		free(connection->clientInfoLine);
+	DEBUG_LOG("Dealloc connection:%p\n", connection);
+	
+	if (connection->arena)
+		Release(connection->arena);
+	
+	MetricAdd(HTTPOpenMetric, -1);
+	SlabFree(HTTPConnectionSlab, connection);
+}
+
+static void HTTPConnectionRun(HTTPConnection connection)
+{
+	DispatchQueue processingQueue;
+	
+	connection->requestTime = wallClockTime();
+	connection->requestStart = monotonicTime();
+	connection->stageStart = connection->requestStart;
+	connection->bytesSent = 0;
+	
+	if (!HTTPConnectionReadRequest(connection)) {
+		HTTPConnectionClose(connection);
+		return;
+	}
+	
+	HTTPConnectionEndStage(connection, HTTPReadMetric);
+	TraceEvent(connection->traceId, "request read");
+	
+	processingQueue = ServerGetProcessingDispatchQueue(connection->server);
+	
+	// Queueing more would only make everybody wait longer
+	if (DispatchQueueShouldShed(processingQueue)) {
+		HTTPRejectRequest(connection);
+		return;
+	}
+	
+	TraceEvent(connection->traceId, "dispatched");
+	HTTPConnectionSwitchQueue(connection, processingQueue, kDispatchQoSDefault);
+	HTTPConnectionEndStage(connection, HTTPDispatchMetric);
+	TraceEvent(connection->traceId, "processing");
+	HTTPProcessRequest(connection);
 	
-	free(connection);
+	// Request and response are gone, so is everything
+	// they allocated
+	connection->buffer = NULL;
+	ArenaReset(connection->arena);
 }
 
-static void HTTPConnectionReadRequest(HTTPConnection connection)
+static bool HTTPConnectionReadRequest(HTTPConnection connection)
 {	
 	if (!connection->buffer) {
 		connection->bufferFilled = 0;
-		connection->bufferLength = 255;
-		connection->buffer = malloc(connection->bufferLength);
+		connection->bufferLength = kHTTPConnectionBufferSize;
+		connection->buffer = ArenaAlloc(connection->arena, connection->bufferLength);
 		if (connection->buffer == NULL) {
-			perror("malloc");
-			return; // Will in turn release close & connection
+			printf("Could not allocate buffer.\n");
+			return false;
 		}
-		memset(connection->buffer, 0, connection->bufferLength);
+		connection->buffer[0] = '\0';
 	}
 		
-	size_t avaiableBuffer;
-	ssize_t readBuffer;
-	do {
-		avaiableBuffer = connection->bufferLength - connection->bufferFilled;
-		readBuffer = 0;
+	for (;;) {
+		size_t avaiableBuffer = connection->bufferLength - connection->bufferFilled;
+		ssize_t readBuffer;
+		int readError;
 		
 		// Not a lot of buffer, expand it
 		if (avaiableBuffer < 10) {
+			// The buffer is the latest allocation in the arena
+			// while reading, so this usually grows in place
+			connection->buffer = ArenaRealloc(connection->arena, connection->buffer, connection->bufferLength, connection->bufferLength * 2);
 			connection->bufferLength *= 2;
-			connection->buffer = realloc(connection->buffer, connection->bufferLength);
 			
 			if (connection->buffer == NULL) {
-				perror("realloc");
-				return; // Will in turn release close & connection
+				printf("Could not grow buffer.\n");
+				return false;
 			}
 			
 			avaiableBuffer = connection->bufferLength - connection->bufferFilled;
-			memset(connection->buffer + connection->bufferFilled, 0, avaiableBuffer);
 		}
-				
-		avaiableBuffer -= 1; /* always leave a null terminator */
 		
-		readBuffer = recv(connection->socket, connection->buffer + connection->bufferFilled, avaiableBuffer, 0);
-				
+		// Keep room for the terminator, the arena does not
+		// hand out zeroed memory
+		readBuffer = recv(connection->socket, connection->buffer + connection->bufferFilled, avaiableBuffer - 1, 0);
+		readError = readBuffer < 0 ? HTTPConnectionGetErrno() : 0;
+		
 		if (readBuffer < 0) {
-			if (errno != EAGAIN) {
+			if (readError != EAGAIN) {
 				perror("recv");
-				return;
+				return false;
+			}
+			
+			if (HTTPCanParseBuffer(connection->buffer))
+				return true;
+			
+			if (!HTTPConnectionWait(connection, POLLIN)) {
+				DEBUG_LOG("Error reading from client...\n");
+				return false;
 			}
-			readBuffer = 0;
+			
+			continue;
 		}
 		else if (readBuffer == 0) {
-			printf("Client closed connection...\n");
-			return;
+			DEBUG_LOG("Client closed connection...\n");
+			return false;
 		}
 		
 		assert(connection->bufferFilled + (size_t)readBuffer <= connection->bufferLength);
 		
+		if (connection->bufferFilled == 0)
+			TraceEvent(connection->traceId, "first byte");
+		
 		connection->bufferFilled += (size_t)readBuffer;
-	} while ((size_t)readBuffer == avaiableBuffer);
-	
-	if (HTTPCanParseBuffer(connection->buffer)) {
+		connection->buffer[connection->bufferFilled] = '\0';
 		
-		Dispatch(ServerGetProcessingDispatchQueue(connection->server), ^{
-			HTTPProcessRequest(connection);
-		});
+		// Read everything there was, no need to
+		// try again when we have a request already
+		if ((size_t)readBuffer < avaiableBuffer - 1 && HTTPCanParseBuffer(connection->buffer))
+			return true;
+	}
+}
+
+static bool HTTPConnectionWait(HTTPConnection connection, short events)
+{
+	Fiber fiber = FiberGetCurrent();
+	Poll poll = ServerGetPoll(connection->server);
+	int socket = connection->socket;
+	DispatchQueue queue;
+	DispatchQoS qos;
+	__block short result = 0;
+	
+	assert(fiber != NULL);
+	
+	// Finishing a started response goes before accepting new
+	// work, otherwise the client waits for nothing
+	if (events & POLLOUT) {
+		queue = ServerGetOutputDispatchQueue(connection->server);
+		qos = kDispatchQoSInteractive;
 	}
 	else {
-		PollRegister(ServerGetPoll(connection->server), connection->socket, 
-			POLLIN|POLLHUP, 0, ServerGetInputDispatchQueue(connection->server), ^(short revents) {
-				if ((revents & POLLHUP) > 0) {
-					printf("Error reading from client...\n");
-					return;
-				}
-
-				HTTPConnectionReadRequest(connection);
-			});
+		queue = ServerGetInputDispatchQueue(connection->server);
+		qos = kDispatchQoSDefault;
 	}
+	
+	FiberSuspend(^{
+		PollRegisterWithQoS(poll, socket, events|POLLHUP, 0, queue, qos, ^(short revents) {
+			result = revents;
+			FiberResume(fiber);
+		});
+	});
+	
+	return (result & POLLHUP) == 0;
+}
+
+static int HTTPConnectionGetErrno(void)
+{
+	return errno;
+}
+
+static void HTTPConnectionSwitchQueue(HTTPConnection connection, DispatchQueue queue, DispatchQoS qos)
+{
+	Fiber fiber = FiberGetCurrent();
+	uintptr_t key = (uintptr_t)connection->socket;
+	
+	assert(fiber != NULL);
+	
+	FiberSuspend(^{
+		DispatchAffine(queue, key, qos, ^{
+			FiberResume(fiber);
+		});
+	});
+}
+
+bool HTTPConnectionSetDocumentRoot(const char* path)
+{
+	char* root = realpath(path, NULL);
+	
+	if (root == NULL) {
+		perror(path);
+		return false;
+	}
+	
+	// Requests always start with a slash
+	if (strcmp(root, "/") == 0)
+		root[0] = '\0';
+	
+	kHTTPDocumentRoot = root;
+	
+	return true;
+}
+
+Arena HTTPConnectionGetArena(HTTPConnection connection)
+{
+	return connection->arena;
 }
 
 static void HTTPProcessRequest(HTTPConnection connection)
@@ -206,7 +472,11 @@ static void HTTPProcessRequest(HTTPConnection connection)
 	HTTPResponse response;
 	struct stat stat;
 	char* resolvedPath;
-	printf("Process %p\n", connection);
+	int lookupError = 0;
+	int openError;
+	const char* connectionHeader;
+	int fd;
+	DEBUG_LOG("Process %p\n", connection);
 	
 	response = HTTPResponseCreate(connection);
 	
@@ -215,22 +485,21 @@ static void HTTPProcessRequest(HTTPConnection connection)
 		return;
 	}
 	
-	void* buffer = connection->buffer;
+	// The request parses the buffer in place, it stays
+	// valid until the arena is reset
+	request = HTTPRequestCreate(connection->buffer);
+	HTTPConnectionEndStage(connection, HTTPParseMetric);
+	TraceEvent(connection->traceId, "parsed");
 	
-	// We use the buffer of the connection
-	// so the connection no longer owns the buffer :)
-	connection->buffer = NULL;
-	
-	request = HTTPRequestCreate(buffer);
 	if (request == NULL) {
-		printf("Could not create request object.\n");
+		DEBUG_LOG("Could not create request object.\n");
 		
 		HTTPResponseSetStatusCode(response, kHTTPBadRequest);
 		HTTPResponseSetResponseString(response, "400/Bad Request");
 		
 		HTTPResponseFinish(response);
 		
-		HTTPSendResponse(connection, response);
+		HTTPSendResponse(connection, NULL, response);
 		Release(response);
 		
 		return;
@@ -244,25 +513,50 @@ static void HTTPProcessRequest(HTTPConnection connection)
 		
 		HTTPResponseFinish(response);
 		
-		HTTPSendResponse(connection, response);
+		HTTPSendResponse(connection, request, response);
 		Release(request);
 		Release(response);
 		return;
 	}
 	
-	resolvedPath = HTTPResolvePath(request, HTTPRequestGetPath(request));
+	// We close after every response, tell clients that
+	// would otherwise keep the connection open
+	connectionHeader = HTTPRequestGetHeaderValue(request, kHTTPHeaderConnection);
+	if ((HTTPRequestGetVersion(request) == kHTTPVersion_1_1 && (connectionHeader == NULL || strcasecmp(connectionHeader, "close") != 0))
+		|| (connectionHeader && strcasecmp(connectionHeader, "keep-alive") == 0))
+		HTTPResponseSetHeaderValue(response, "Connection", "close");
+	
+	if (strcmp(HTTPRequestGetPath(request), kHTTPMetricsPath) == 0) {
+		HTTPServeMetrics(connection, request, response);
+		return;
+	}
+	
+	if (strcmp(HTTPRequestGetPath(request), kHTTPTracePath) == 0) {
+		HTTPServeTrace(connection, request, response);
+		return;
+	}
+	
+	// Resolving and checking the file may hit the disk, let
+	// the queue know so it can keep other requests going
+	DispatchBlockingRegionBegin();
+	resolvedPath = HTTPResolvePath(connection, request, HTTPRequestGetPath(request));
+	if (resolvedPath == NULL)
+		lookupError = errno;
+	else if (lstat(resolvedPath, &stat) < 0)
+		lookupError = errno;
+	DispatchBlockingRegionEnd();
 	
-	printf("Real path: %s\n", resolvedPath);
+	if (resolvedPath)
+		DEBUG_LOG("Real path: %s\n", resolvedPath);
 	
 	// Check the file
-	if (lstat(resolvedPath, &stat) < 0) {
+	if (lookupError != 0) {
 		HTTPResponseSetStatusCode(response, kHTTPBadNotFound);
 		HTTPResponseSetResponseString(response, "404/Not Found");
 		HTTPResponseFinish(response);
-		perror("lstat");
+		DEBUG_LOG("%s: %s\n", resolvedPath ? "lstat" : "resolve", strerror(lookupError));
 		
-		HTTPSendResponse(connection, response);
-		free(resolvedPath);
+		HTTPSendResponse(connection, request, response);
 		Release(request);
 		Release(response);
 		return;
@@ -272,111 +566,281 @@ static void HTTPProcessRequest(HTTPConnection connection)
 		HTTPResponseSetStatusCode(response, kHTTPBadNotFound);
 		HTTPResponseSetResponseString(response, "404/Not Found");
 		HTTPResponseFinish(response);
-		printf("not regular\n");
+		DEBUG_LOG("not regular\n");
 		
-		HTTPSendResponse(connection, response);
+		HTTPSendResponse(connection, request, response);
 		
-		free(resolvedPath);
 		Release(request);
 		Release(response);
 		return;
 	}
 	
+	DispatchBlockingRegionBegin();
+	fd = open(resolvedPath, O_RDONLY);
+	openError = fd < 0 ? errno : 0;
+	DispatchBlockingRegionEnd();
+	
+	// The file may be gone since the lstat, or we ran
+	// out of descriptors
+	if (fd < 0) {
+		if (openError == ENOENT || openError == EACCES) {
+			HTTPResponseSetStatusCode(response, kHTTPBadNotFound);
+			HTTPResponseSetResponseString(response, "404/Not Found");
+		}
+		else {
+			HTTPResponseSetStatusCode(response, kHTTPErrorServiceUnavailable);
+			HTTPResponseSetResponseString(response, "503/Service Unavailable");
+		}
+		HTTPResponseFinish(response);
+		DEBUG_LOG("open: %s\n", strerror(openError));
+		
+		HTTPSendResponse(connection, request, response);
+		Release(request);
+		Release(response);
+		return;
+	}
+	
+	TraceEvent(connection->traceId, "file opened");
+	
 	HTTPResponseSetStatusCode(response, kHTTPOK);
-	HTTPResponseSetResponseFileDescriptor(response, open(resolvedPath, O_RDONLY));
+	HTTPResponseSetResponseFileDescriptor(response, fd);
 	HTTPResponseFinish(response);
 		
-	HTTPSendResponse(connection, response);
+	HTTPSendResponse(connection, request, response);
 	
-	free(resolvedPath);
 	Release(request);
 	Release(response);
 }
 
-static void HTTPSendResponse(HTTPConnection connection, HTTPResponse response)
+static void HTTPRejectRequest(HTTPConnection connection)
 {
-	if (!HTTPResponseSend(response)) {
-		PollRegister(ServerGetPoll(connection->server), connection->socket, 
-			POLLOUT|POLLHUP, 0, ServerGetOutputDispatchQueue(connection->server), ^(short revents) {
-				if ((revents & POLLHUP) > 0) {
-					printf("Error writing to client...\n");
-					return;
-				}
-				
-				HTTPSendResponse(connection, response);
-			});
-	}
+	ssize_t sent;
+	
+	DEBUG_LOG("Reject %p, overloaded\n", connection);
+	MetricAdd(HTTPRejectedMetric, 1);
+	
+	// Best effort, the response is tiny and the socket
+	// buffer is empty at this point
+	sent = send(connection->socket, kHTTPServiceUnavailableResponse, sizeof(kHTTPServiceUnavailableResponse) - 1, 0);
+	if (sent < 0)
+		perror("send");
 	else
-		HTTPConnectionClose(connection);
+		connection->bytesSent += (uint64_t)sent;
+	
+	HTTPConnectionLogRequest(connection, NULL, kHTTPErrorServiceUnavailable);
+	HTTPConnectionClose(connection);
 }
 
-static char* HTTPResolvePath(HTTPRequest request, char* p)
+static void HTTPSendResponse(HTTPConnection connection, HTTPRequest request, HTTPResponse response)
 {
-#pragma unused(request)
-	char* path = malloc(sizeof(char) * PATH_MAX);
-	char* real;
+	HTTPConnectionEndStage(connection, HTTPProcessMetric);
 	
-	strncpy(path, kHTTPDocumentRoot, PATH_MAX);
-	strncat(path, p, PATH_MAX);
+	if (!HTTPResponseSend(response))
+		DEBUG_LOG("Error writing to client...\n");
 	
-	real = realpath(path, NULL);
+	HTTPConnectionEndStage(connection, HTTPSendMetric);
 	
-	free(path);
+	HTTPConnectionLogRequest(connection, request, HTTPResponseGetStatusCode(response));
+	HTTPConnectionClose(connection);
+}
+
+static void HTTPServeMetrics(HTTPConnection connection, HTTPRequest request, HTTPResponse response)
+{
+	char* text = MetricsCopyPrometheusText();
 	
-	if (!real)
-		return NULL;
+	HTTPServeText(connection, request, response, "text/plain; version=0.0.4", text);
+	free(text);
+}
 
-	// We're no longer in the specified root
-	if (strncmp(real, kHTTPDocumentRoot, strlen(kHTTPDocumentRoot)) != 0) {
-		free(real);
-		return NULL;
+static void HTTPServeTrace(HTTPConnection connection, HTTPRequest request, HTTPResponse response)
+{
+	char* json = TraceCopyChromeJSON();
+	
+	HTTPServeText(connection, request, response, "application/json", json);
+	free(json);
+}
+
+static void HTTPServeText(HTTPConnection connection, HTTPRequest request, HTTPResponse response, const char* contentType, const char* text)
+{
+	char* body = text ? ArenaStrdup(connection->arena, text) : NULL;
+	
+	if (body && HTTPResponseSetHeaderValue(response, "Content-Type", contentType)) {
+		HTTPResponseSetStatusCode(response, kHTTPOK);
+		HTTPResponseSetResponseString(response, body);
+	}
+	else {
+		HTTPResponseSetStatusCode(response, kHTTPErrorServiceUnavailable);
+		HTTPResponseSetResponseString(response, "503/Service Unavailable");
 	}
 	
-	return real;
+	HTTPResponseFinish(response);
+	
+	HTTPSendResponse(connection, request, response);
+	Release(request);
+	Release(response);
 }
 
-ssize_t HTTPConnectionSend(HTTPConnection connection, const void *buffer, size_t length)
+static void HTTPConnectionEndStage(HTTPConnection connection, Metric metric)
 {
-	return send(connection->socket, buffer, length, 0);
+	uint64_t now = monotonicTime();
+	
+	MetricObserve(metric, now - connection->stageStart);
+	connection->stageStart = now;
 }
 
-bool HTTPConnectionSendFD(HTTPConnection connection, int fd, off_t* offset, size_t length)
+static void HTTPConnectionLogRequest(HTTPConnection connection, HTTPRequest request, HTTPStatusCode status)
 {
-#ifdef DARWIN
-	off_t len = (off_t)length;
-	int result;
+	HTTPAccessLogRecord record;
+	
+	TraceEvent(connection->traceId, "done");
+	MetricAdd(HTTPRequestsMetric, 1);
+	MetricAdd(HTTPSentBytesMetric, (int64_t)connection->bytesSent);
+	
+	record.time = connection->requestTime;
+	record.duration = monotonicTime() - connection->requestStart;
+	record.bytes = connection->bytesSent;
+	memcpy(&record.address, &connection->info, sizeof(record.address));
+	record.status = (uint16_t)status;
+	
+	if (request) {
+		const char* path = HTTPRequestGetPath(request);
+		size_t length = strlen(path);
+		HTTPMethod method = HTTPRequestGetMethod(request);
+		HTTPVersion version = HTTPRequestGetVersion(request);
+		
+		if (length >= kHTTPAccessLogPathLength)
+			length = kHTTPAccessLogPathLength - 1;
+		
+		record.method = (uint8_t)method;
+		record.version = (uint8_t)version;
+		memcpy(record.path, path, length);
+		record.path[length] = '\0';
+	}
+	else {
+		record.method = kHTTPMethodUnkown;
+		record.version = kHTTPVersionUnkown;
+		record.path[0] = '\0';
+	}
 	
-	result = sendfile(fd, connection->socket, *offset, &len, NULL, 0);
+	HTTPAccessLogAppend(&record);
+}
+
+static char* HTTPResolvePath(HTTPConnection connection, HTTPRequest request, char* p)
+{
+#pragma unused(request)
+	size_t rootLength = strlen(kHTTPDocumentRoot);
+	size_t length = strlen(p);
+	char* path = ArenaAlloc(connection->arena, rootLength + length + 1);
+	char* real = ArenaAlloc(connection->arena, PATH_MAX);
 	
-	if (result < 0 && errno != EAGAIN) {
-		perror("sendfile");
-		return -1;
+	if (path == NULL || real == NULL) {
+		errno = ENOMEM;
+		return NULL;
 	}
 	
-	*offset += len;
+	memcpy(path, kHTTPDocumentRoot, rootLength);
+	memcpy(path + rootLength, p, length + 1);
 	
-	if (result < 0 && errno == EAGAIN)
-		return false;
-	return len == 0;
-#else
-	ssize_t s;
+	if (!realpath(path, real))
+		return NULL;
+
+	// We're no longer in the specified root, which
+	// is not the case for /root2 next to /root
+	if (strncmp(real, kHTTPDocumentRoot, rootLength) != 0
+		|| (real[rootLength] != '/' && real[rootLength] != '\0')) {
+		errno = EACCES;
+		return NULL;
+	}
 	
-	s = sendfile(connection->socket, fd, offset, length);
+	return real;
+}
 
-	if (s < 0 && errno != EAGAIN) {
-		perror("sendfile");
-		return -1;
+bool HTTPConnectionSend(HTTPConnection connection, const void *buffer, size_t length)
+{
+	const char* bytes = buffer;
+	
+	while (length > 0) {
+		ssize_t s = send(connection->socket, bytes, length, 0);
+		int error = s < 0 ? HTTPConnectionGetErrno() : 0;
+		
+		if (s > 0 && connection->bytesSent == 0)
+			TraceEvent(connection->traceId, "first byte out");
+		
+		if (s < 0) {
+			if (error != EAGAIN) {
+				perror("send");
+				return false;
+			}
+			
+			if (!HTTPConnectionWait(connection, POLLOUT))
+				return false;
+			
+			continue;
+		}
+		
+		bytes += s;
+		length -= (size_t)s;
+		connection->bytesSent += (uint64_t)s;
 	}
 	
-	if (s < 0 && errno == EAGAIN)
-		return false;
-	return s == 0;
+	return true;
+}
+
+bool HTTPConnectionSendFD(HTTPConnection connection, int fd, off_t* offset, size_t length)
+{
+	while (length > 0) {
+		bool wouldBlock;
+#ifdef DARWIN
+		off_t len = (off_t)length;
+		int result;
+		
+		result = sendfile(fd, connection->socket, *offset, &len, NULL, 0);
+		
+		if (result < 0 && HTTPConnectionGetErrno() != EAGAIN) {
+			perror("sendfile");
+			return false;
+		}
+		
+		// Also partially sent if it would block
+		*offset += len;
+		length -= (size_t)len;
+		connection->bytesSent += (uint64_t)len;
+		wouldBlock = result < 0;
+		
+		// The file got shorter
+		if (!wouldBlock && len == 0)
+			return false;
+#else
+		ssize_t s;
+		
+		s = sendfile(connection->socket, fd, offset, length);
+
+		if (s < 0 && HTTPConnectionGetErrno() != EAGAIN) {
+			perror("sendfile");
+			return false;
+		}
+		
+		// The file got shorter
+		if (s == 0)
+			return false;
+		
+		wouldBlock = s < 0;
+		if (!wouldBlock) {
+			length -= (size_t)s;
+			connection->bytesSent += (uint64_t)s;
+		}
 #endif
+		
+		if (wouldBlock && !HTTPConnectionWait(connection, POLLOUT))
+			return false;
+	}
+	
+	return true;
 }
 
 void HTTPConnectionClose(HTTPConnection connection)
 {
-	printf("Close connection:%p from %s...\n", connection, connection->clientInfoLine);
+	DEBUG_LOG("Close connection:%p on socket %d...\n", connection, connection->socket);
 	PollUnregister(ServerGetPoll(connection->server), connection->socket);
 	close(connection->socket);
 	connection->socket = -1;
@@ -27,6 +27,7 @@
 #include "http/http.h"
 #include "http/httprequest.h"
 #include "http/httpresponse.h"
+#include "utils/arena.h"
 
 #include <stdbool.h>
 #include <netinet/in.h>
@@ -53,18 +54,34 @@ HTTPRequest HTTPConnectionGetRequest(HTTPConnection connection);
 HTTPResponse HTTPConnectionGetResponse(HTTPConnection connection);
 
 //
-// Sends data over the connection. Works similar to send (2)
-// but already handles most of the errors (and probbaly closes
-// the connection in return)
+// Serves files from path instead of the built in default.
+// Call it before the server is created. Returns false if
+// the path does not exist.
 //
-ssize_t HTTPConnectionSend(HTTPConnection connection, const void *buffer, size_t length);
+bool HTTPConnectionSetDocumentRoot(const char* path);
 
 //
-// Similar to HTTPConnectionSend but used an fd to send the
-// data.
+// Returns the arena for allocations that only live as long
+// as the current request. It is reset once the response
+// has been sent.
 //
-// Returns true if everything is sent, false if should be recalled
-// when data to the connection can be written
+Arena HTTPConnectionGetArena(HTTPConnection connection);
+
+//
+// Sends all data over the connection. When the socket would
+// block the fiber of the connection is suspended until it
+// can write again.
+//
+// Must be called from the fiber of the connection.
+//
+// Returns false if the data could not be sent.
+//
+bool HTTPConnectionSend(HTTPConnection connection, const void *buffer, size_t length);
+
+//
+// Similar to HTTPConnectionSend but sends length
+// bytes of fd starting at offset. The offset is
+// advanced by the sent bytes.
 //
 bool HTTPConnectionSendFD(HTTPConnection connection, int fd, off_t* offset, size_t length);
 
@@ -0,0 +1,225 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "httpheadermap.h"
+
+#include "utils/slab.h"
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+struct _HTTPHeaderMapEntry {
+	const char* name;
+	const char* value;
+	
+	//
+	// Precomputed so most mismatches are
+	// found without looking at the name
+	//
+	uint32_t nameLength;
+	uint32_t hash;
+};
+
+DEFINE_CLASS(HTTPHeaderMap,
+	//
+	// Points to inlineEntries until the map
+	// outgrows them
+	//
+	struct _HTTPHeaderMapEntry* entries;
+	size_t count;
+	size_t capacity;
+	
+	struct _HTTPHeaderMapEntry inlineEntries[kHTTPHeaderMapInlineEntries];
+);
+
+DEFINE_SLAB(HTTPHeaderMap, sizeof(struct _HTTPHeaderMap));
+
+static void HTTPHeaderMapDealloc(void* ptr);
+static uint32_t HTTPHeaderMapHash(const char* name, uint32_t* length);
+static size_t HTTPHeaderMapFindHashed(HTTPHeaderMap map, const char* name, uint32_t length, uint32_t hash, size_t start);
+static bool HTTPHeaderMapGrow(HTTPHeaderMap map);
+
+HTTPHeaderMap HTTPHeaderMapCreate()
+{
+	HTTPHeaderMap map = SlabAlloc(HTTPHeaderMapSlab);
+	
+	if (map == NULL) {
+		perror("SlabAlloc");
+		return NULL;
+	}
+	
+	ObjectInit(map, &HTTPHeaderMapClass, HTTPHeaderMapDealloc);
+	
+	map->entries = map->inlineEntries;
+	map->capacity = kHTTPHeaderMapInlineEntries;
+	
+	return map;
+}
+
+bool HTTPHeaderMapAdd(HTTPHeaderMap map, const char* name, const char* value)
+{
+	struct _HTTPHeaderMapEntry* entry;
+	
+	if (map->count == map->capacity && !HTTPHeaderMapGrow(map))
+		return false;
+	
+	entry = &map->entries[map->count++];
+	entry->name = name;
+	entry->value = value;
+	entry->hash = HTTPHeaderMapHash(name, &entry->nameLength);
+	
+	return true;
+}
+
+bool HTTPHeaderMapSet(HTTPHeaderMap map, const char* name, const char* value)
+{
+	uint32_t length;
+	uint32_t hash = HTTPHeaderMapHash(name, &length);
+	size_t index = HTTPHeaderMapFindHashed(map, name, length, hash, 0);
+	size_t next;
+	
+	if (index == kHTTPHeaderMapNotFound)
+		return HTTPHeaderMapAdd(map, name, value);
+	
+	map->entries[index].name = name;
+	map->entries[index].value = value;
+	
+	// Drop the other values
+	while ((next = HTTPHeaderMapFindHashed(map, name, length, hash, index + 1)) != kHTTPHeaderMapNotFound) {
+		memmove(&map->entries[next], &map->entries[next + 1], (map->count - next - 1) * sizeof(struct _HTTPHeaderMapEntry));
+		map->count--;
+	}
+	
+	return true;
+}
+
+const char* HTTPHeaderMapGet(HTTPHeaderMap map, const char* name)
+{
+	size_t index = HTTPHeaderMapFind(map, name, 0);
+	
+	if (index == kHTTPHeaderMapNotFound)
+		return NULL;
+	
+	return map->entries[index].value;
+}
+
+size_t HTTPHeaderMapFind(HTTPHeaderMap map, const char* name, size_t start)
+{
+	uint32_t length;
+	uint32_t hash = HTTPHeaderMapHash(name, &length);
+	
+	return HTTPHeaderMapFindHashed(map, name, length, hash, start);
+}
+
+size_t HTTPHeaderMapGetCount(HTTPHeaderMap map)
+{
+	return map->count;
+}
+
+const char* HTTPHeaderMapGetName(HTTPHeaderMap map, size_t index)
+{
+	assert(index < map->count);
+	
+	return map->entries[index].name;
+}
+
+const char* HTTPHeaderMapGetValue(HTTPHeaderMap map, size_t index)
+{
+	assert(index < map->count);
+	
+	return map->entries[index].value;
+}
+
+static void HTTPHeaderMapDealloc(void* ptr)
+{
+	HTTPHeaderMap map = ptr;
+	
+	if (map->entries != map->inlineEntries)
+		free(map->entries);
+	
+	SlabFree(HTTPHeaderMapSlab, map);
+}
+
+//
+// FNV-1a over the lowercased name, also
+// returns the length of the name
+//
+static uint32_t HTTPHeaderMapHash(const char* name, uint32_t* length)
+{
+	uint32_t hash = 2166136261u;
+	const char* c;
+	
+	for (c = name; *c; c++) {
+		char lower = *c >= 'A' && *c <= 'Z' ? (char)(*c + 'a' - 'A') : *c;
+		
+		hash ^= (uint8_t)lower;
+		hash *= 16777619u;
+	}
+	
+	*length = (uint32_t)(c - name);
+	
+	return hash;
+}
+
+static size_t HTTPHeaderMapFindHashed(HTTPHeaderMap map, const char* name, uint32_t length, uint32_t hash, size_t start)
+{
+	for (size_t i = start; i < map->count; i++) {
+		struct _HTTPHeaderMapEntry* entry = &map->entries[i];
+		
+		// Interned names match by pointer
+		if (entry->name == name)
+			return i;
+		
+		if (entry->hash == hash && entry->nameLength == length && strncasecmp(entry->name, name, length) == 0)
+			return i;
+	}
+	
+	return kHTTPHeaderMapNotFound;
+}
+
+static bool HTTPHeaderMapGrow(HTTPHeaderMap map)
+{
+	size_t capacity = map->capacity * 2;
+	struct _HTTPHeaderMapEntry* entries;
+	
+	if (map->entries == map->inlineEntries) {
+		entries = malloc(capacity * sizeof(struct _HTTPHeaderMapEntry));
+		
+		if (entries)
+			memcpy(entries, map->inlineEntries, map->count * sizeof(struct _HTTPHeaderMapEntry));
+	}
+	else
+		entries = realloc(map->entries, capacity * sizeof(struct _HTTPHeaderMapEntry));
+	
+	if (entries == NULL) {
+		perror("malloc");
+		return false;
+	}
+	
+	map->entries = entries;
+	map->capacity = capacity;
+	
+	return true;
+}
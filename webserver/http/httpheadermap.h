@@ -0,0 +1,99 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _HTTPHEADERMAP_H_
+#define _HTTPHEADERMAP_H_
+
+#include "utils/object.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// The headers of a request or response. Names are matched
+// case-insensitively and a name may occur more than once.
+// The order in which headers were added is kept.
+//
+// The first kHTTPHeaderMapInlineEntries headers are stored in
+// the map itself, only larger sets need another allocation.
+//
+DECLARE_CLASS(HTTPHeaderMap);
+
+#define kHTTPHeaderMapInlineEntries 16
+
+//
+// Returned by HTTPHeaderMapFind when there are no
+// more matching headers
+//
+#define kHTTPHeaderMapNotFound SIZE_MAX
+
+//
+// Creates a new empty header map
+//
+OBJECT_RETURNS_RETAINED
+HTTPHeaderMap HTTPHeaderMapCreate();
+
+//
+// Adds a header, existing values of name are kept.
+//
+// Note you must ensure that name and value
+// are kept valid.
+//
+bool HTTPHeaderMapAdd(HTTPHeaderMap map, const char* name, const char* value);
+
+//
+// Sets a header, replacing all existing values of name.
+//
+// Note you must ensure that name and value
+// are kept valid.
+//
+bool HTTPHeaderMapSet(HTTPHeaderMap map, const char* name, const char* value);
+
+//
+// Returns the first value of name or NULL
+//
+const char* HTTPHeaderMapGet(HTTPHeaderMap map, const char* name);
+
+//
+// Returns the index of the first header called name at or
+// after start, or kHTTPHeaderMapNotFound. Use it to walk
+// all values of a name.
+//
+size_t HTTPHeaderMapFind(HTTPHeaderMap map, const char* name, size_t start);
+
+//
+// Returns the number of headers
+//
+size_t HTTPHeaderMapGetCount(HTTPHeaderMap map);
+
+//
+// Returns the name of the header at index
+//
+const char* HTTPHeaderMapGetName(HTTPHeaderMap map, size_t index);
+
+//
+// Returns the value of the header at index
+//
+const char* HTTPHeaderMapGetValue(HTTPHeaderMap map, size_t index);
+
+#endif /* _HTTPHEADERMAP_H_ */
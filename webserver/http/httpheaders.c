@@ -0,0 +1,223 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Generated by httpheaders.py, do not edit.
+
+#include "httpheaders.h"
+
+#include <stdint.h>
+#include <strings.h>
+
+#define kHTTPHeaderTableBits 8
+
+static const char* const kHTTPHeaderNames[kHTTPHeaderCount] = {
+	"Accept",
+	"Accept-Charset",
+	"Accept-Encoding",
+	"Accept-Language",
+	"Accept-Ranges",
+	"Age",
+	"Allow",
+	"Authorization",
+	"Cache-Control",
+	"Connection",
+	"Content-Disposition",
+	"Content-Encoding",
+	"Content-Language",
+	"Content-Length",
+	"Content-Location",
+	"Content-Range",
+	"Content-Type",
+	"Cookie",
+	"Date",
+	"DNT",
+	"ETag",
+	"Expect",
+	"Expires",
+	"Forwarded",
+	"From",
+	"Host",
+	"If-Match",
+	"If-Modified-Since",
+	"If-None-Match",
+	"If-Range",
+	"If-Unmodified-Since",
+	"Keep-Alive",
+	"Last-Modified",
+	"Location",
+	"Max-Forwards",
+	"Origin",
+	"Pragma",
+	"Proxy-Authorization",
+	"Range",
+	"Referer",
+	"Retry-After",
+	"Server",
+	"Set-Cookie",
+	"TE",
+	"Trailer",
+	"Transfer-Encoding",
+	"Upgrade",
+	"Upgrade-Insecure-Requests",
+	"User-Agent",
+	"Vary",
+	"Via",
+	"Warning",
+	"WWW-Authenticate",
+	"X-Forwarded-For",
+	"X-Requested-With",
+};
+
+static const size_t kHTTPHeaderNameLengths[kHTTPHeaderCount] = {
+	6,
+	14,
+	15,
+	15,
+	13,
+	3,
+	5,
+	13,
+	13,
+	10,
+	19,
+	16,
+	16,
+	14,
+	16,
+	13,
+	12,
+	6,
+	4,
+	3,
+	4,
+	6,
+	7,
+	9,
+	4,
+	4,
+	8,
+	17,
+	13,
+	8,
+	19,
+	10,
+	13,
+	8,
+	12,
+	6,
+	6,
+	19,
+	5,
+	7,
+	11,
+	6,
+	10,
+	2,
+	7,
+	17,
+	7,
+	25,
+	10,
+	4,
+	3,
+	7,
+	16,
+	15,
+	16,
+};
+
+//
+// Slots of the hash, kHTTPHeaderUnknown when unused
+//
+static const uint8_t kHTTPHeaderTable[1 << kHTTPHeaderTableBits] = {
+	55, 55, 55, 55, 55, 55, 24, 55,
+	6, 55, 55, 55, 55, 55, 55, 55,
+	55, 55, 55, 55, 18, 45, 55, 55,
+	27, 55, 55, 37, 55, 39, 55, 55,
+	54, 55, 11, 55, 55, 55, 55, 55,
+	55, 55, 55, 4, 55, 55, 55, 55,
+	55, 55, 5, 55, 55, 17, 13, 52,
+	55, 16, 55, 55, 55, 55, 55, 55,
+	55, 55, 2, 55, 55, 55, 55, 55,
+	55, 55, 55, 55, 55, 8, 55, 55,
+	55, 55, 28, 55, 55, 55, 55, 55,
+	55, 55, 36, 48, 55, 55, 35, 55,
+	23, 55, 55, 55, 55, 43, 55, 55,
+	55, 55, 55, 55, 55, 29, 19, 21,
+	55, 55, 55, 55, 53, 55, 55, 55,
+	42, 55, 55, 55, 55, 55, 55, 55,
+	55, 55, 55, 55, 55, 55, 55, 55,
+	55, 55, 33, 7, 55, 55, 55, 55,
+	55, 55, 55, 38, 55, 55, 32, 20,
+	55, 55, 55, 55, 55, 55, 55, 55,
+	55, 55, 55, 40, 55, 0, 22, 55,
+	55, 55, 55, 25, 55, 30, 44, 50,
+	55, 55, 55, 55, 55, 15, 47, 55,
+	55, 55, 55, 55, 55, 9, 55, 26,
+	55, 55, 14, 55, 55, 34, 55, 55,
+	55, 31, 55, 55, 55, 46, 12, 41,
+	55, 55, 10, 55, 55, 55, 55, 55,
+	49, 55, 55, 55, 55, 55, 55, 55,
+	55, 55, 55, 55, 55, 55, 55, 1,
+	51, 55, 55, 55, 55, 3, 55, 55,
+	55, 55, 55, 55, 55, 55, 55, 55,
+	55, 55, 55, 55, 55, 55, 55, 55,
+};
+
+static inline uint32_t HTTPHeaderLower(char c)
+{
+	return (uint32_t)(uint8_t)(c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c);
+}
+
+static inline uint32_t HTTPHeaderHash(const char* name, size_t length)
+{
+	return (uint32_t)length * 0x7b0a827fu
+		+ HTTPHeaderLower(name[0]) * 0xb2b5e5cfu
+		+ HTTPHeaderLower(name[length / 2]) * 0xcaf7f9a3u
+		+ HTTPHeaderLower(name[length - 1]) * 0x707b9d45u;
+}
+
+HTTPHeader HTTPHeaderFromName(const char* name, size_t length)
+{
+	HTTPHeader header;
+	
+	if (length == 0)
+		return kHTTPHeaderUnknown;
+	
+	header = (HTTPHeader)kHTTPHeaderTable[HTTPHeaderHash(name, length) >> (32 - kHTTPHeaderTableBits)];
+	
+	if (header == kHTTPHeaderUnknown || kHTTPHeaderNameLengths[header] != length)
+		return kHTTPHeaderUnknown;
+	
+	if (strncasecmp(kHTTPHeaderNames[header], name, length) != 0)
+		return kHTTPHeaderUnknown;
+	
+	return header;
+}
+
+const char* HTTPHeaderGetName(HTTPHeader header)
+{
+	if (header >= kHTTPHeaderCount)
+		return NULL;
+	
+	return kHTTPHeaderNames[header];
+}
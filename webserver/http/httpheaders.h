@@ -0,0 +1,110 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Generated by httpheaders.py, do not edit.
+
+#ifndef _HTTPHEADERS_H_
+#define _HTTPHEADERS_H_
+
+#include <stddef.h>
+
+//
+// The well known header names
+//
+typedef enum {
+	kHTTPHeaderAccept,
+	kHTTPHeaderAcceptCharset,
+	kHTTPHeaderAcceptEncoding,
+	kHTTPHeaderAcceptLanguage,
+	kHTTPHeaderAcceptRanges,
+	kHTTPHeaderAge,
+	kHTTPHeaderAllow,
+	kHTTPHeaderAuthorization,
+	kHTTPHeaderCacheControl,
+	kHTTPHeaderConnection,
+	kHTTPHeaderContentDisposition,
+	kHTTPHeaderContentEncoding,
+	kHTTPHeaderContentLanguage,
+	kHTTPHeaderContentLength,
+	kHTTPHeaderContentLocation,
+	kHTTPHeaderContentRange,
+	kHTTPHeaderContentType,
+	kHTTPHeaderCookie,
+	kHTTPHeaderDate,
+	kHTTPHeaderDNT,
+	kHTTPHeaderETag,
+	kHTTPHeaderExpect,
+	kHTTPHeaderExpires,
+	kHTTPHeaderForwarded,
+	kHTTPHeaderFrom,
+	kHTTPHeaderHost,
+	kHTTPHeaderIfMatch,
+	kHTTPHeaderIfModifiedSince,
+	kHTTPHeaderIfNoneMatch,
+	kHTTPHeaderIfRange,
+	kHTTPHeaderIfUnmodifiedSince,
+	kHTTPHeaderKeepAlive,
+	kHTTPHeaderLastModified,
+	kHTTPHeaderLocation,
+	kHTTPHeaderMaxForwards,
+	kHTTPHeaderOrigin,
+	kHTTPHeaderPragma,
+	kHTTPHeaderProxyAuthorization,
+	kHTTPHeaderRange,
+	kHTTPHeaderReferer,
+	kHTTPHeaderRetryAfter,
+	kHTTPHeaderServer,
+	kHTTPHeaderSetCookie,
+	kHTTPHeaderTE,
+	kHTTPHeaderTrailer,
+	kHTTPHeaderTransferEncoding,
+	kHTTPHeaderUpgrade,
+	kHTTPHeaderUpgradeInsecureRequests,
+	kHTTPHeaderUserAgent,
+	kHTTPHeaderVary,
+	kHTTPHeaderVia,
+	kHTTPHeaderWarning,
+	kHTTPHeaderWWWAuthenticate,
+	kHTTPHeaderXForwardedFor,
+	kHTTPHeaderXRequestedWith,
+	
+	kHTTPHeaderCount,
+	
+	//
+	// Any other name
+	//
+	kHTTPHeaderUnknown = kHTTPHeaderCount
+} HTTPHeader;
+
+//
+// Maps a header name (of length bytes, case-insensitive)
+// to its id, or kHTTPHeaderUnknown. Takes one hash and
+// a single comparison.
+//
+HTTPHeader HTTPHeaderFromName(const char* name, size_t length);
+
+//
+// Returns the canonical name of a header
+//
+const char* HTTPHeaderGetName(HTTPHeader header);
+
+#endif /* _HTTPHEADERS_H_ */
@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+#
+# Generates httpheaders.h and httpheaders.c, a perfect hash
+# table of the well known HTTP header names.
+#
+#   make headers
+#
+# Add new names to HEADERS and rerun. The generated files are
+# checked in, so building needs no python.
+#
+
+import os
+import random
+import sys
+
+HEADERS = [
+	"Accept",
+	"Accept-Charset",
+	"Accept-Encoding",
+	"Accept-Language",
+	"Accept-Ranges",
+	"Age",
+	"Allow",
+	"Authorization",
+	"Cache-Control",
+	"Connection",
+	"Content-Disposition",
+	"Content-Encoding",
+	"Content-Language",
+	"Content-Length",
+	"Content-Location",
+	"Content-Range",
+	"Content-Type",
+	"Cookie",
+	"Date",
+	"DNT",
+	"ETag",
+	"Expect",
+	"Expires",
+	"Forwarded",
+	"From",
+	"Host",
+	"If-Match",
+	"If-Modified-Since",
+	"If-None-Match",
+	"If-Range",
+	"If-Unmodified-Since",
+	"Keep-Alive",
+	"Last-Modified",
+	"Location",
+	"Max-Forwards",
+	"Origin",
+	"Pragma",
+	"Proxy-Authorization",
+	"Range",
+	"Referer",
+	"Retry-After",
+	"Server",
+	"Set-Cookie",
+	"TE",
+	"Trailer",
+	"Transfer-Encoding",
+	"Upgrade",
+	"Upgrade-Insecure-Requests",
+	"User-Agent",
+	"Vary",
+	"Via",
+	"Warning",
+	"WWW-Authenticate",
+	"X-Forwarded-For",
+	"X-Requested-With",
+]
+
+LICENSE_LINES = 21
+MASK32 = 0xffffffff
+
+
+def key(name):
+	# Must match HTTPHeaderHash in the generated C code
+	lower = name.lower().encode()
+	return (len(lower), lower[0], lower[len(lower) // 2], lower[-1])
+
+
+def slot(k, seeds, bits):
+	length, first, middle, last = k
+	h = (length * seeds[0] + first * seeds[1] + middle * seeds[2] + last * seeds[3]) & MASK32
+	return (h >> (32 - bits))
+
+
+def search():
+	keys = [key(name) for name in HEADERS]
+	rng = random.Random(1)
+	
+	if len(set(keys)) != len(keys):
+		sys.exit("Header names are not distinguished by length and first/middle/last character")
+	
+	bits = max(len(HEADERS) - 1, 1).bit_length()
+	while True:
+		for _ in range(200000):
+			seeds = [rng.randrange(1, 1 << 32) | 1 for _ in range(4)]
+			slots = [slot(k, seeds, bits) for k in keys]
+			if len(set(slots)) == len(slots):
+				return seeds, bits, slots
+		bits += 1
+
+
+def identifier(name):
+	return "kHTTPHeader" + name.replace("-", "")
+
+
+def main():
+	directory = os.path.dirname(os.path.abspath(__file__))
+	
+	with open(os.path.join(directory, "http.c")) as f:
+		license = "".join(f.readlines()[:LICENSE_LINES])
+	
+	seeds, bits, slots = search()
+	generated = "// Generated by httpheaders.py, do not edit.\n"
+	
+	with open(os.path.join(directory, "httpheaders.h"), "w") as f:
+		f.write(license)
+		f.write("\n" + generated)
+		f.write("\n#ifndef _HTTPHEADERS_H_\n#define _HTTPHEADERS_H_\n\n#include <stddef.h>\n\n")
+		f.write("//\n// The well known header names\n//\ntypedef enum {\n")
+		for name in HEADERS:
+			f.write("\t%s,\n" % identifier(name))
+		f.write("\t\n\tkHTTPHeaderCount,\n\t\n\t//\n\t// Any other name\n\t//\n\tkHTTPHeaderUnknown = kHTTPHeaderCount\n} HTTPHeader;\n\n")
+		f.write("//\n// Maps a header name (of length bytes, case-insensitive)\n")
+		f.write("// to its id, or kHTTPHeaderUnknown. Takes one hash and\n")
+		f.write("// a single comparison.\n//\n")
+		f.write("HTTPHeader HTTPHeaderFromName(const char* name, size_t length);\n\n")
+		f.write("//\n// Returns the canonical name of a header\n//\n")
+		f.write("const char* HTTPHeaderGetName(HTTPHeader header);\n\n")
+		f.write("#endif /* _HTTPHEADERS_H_ */\n")
+	
+	assert len(HEADERS) < 255
+	
+	table = [len(HEADERS)] * (1 << bits)
+	for header, index in enumerate(slots):
+		table[index] = header
+	
+	with open(os.path.join(directory, "httpheaders.c"), "w") as f:
+		f.write(license)
+		f.write("\n" + generated)
+		f.write('\n#include "httpheaders.h"\n\n#include <stdint.h>\n#include <strings.h>\n\n')
+		f.write("#define kHTTPHeaderTableBits %d\n\n" % bits)
+		f.write("static const char* const kHTTPHeaderNames[kHTTPHeaderCount] = {\n")
+		for name in HEADERS:
+			f.write('\t"%s",\n' % name)
+		f.write("};\n\n")
+		f.write("static const size_t kHTTPHeaderNameLengths[kHTTPHeaderCount] = {\n")
+		for name in HEADERS:
+			f.write("\t%d,\n" % len(name))
+		f.write("};\n\n")
+		f.write("//\n// Slots of the hash, kHTTPHeaderUnknown when unused\n//\n")
+		f.write("static const uint8_t kHTTPHeaderTable[1 << kHTTPHeaderTableBits] = {\n")
+		for row in range(0, len(table), 8):
+			f.write("\t%s,\n" % ", ".join(str(entry) for entry in table[row:row + 8]))
+		f.write("};\n\n")
+		f.write("static inline uint32_t HTTPHeaderLower(char c)\n{\n")
+		f.write("\treturn (uint32_t)(uint8_t)(c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c);\n}\n\n")
+		f.write("static inline uint32_t HTTPHeaderHash(const char* name, size_t length)\n{\n")
+		f.write("\treturn (uint32_t)length * %#010xu\n" % seeds[0])
+		f.write("\t\t+ HTTPHeaderLower(name[0]) * %#010xu\n" % seeds[1])
+		f.write("\t\t+ HTTPHeaderLower(name[length / 2]) * %#010xu\n" % seeds[2])
+		f.write("\t\t+ HTTPHeaderLower(name[length - 1]) * %#010xu;\n}\n\n" % seeds[3])
+		f.write("HTTPHeader HTTPHeaderFromName(const char* name, size_t length)\n{\n")
+		f.write("\tHTTPHeader header;\n\t\n")
+		f.write("\tif (length == 0)\n\t\treturn kHTTPHeaderUnknown;\n\t\n")
+		f.write("\theader = (HTTPHeader)kHTTPHeaderTable[HTTPHeaderHash(name, length) >> (32 - kHTTPHeaderTableBits)];\n\t\n")
+		f.write("\tif (header == kHTTPHeaderUnknown || kHTTPHeaderNameLengths[header] != length)\n\t\treturn kHTTPHeaderUnknown;\n\t\n")
+		f.write("\tif (strncasecmp(kHTTPHeaderNames[header], name, length) != 0)\n\t\treturn kHTTPHeaderUnknown;\n\t\n")
+		f.write("\treturn header;\n}\n\n")
+		f.write("const char* HTTPHeaderGetName(HTTPHeader header)\n{\n")
+		f.write("\tif (header >= kHTTPHeaderCount)\n\t\treturn NULL;\n\t\n")
+		f.write("\treturn kHTTPHeaderNames[header];\n}\n")
+
+
+if __name__ == "__main__":
+	main()
@@ -21,9 +21,11 @@
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "httprequest.h"
+#include "httpheadermap.h"
 
-#include "utils/str_helper.h"
-#include "utils/dictionary.h"
+#include "utils/probes.h"
+#include "utils/slab.h"
+#include "utils/slice.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -47,23 +49,26 @@ DEFINE_CLASS(HTTPRequest,
 	char* path;
 	
 	//
-	// The headers of the request
+	// Values of the well known headers, indexed by their
+	// id. The first value wins, repeated ones go to headers.
 	//
-	Dictionary headerDictionary;
+	const char* knownHeaders[kHTTPHeaderCount];
 	
 	//
-	// Is a pointer to a memory location which
-	// contains the initial data, which is now referenced
-	// in path, headers etc. Therefore we must free this
-	// when the request is destroyed.
+	// All other headers of the request. Keys and values
+	// point into the buffer the request was created with.
 	//
-	void* inputBackend;
+	HTTPHeaderMap headers;
 );
 
+DEFINE_SLAB(HTTPRequest, sizeof(struct _HTTPRequest));
+
 static bool HTTPRequestParse(HTTPRequest request, char* buffer);
-static bool HTTPRequestParseActionLine(HTTPRequest request, char* line);
-static bool HTTPRequestParseHeader(HTTPRequest request, char* buffer);
-static bool HTTPRequestParseHeaderLine(HTTPRequest request, char* line);
+static bool HTTPRequestNextLine(Slice* rest, Slice* line);
+static char* HTTPRequestTerminate(char* buffer, Slice slice);
+static bool HTTPRequestParseActionLine(HTTPRequest request, char* buffer, Slice line);
+static bool HTTPRequestParseHeader(HTTPRequest request, char* buffer, Slice rest);
+static bool HTTPRequestParseHeaderLine(HTTPRequest request, char* buffer, Slice line);
 static void HTTPRequestDealloc(void* ptr);
 
 bool HTTPCanParseBuffer(char* buffer) {
@@ -82,32 +87,38 @@ HTTPRequest HTTPRequestCreate(char* buffer)
 {
 	assert(buffer != NULL);
 	
-	HTTPRequest request = malloc(sizeof(struct _HTTPRequest));
+	PROBE1(request__parse__start, buffer);
+	
+	HTTPRequest request = SlabAlloc(HTTPRequestSlab);
 	
 	if (request == NULL) {
-		perror("malloc");
+		perror("SlabAlloc");
 		return NULL;
 	}
 	
-	memset(request, 0, sizeof(struct _HTTPRequest));
+	ObjectInit(request, &HTTPRequestClass, HTTPRequestDealloc);
 	
-	ObjectInit(request, HTTPRequestDealloc);
+	// Requests never leave the fiber of their connection
+	ObjectSetConfined(request);
 	
-	request->headerDictionary = DictionaryCreate();
+	request->headers = HTTPHeaderMapCreate();
 	
-	if (request->headerDictionary == NULL) {
-		printf("Could not create header dictionary.\n");
+	if (request->headers == NULL) {
+		printf("Could not create header map.\n");
 		Release(request);
 		return NULL;
 	}
 	
-	request->inputBackend = buffer;
+	ObjectSetConfined(request->headers);
 	
 	if (!HTTPRequestParse(request, buffer)) {
+		PROBE2(request__parse__done, buffer, NULL);
 		Release(request);
 		return NULL;
 	}
 	
+	PROBE2(request__parse__done, buffer, request);
+	
 	return request;
 }
 
@@ -123,91 +134,145 @@ HTTPVersion HTTPRequestGetVersion(HTTPRequest request)
 
 const char* HTTPRequestGetHeaderValueForKey(HTTPRequest request, const char* key)
 {
-	return DictionaryGet(request->headerDictionary, key);
+	HTTPHeader header = HTTPHeaderFromName(key, strlen(key));
+	
+	if (header != kHTTPHeaderUnknown)
+		return request->knownHeaders[header];
+	
+	return HTTPHeaderMapGet(request->headers, key);
 }
 
 void HTTPRequestDealloc(void* ptr)
 {
 	HTTPRequest request = ptr;
 	
-	if (request->inputBackend)
-		free(request->inputBackend);
-	
-	Release(request->headerDictionary);
-	free(request);
+	Release(request->headers);
+	SlabFree(HTTPRequestSlab, request);
 }
 
 static bool HTTPRequestParse(HTTPRequest request, char* buffer)
 {
-	char* actionLine;
+	Slice rest = SliceFromString(buffer);
+	Slice actionLine;
 	
-	actionLine = strsep_ext(&buffer, kHTTPLineDelimiter);
+	if (!HTTPRequestNextLine(&rest, &actionLine))
+		return false;
 	
-	if (!HTTPRequestParseActionLine(request, actionLine))
+	if (!HTTPRequestParseActionLine(request, buffer, actionLine))
 		return false;
-	if (!HTTPRequestParseHeader(request, buffer))
+	if (!HTTPRequestParseHeader(request, buffer, rest))
 		return false;
 		
 	return true;
 }
 
-static bool HTTPRequestParseActionLine(HTTPRequest request, char* line)
+//
+// Takes the next non empty line from rest, lines
+// end with \r\n or a bare \n
+//
+static bool HTTPRequestNextLine(Slice* rest, Slice* line)
+{
+	while (SliceNextToken(rest, '\n', line)) {
+		if (line->data[line->length - 1] == '\r')
+			line->length--;
+		
+		if (line->length > 0)
+			return true;
+	}
+	
+	return false;
+}
+
+//
+// The parser works on slices of the buffer and only
+// writes a \0 behind the parts it hands out. The byte after
+// a slice is always a delimiter, whitespace or the final \0.
+//
+static char* HTTPRequestTerminate(char* buffer, Slice slice)
 {
-	char* methodString;
-	char* versionString;
+	char* string = buffer + (slice.data - buffer);
 	
-	methodString = strsep_ext(&line, " ");
-	request->path = strsep_ext(&line, " ");
-	versionString = strsep_ext(&line, " ");
+	string[slice.length] = '\0';
+	
+	return string;
+}
+
+static bool HTTPRequestParseActionLine(HTTPRequest request, char* buffer, Slice line)
+{
+	Slice method;
+	Slice path;
+	Slice version;
 	
-	if (methodString == NULL)
+	if (!SliceNextToken(&line, ' ', &method))
 		return false;
-		
-	if (strncmp(methodString, "GET", strlen("GET")) == 0)
+	if (!SliceNextToken(&line, ' ', &path))
+		return false;
+	if (!SliceNextToken(&line, ' ', &version))
+		return false;
+	
+	if (SliceEqualsString(method, "GET"))
 		request->method = kHTTPMethodGet;
 	else
 		request->method = kHTTPMethodUnkown;
 	
-	if (versionString == NULL)
-		return false;
-		
-	if (strncmp(versionString, "HTTP/1.0", strlen("HTTP/1.0")) == 0)
+	if (SliceEqualsString(version, "HTTP/1.0"))
 		request->version = kHTTPVersion_1_0;
-	else if (strncmp(versionString, "HTTP/1.1", strlen("HTTP/1.1")) == 0)
+	else if (SliceEqualsString(version, "HTTP/1.1"))
 		request->version = kHTTPVersion_1_1;
 	else
 		request->version = kHTTPVersionUnkown;
-		
+	
+	request->path = HTTPRequestTerminate(buffer, path);
+	
 	return true;
 }
 
-static bool HTTPRequestParseHeader(HTTPRequest request, char* buffer)
+static bool HTTPRequestParseHeader(HTTPRequest request, char* buffer, Slice rest)
 {
-	char* line = strsep_ext(&buffer, kHTTPLineDelimiter);
+	Slice line;
 	
-	while (line != NULL) {
-		if (!HTTPRequestParseHeaderLine(request, line))
+	while (HTTPRequestNextLine(&rest, &line)) {
+		if (!HTTPRequestParseHeaderLine(request, buffer, line))
 			return false;
-		line = strsep_ext(&buffer, kHTTPLineDelimiter);
 	}
 	
 	return true;
 }
 
-static bool HTTPRequestParseHeaderLine(HTTPRequest request, char* line)
+static bool HTTPRequestParseHeaderLine(HTTPRequest request, char* buffer, Slice line)
 {
-	char* key;
-	char* value;
+	size_t separator = SliceFind(line, ':');
+	Slice key;
+	const char* name;
+	const char* value;
+	HTTPHeader header;
 	
-	key = strsep_ext(&line, kHTTPHeaderDelimiter);
-	if (!line)
+	if (separator == kSliceNotFound || separator == 0)
 		return false;
 	
-	value = strtrim(line);
+	key = SliceTo(line, separator);
+	value = HTTPRequestTerminate(buffer, SliceTrim(SliceFrom(line, separator + 1)));
+	header = HTTPHeaderFromName(key.data, key.length);
 	
-	DictionarySet(request->headerDictionary, key, value);
+	if (header != kHTTPHeaderUnknown && request->knownHeaders[header] == NULL) {
+		request->knownHeaders[header] = value;
+		return true;
+	}
 	
-	return true;
+	// The name stays in the request buffer. Clients choose
+	// it, so it must not go into the process wide intern table
+	name = HTTPRequestTerminate(buffer, key);
+	
+	// Repeated headers are all kept
+	return HTTPHeaderMapAdd(request->headers, name, value);
+}
+
+const char* HTTPRequestGetHeaderValue(HTTPRequest request, HTTPHeader header)
+{
+	if (header >= kHTTPHeaderCount)
+		return NULL;
+	
+	return request->knownHeaders[header];
 }
 
 char* HTTPRequestGetPath(HTTPRequest request)
@@ -24,6 +24,7 @@
 #define _HTTPREQUEST_H_
 
 #include "http/http.h"
+#include "http/httpheaders.h"
 
 #include <stdbool.h>
 
@@ -35,7 +36,9 @@
 bool HTTPCanParseBuffer(char* buffer);
 
 //
-// Creates an http request with a given buffer.
+// Creates an http request with a given buffer. The buffer is
+// parsed in place and must outlive the request, usually it
+// is allocated in the arena of the connection.
 //
 OBJECT_RETURNS_RETAINED
 HTTPRequest HTTPRequestCreate(char* buffer);
@@ -60,4 +63,10 @@ char* HTTPRequestGetPath(HTTPRequest request);
 //
 const char* HTTPRequestGetHeaderValueForKey(HTTPRequest request, const char* key);
 
+//
+// Returns the value of a well known header or NULL. This is
+// a plain array access, prefer it over the key variant.
+//
+const char* HTTPRequestGetHeaderValue(HTTPRequest request, HTTPHeader header);
+
 #endif /* _HTTPREQUEST_H_ */
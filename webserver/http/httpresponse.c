@@ -21,9 +21,12 @@
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "httpresponse.h"
+#include "httpheadermap.h"
 
-#include "utils/dictionary.h"
 #include "utils/helper.h"
+#include "utils/intern.h"
+#include "utils/probes.h"
+#include "utils/slab.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -39,36 +42,6 @@ typedef enum {
 	kHTTPResponseSendingComplete
 } HTTPResponseSendStatus;
 
-struct _HTTPResponseSendGeneralInfo {
-	size_t sentBytes;
-};
-
-struct _HTTPResponseSendStatusLineInfo {
-	struct _HTTPResponseSendGeneralInfo gernal;
-	char* statusLine;
-};
-
-struct _HTTPResponseSendBodyInfo {
-	struct _HTTPResponseSendGeneralInfo gernal;
-	off_t fileOffset;
-	size_t fileSize;
-};
-
-typedef enum {
-	kHTTPResponseHeadersSendKey,
-	kHTTPResponseSendersSendKeyValueDelimiter,
-	kHTTPResponseHeadersSendValue,
-	kHTTPResponseHeadersSendLineDelimiter,
-	kHTTPResponseHeadersSendHeadersEnd
-} HTTPResponseHeadersSendStatus;
-
-struct _HTTPResponseSendHeadersInfo {
-	struct _HTTPResponseSendGeneralInfo general;
-	
-	HTTPResponseHeadersSendStatus status;
-	DictionaryIterator iter;
-};
-
 DEFINE_CLASS(HTTPResponse,
 	//
 	// The connection this resposne is accosiated to
@@ -83,7 +56,7 @@ DEFINE_CLASS(HTTPResponse,
 	//
 	// Headers
 	//
-	Dictionary headerDictionary;
+	HTTPHeaderMap headers;
 	
 	//
 	// Response
@@ -94,22 +67,20 @@ DEFINE_CLASS(HTTPResponse,
 	int responseFileDescriptor;
 	
 	//
-	// Manage sending
+	// How far sending got
 	//
 	HTTPResponseSendStatus sendStatus;
-	//
-	// Extra status for sending by the current step
-	//
-	void* sendStatusExtra;
 );
 
+DEFINE_SLAB(HTTPResponse, sizeof(struct _HTTPResponse));
+
 // Convienience method for an error condition
 static void HTTPResponseDealloc(void* ptr);
 
 //
-// If returns false, you need to call this method
-// again when the socket is able to write data
+// Return false if sending failed
 //
+static void HTTPResponseSetSendStatus(HTTPResponse response, HTTPResponseSendStatus status);
 static bool HTTPResponseSendStatusLine(HTTPResponse response);
 static bool HTTPResponseSendHeaders(HTTPResponse response);
 static bool HTTPResponseSendBody(HTTPResponse response);
@@ -118,16 +89,33 @@ static bool HTTPResponseSendString(HTTPResponse response, const char* string);
 
 HTTPResponse HTTPResponseCreate(HTTPConnection connection)
 {
-	HTTPResponse response = malloc(sizeof(struct _HTTPResponse));
+	HTTPResponse response = SlabAlloc(HTTPResponseSlab);
+	
+	if (response == NULL) {
+		perror("SlabAlloc");
+		return NULL;
+	}
 	
-	memset(response, 0, sizeof(struct _HTTPResponse));
+	ObjectInit(response, &HTTPResponseClass, HTTPResponseDealloc);
 	
-	ObjectInit(response, HTTPResponseDealloc);
+	// Responses never leave the fiber of their connection
+	ObjectSetConfined(response);
 	
 	response->connection = connection;
-	response->headerDictionary = DictionaryCreate();
+	response->headers = HTTPHeaderMapCreate();
+	
+	if (response->headers == NULL) {
+		printf("Could not create header map.\n");
+		Release(response);
+		return NULL;
+	}
 	
-	HTTPResponseSetHeaderValue(response, "Server", "webserver/dev");
+	ObjectSetConfined(response->headers);
+	
+	if (!HTTPResponseSetHeaderValue(response, "Server", "webserver/dev")) {
+		Release(response);
+		return NULL;
+	}
 	
 	return response;
 }
@@ -139,8 +127,8 @@ void HTTPResponseDealloc(void* ptr)
 	if (response->responseFileDescriptor > 0)
 		close(response->responseFileDescriptor);
 	
-	Release(response->headerDictionary);
-	free(response);
+	Release(response->headers);
+	SlabFree(HTTPResponseSlab, response);
 }
 
 void HTTPResponseSetStatusCode(HTTPResponse response, HTTPStatusCode code)
@@ -148,9 +136,32 @@ void HTTPResponseSetStatusCode(HTTPResponse response, HTTPStatusCode code)
 	response->code = code;
 }
 
-void HTTPResponseSetHeaderValue(HTTPResponse response, const char* key, const char* value)
+HTTPStatusCode HTTPResponseGetStatusCode(HTTPResponse response)
 {
-	DictionarySet(response->headerDictionary, key, value);
+	return response->code;
+}
+
+bool HTTPResponseSetHeaderValue(HTTPResponse response, const char* key, const char* value)
+{
+	Arena arena = HTTPConnectionGetArena(response->connection);
+	// Header names are the same few strings for every response
+	const char* keyCopy = InternString(key);
+	char* valueCopy = ArenaStrdup(arena, value);
+	
+	if (keyCopy == NULL)
+		keyCopy = ArenaStrdup(arena, key);
+	
+	if (keyCopy == NULL || valueCopy == NULL) {
+		printf("Could not copy header %s.\n", key);
+		return false;
+	}
+	
+	if (!HTTPHeaderMapSet(response->headers, keyCopy, valueCopy)) {
+		printf("Could not set header %s.\n", key);
+		return false;
+	}
+	
+	return true;
 }
 
 void HTTPResponseSetResponseString(HTTPResponse response, char* string)
@@ -165,166 +176,70 @@ void HTTPResponseSetResponseFileDescriptor(HTTPResponse response, int fd)
 
 bool HTTPResponseSend(HTTPResponse response)
 {
-	switch(response->sendStatus) {
-	case kHTTPResponseSendingNotStarted:
-		response->sendStatus++;
-	case kHTTPResponseSendingStatusLine:
-		if (!HTTPResponseSendStatusLine(response))
-			return false;
-		response->sendStatus++;
-	case kHTTPResponseSendingHeaders:
-		if (!HTTPResponseSendHeaders(response))
-			return false;
-		response->sendStatus++;
-	case kHTTPResponseSendingBody:
-		if (!HTTPResponseSendBody(response))
-			return false;
-		response->sendStatus++;
-	case kHTTPResponseSendingComplete:
-		return true;
-	}
-}
-
-static bool HTTPResponseSendStatusLine(HTTPResponse response)
-{
-	struct _HTTPResponseSendStatusLineInfo* info = response->sendStatusExtra;
+	HTTPResponseSetSendStatus(response, kHTTPResponseSendingStatusLine);
+	if (!HTTPResponseSendStatusLine(response))
+		return false;
 	
-	if (!info) {
-		response->sendStatusExtra = malloc(sizeof(struct _HTTPResponseSendStatusLineInfo));
-		
-		memset(response->sendStatusExtra, 0, sizeof(struct _HTTPResponseSendStatusLineInfo));
-		
-		info = response->sendStatusExtra;
-		
-		uint maxLineLength = 255;
-		info->statusLine = malloc(sizeof(char) * maxLineLength);
-		snprintf(info->statusLine, maxLineLength, "HTTP/1.0 %3d %s\r\n", response->code, HTTPStatusNameFromCode(response->code));
-	}
+	HTTPResponseSetSendStatus(response, kHTTPResponseSendingHeaders);
+	if (!HTTPResponseSendHeaders(response))
+		return false;
 	
-	if (!HTTPResponseSendString(response, info->statusLine))
+	HTTPResponseSetSendStatus(response, kHTTPResponseSendingBody);
+	if (!HTTPResponseSendBody(response))
 		return false;
-
-	free(info->statusLine);
-	free(response->sendStatusExtra);
-	response->sendStatusExtra = NULL;
+	
+	HTTPResponseSetSendStatus(response, kHTTPResponseSendingComplete);
 	return true;
 }
 
-static bool HTTPResponseSendHeaders(HTTPResponse response)
+static void HTTPResponseSetSendStatus(HTTPResponse response, HTTPResponseSendStatus status)
 {
-	struct _HTTPResponseSendHeadersInfo* info = response->sendStatusExtra;
-	
-	if (!info) {
-		response->sendStatusExtra = malloc(sizeof(struct _HTTPResponseSendHeadersInfo));
-		
-		memset(response->sendStatusExtra, 0, sizeof(struct _HTTPResponseSendHeadersInfo));
-		
-		info = response->sendStatusExtra;
-		
-		info->status = kHTTPResponseHeadersSendKey;
-		info->iter = DictionaryGetIterator(response->headerDictionary);
-	}
-	
-	while(DictionaryIteratorGetKey(info->iter) != NULL) {
-		switch(info->status) {
-		case kHTTPResponseHeadersSendKey:
-		{
-			char* key = DictionaryIteratorGetKey(info->iter);
-			
-			if (!HTTPResponseSendString(response, key))
-				return false;
-
-			info->status++;
-		}
-			break;
-		case kHTTPResponseSendersSendKeyValueDelimiter:
-		{
-			char* del = ": ";
-			
-			if (!HTTPResponseSendString(response, del))
-				return false;
-
-			info->status++;
-		}
-			break;
-		case kHTTPResponseHeadersSendValue:
-		{
-			char* value = DictionaryIteratorGetValue(info->iter);
-			
-			if (!HTTPResponseSendString(response, value))
-				return false;
-
-			info->status++;
-		}
-			break;
-		case kHTTPResponseHeadersSendLineDelimiter:
-		{
-			char* del = "\r\n";
-			
-			if (!HTTPResponseSendString(response, del))
-				return false;
+	PROBE2(response__stage, response, status);
+	response->sendStatus = status;
+}
 
-			if (DictionaryIteratorNext(info->iter)) {
-				info->status = kHTTPResponseHeadersSendKey;
-			}
-			else {
-				info->status++;
-			}
-		}
-			break;
-		case kHTTPResponseHeadersSendHeadersEnd:
-			break;
-		};
-	}
+static bool HTTPResponseSendStatusLine(HTTPResponse response)
+{
+	char statusLine[255];
 	
-	if (info->status == kHTTPResponseHeadersSendHeadersEnd) {
-		char* del = "\r\n";
-			
-		if (!HTTPResponseSendString(response, del))
-			return false;
+	snprintf(statusLine, sizeof(statusLine), "HTTP/1.0 %3d %s\r\n", response->code, HTTPStatusNameFromCode(response->code));
+	
+	return HTTPResponseSendString(response, statusLine);
+}
 
-		info->status++;
-		Release(info->iter);
-		free(response->sendStatusExtra);
-		response->sendStatusExtra = NULL;
+static bool HTTPResponseSendHeaders(HTTPResponse response)
+{
+	size_t count = HTTPHeaderMapGetCount(response->headers);
+	bool success = true;
+	
+	// Headers go out in the order they were set
+	for (size_t i = 0; success && i < count; i++) {
+		success = HTTPResponseSendString(response, HTTPHeaderMapGetName(response->headers, i))
+			&& HTTPResponseSendString(response, ": ")
+			&& HTTPResponseSendString(response, HTTPHeaderMapGetValue(response->headers, i))
+			&& HTTPResponseSendString(response, "\r\n");
 	}
 	
-	return true;
+	return success && HTTPResponseSendString(response, "\r\n");
 }
 
 static bool HTTPResponseSendBody(HTTPResponse response)
 {
-	struct _HTTPResponseSendBodyInfo* info = response->sendStatusExtra;
-	
-	if (!info) {
-		response->sendStatusExtra = malloc(sizeof(struct _HTTPResponseSendBodyInfo));
-		
-		memset(response->sendStatusExtra, 0, sizeof(struct _HTTPResponseSendBodyInfo));
-		
-		info = response->sendStatusExtra;
-		
-		if (response->responseFileDescriptor) {
-			struct stat stat;
-			
-			if (fstat(response->responseFileDescriptor, &stat) < 0) {
-				perror("fstat");
-			}
-			info->fileSize = (size_t)stat.st_size;
-		}
-	}
-
 	if (response->responseString) {
-		if (!HTTPResponseSendString(response, response->responseString))
-			return false;
+		return HTTPResponseSendString(response, response->responseString);
 	}
 	else if (response->responseFileDescriptor) {
-		if (!HTTPConnectionSendFD(response->connection, response->responseFileDescriptor, &info->fileOffset, info->fileSize - (size_t)info->fileOffset))
+		struct stat stat;
+		off_t offset = 0;
+		
+		if (fstat(response->responseFileDescriptor, &stat) < 0) {
+			perror("fstat");
 			return false;
+		}
+		
+		return HTTPConnectionSendFD(response->connection, response->responseFileDescriptor, &offset, (size_t)stat.st_size);
 	}
 	
-	free(info);
-	response->sendStatusExtra = NULL;
-
 	return true;
 }
 
@@ -335,23 +250,5 @@ void HTTPResponseFinish(HTTPResponse response)
 
 static bool HTTPResponseSendString(HTTPResponse response, const char* string)
 {
-	struct _HTTPResponseSendGeneralInfo* info = response->sendStatusExtra;
-	ssize_t s;
-			
-	s = HTTPConnectionSend(response->connection, string + info->sentBytes,
-				strlen(string) - info->sentBytes);
-			
-	if (s < 0) {
-		perror("send");
-		return false;
-	}
-			
-	info->sentBytes += (size_t)s;
-			
-	if (info->sentBytes < strlen(string)) {
-		return false;
-	}
-	
-	info->sentBytes = 0;
-	return true;
+	return HTTPConnectionSend(response->connection, string, strlen(string));
 }
@@ -44,9 +44,17 @@ HTTPResponse HTTPResponseCreate(HTTPConnection connection);
 void HTTPResponseSetStatusCode(HTTPResponse response, HTTPStatusCode code);
 
 //
-// Set a given value for the header field.
+// Returns the status code of the response
 //
-void HTTPResponseSetHeaderValue(HTTPResponse response, const char* key, const char* value);
+HTTPStatusCode HTTPResponseGetStatusCode(HTTPResponse response);
+
+//
+// Set a given value for the header field. Key and value are
+// copied into the arena of the connection.
+//
+// Returns false if there was no memory left for the header.
+//
+bool HTTPResponseSetHeaderValue(HTTPResponse response, const char* key, const char* value);
 
 //
 // Set a string to be delivered as response.
@@ -63,8 +71,11 @@ void HTTPResponseSetResponseString(HTTPResponse response, char* string);
 void HTTPResponseSetResponseFileDescriptor(HTTPResponse response, int fd);
 
 //
-// Sends the response over the connection.
+// Sends the response over the connection. Must be called
+// from the fiber of the connection, which is suspended
+// while the socket can not take more data.
 //
+// Returns false if the response could not be sent.
 //
 bool HTTPResponseSend(HTTPResponse response);
 
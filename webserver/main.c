@@ -23,24 +23,101 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
 
 #include "utils/object.h"
 #include "net/server.h"
 #include "utils/helper.h"
+#include "http/httpaccesslog.h"
+#include "http/httpconnection.h"
+#include "utils/trace.h"
+
+//
+// Default load shedding thresholds in milliseconds
+//
+#define kDefaultShedTarget 10
+#define kDefaultShedInterval 100
+
+//
+// Size of one access log segment
+//
+#define kDefaultAccessLogSegmentSize (64 * 1024 * 1024)
+
+//
+// Where SIGUSR1 writes the trace to
+//
+#define kTraceDumpPath "webserver-trace.json"
+
+static void usage(const char* name)
+{
+	printf("Usage: %s [-a] [-r docroot] [-l access-log] [-T rate] [-t target-ms] [-i interval-ms] [port]\n", name);
+	printf("  -a  Run all work of a connection on one worker\n");
+	printf("  -r  Serve files from this directory\n");
+	printf("  -l  Log requests to this file in %d MB segments, see logdecode\n", kDefaultAccessLogSegmentSize / 1024 / 1024);
+	printf("  -T  Trace one of every rate requests, SIGUSR1 writes them to %s\n", kTraceDumpPath);
+	printf("  -t  Shed new requests when they wait longer than this (0 disables, default %d)\n", kDefaultShedTarget);
+	printf("  -i  ... for at least this long (default %d)\n", kDefaultShedInterval);
+}
 
 int main(int argc, char** argv) {
 	char* port = "8080";
+	char* accessLog = NULL;
+	uint32_t traceRate = 0;
+	uint32_t shedTarget = kDefaultShedTarget;
+	uint32_t shedInterval = kDefaultShedInterval;
+	WebServerFlags flags = 0;
+	int c;
 	
 	setBlocking(0, false);
 	ObjectRuntimeInit();
+	
+	while ((c = getopt(argc, argv, "ar:l:T:t:i:h")) != -1) {
+		switch (c) {
+			case 'a':
+				flags |= kWebServerAffine;
+				break;
+			case 'r':
+				if (!HTTPConnectionSetDocumentRoot(optarg))
+					return 1;
+				break;
+			case 'l':
+				accessLog = optarg;
+				break;
+			case 'T':
+				traceRate = (uint32_t)strtoul(optarg, NULL, 10);
+				break;
+			case 't':
+				shedTarget = (uint32_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'i':
+				shedInterval = (uint32_t)strtoul(optarg, NULL, 10);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
 
-	if (argc == 2)
-		port = argv[1];
+	if (optind < argc)
+		port = argv[optind];
+	
+	if (accessLog && !HTTPAccessLogOpen(accessLog, kDefaultAccessLogSegmentSize))
+		return 1;
+	
+	if (traceRate > 0) {
+		TraceSetSampling(traceRate);
+		
+		if (!TraceDumpOnSignal(kTraceDumpPath))
+			return 1;
+	}
 	
-	WebServer server = WebServerCreate(port);
+	WebServer server = WebServerCreate(port, flags);
 	
-	if (server)
+	if (server) {
+		WebServerSetLoadShedding(server, shedTarget, shedInterval);
 		WebServerRunloop(server);
+	}
 	
 	return 0;
 }
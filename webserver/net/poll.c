@@ -21,29 +21,51 @@
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "poll.h"
-#include "utils/queue.h"
+#include "utils/ringqueue.h"
 #include "utils/helper.h"
+#include "utils/probes.h"
 
 #include <string.h>
 #include <pthread.h>
 #include <poll.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <Block.h>
 #include <assert.h>
 
+//
+// Number of pending updates that fit into the ring,
+// everything above that spills into a linked queue
+//
+#define kPollUpdateQueueCapacity 256
+
 struct _PollInfo {
 	PollFlags flags;
 	DispatchQueue queue;
+	DispatchQoS qos;
 	void (^block)(short revents);
 };
 
+//
+// A block that is going to be dispatched at the
+// end of the current poll round
+//
+struct _PollDispatch {
+	DispatchQueue queue;
+	DispatchQoS qos;
+	int fd;
+	void (^block)();
+};
+
 struct _PollUpdate {
 	struct pollfd poll;
 	struct _PollInfo pollInfo;
 };
 
+DEFINE_ALLOCATION_CLASS(PollUpdate, sizeof(struct _PollUpdate));
+
 DEFINE_CLASS(Poll,	
 	pthread_t thread;
 	
@@ -51,7 +73,7 @@ DEFINE_CLASS(Poll,
 	// Updates to the poll
 	// are enqueue here until they are applied
 	//
-	Queue updateQueue;
+	RingQueue updateQueue;
 	
 	//
 	// Fds used to wake up the poll to flush changes
@@ -66,11 +88,31 @@ DEFINE_CLASS(Poll,
 	struct _PollInfo* pollInfos;
 	uint32_t numOfPolls;
 	uint32_t numOfSlots;
+	
+	//
+	// Blocks collected in one poll round, they
+	// get dispatched batched per queue. The fd is
+	// the key for affine queues.
+	//
+	struct _PollDispatch* dispatches;
+	void (^*dispatchBatch)();
+	uintptr_t* dispatchKeys;
+	uint32_t numOfDispatches;
+	uint32_t numOfDispatchSlots;
+	
+	//
+	// Only written by the poll thread, read
+	// with PollGetStats
+	//
+	PollStats stats;
 );
 
 static void* PollThread(void* ptr);
 static void PollDealloc(void* ptr);
-static void PollApplyUpdates(Poll poll);
+static uint32_t PollApplyUpdates(Poll poll);
+static void PollCollectDispatch(Poll poll, DispatchQueue queue, DispatchQoS qos, int fd, void (^block)());
+static void PollFlushDispatches(Poll poll);
+static void PollStatsAdd(uint64_t* value, uint64_t amount);
 
 Poll PollCreate()
 {
@@ -83,7 +125,7 @@ Poll PollCreate()
 	
 	memset(poll, 0, sizeof(struct _Poll));
 	
-	ObjectInit(poll, PollDealloc);
+	ObjectInit(poll, &PollClass, PollDealloc);
 	
 	poll->numOfSlots = 10;
 	poll->numOfPolls = 0;
@@ -107,7 +149,7 @@ Poll PollCreate()
 	
 	memset(poll->pollInfos, 0, sizeof(struct _PollInfo) * poll->numOfSlots);
 	
-	poll->updateQueue = QueueCreate();
+	poll->updateQueue = RingQueueCreate(kPollUpdateQueueCapacity, kRingQueueOverflowSpill);
 	if (poll->updateQueue == NULL) {
 		printf("Could not create poll update queue...\n");
 		Release(poll);
@@ -133,6 +175,11 @@ Poll PollCreate()
 }
 
 void PollRegister(Poll poll, int fd, short events, PollFlags flags, DispatchQueue queue, void (^block)(short revents))
+{
+	PollRegisterWithQoS(poll, fd, events, flags, queue, kDispatchQoSDefault, block);
+}
+
+void PollRegisterWithQoS(Poll poll, int fd, short events, PollFlags flags, DispatchQueue queue, DispatchQoS qos, void (^block)(short revents))
 {
 	struct _PollUpdate* update = malloc(sizeof(struct _PollUpdate));
 	
@@ -141,6 +188,7 @@ void PollRegister(Poll poll, int fd, short events, PollFlags flags, DispatchQueu
 		return;
 	}
 	
+	ObjectClassCount(&PollUpdateClass, 1);
 	memset(update, 0, sizeof(struct _PollUpdate));
 	
 	update->poll.fd = fd;
@@ -149,8 +197,17 @@ void PollRegister(Poll poll, int fd, short events, PollFlags flags, DispatchQueu
 	if (queue)
 		update->pollInfo.queue = Retain(queue);
 	update->pollInfo.flags = flags;
-	
-	QueueEnqueue(poll->updateQueue, update);
+	update->pollInfo.qos = qos;
+	
+	if (!RingQueueEnqueue(poll->updateQueue, update)) {
+		printf("Could not register fd %d.\n", fd);
+		Block_release(update->pollInfo.block);
+		if (queue)
+			Release(queue);
+		ObjectClassUncount(&PollUpdateClass, 1);
+		free(update);
+		return;
+	}
 	
 	// Notify to reload the poll descritors
 	// Not interested in write errors here
@@ -167,11 +224,17 @@ void PollUnregister(Poll poll, int fd)
 		return;
 	}
 	
+	ObjectClassCount(&PollUpdateClass, 1);
 	memset(update, 0, sizeof(struct _PollUpdate));
 	
 	update->poll.fd = fd;
 	
-	QueueEnqueue(poll->updateQueue, update);
+	if (!RingQueueEnqueue(poll->updateQueue, update)) {
+		printf("Could not unregister fd %d.\n", fd);
+		ObjectClassUncount(&PollUpdateClass, 1);
+		free(update);
+		return;
+	}
 	
 	// Notify to reload the poll descritors
 	// Not interested in write errors here
@@ -191,24 +254,51 @@ static void* PollThread(void* ptr)
 #pragma unused(revents)
 	});
 	
+	uint64_t roundStart = monotonicTime();
+	
 	for (;;) {
+		uint64_t now;
+		uint32_t updates;
+		
 		// Update the poll before to ensure we get all
-		PollApplyUpdates(p);
+		updates = PollApplyUpdates(p);
 		
+		now = monotonicTime();
+		HistogramRecord(&p->stats.roundTime, now - roundStart);
+		
+		PROBE2(poll__wait, p, p->numOfPolls);
 		socksToHandle = poll(p->polls, p->numOfPolls, 1000);
+		PROBE2(poll__wakeup, p, socksToHandle);
+		
+		roundStart = monotonicTime();
+		HistogramRecord(&p->stats.blockedTime, roundStart - now);
+		PollStatsAdd(&p->stats.wakeups, 1);
 		
 		// Update after to not notify deleted poll requests
-		PollApplyUpdates(p);
+		updates += PollApplyUpdates(p);
+		
+		now = monotonicTime();
+		HistogramRecord(&p->stats.updateTime, now - roundStart);
+		HistogramRecord(&p->stats.updatesPerRound, updates);
+		PollStatsAdd(&p->stats.updates, updates);
 		
 		if (socksToHandle < 0) {
 			perror("poll");
 			return NULL;
 		}
 		else {
+			if (socksToHandle == 0)
+				PollStatsAdd(&p->stats.timeouts, 1);
+			
+			HistogramRecord(&p->stats.readyPerWakeup, (uint64_t)socksToHandle);
+			
 			for (uint32_t i = 0; i < p->numOfPolls && socksToHandle > 0; i++) {
 				if (p->polls[i].revents > 0) {
 					socksToHandle--;
 					
+					if (p->polls[i].fd == p->updateFDs[0])
+						PollStatsAdd(&p->stats.pipeWakeups, 1);
+					
 					// Dont repeat so remove it
 					// We need to enqueue the update before to let the block
 					// reregister itself
@@ -221,23 +311,33 @@ static void* PollThread(void* ptr)
 					if (p->pollInfos[i].queue) {
 						short revents = p->polls[i].revents;
 						void (^block)(short revents) = p->pollInfos[i].block; // Get a reference to properly retain the block
-						Dispatch(p->pollInfos[i].queue, ^{
+						PollCollectDispatch(p, p->pollInfos[i].queue, p->pollInfos[i].qos, p->polls[i].fd, ^{
 							block(revents);
 						});
+						PollStatsAdd(&p->stats.dispatchedCallbacks, 1);
 					}
-					else
+					else {
+						uint64_t start = monotonicTime();
+						
 						p->pollInfos[i].block(p->polls[i].revents);
+						
+						HistogramRecord(&p->stats.callbackTime, monotonicTime() - start);
+						PollStatsAdd(&p->stats.inlineCallbacks, 1);
+					}
 				}
 			}
+			
+			PollFlushDispatches(p);
 		}
 	}
 	
 	return NULL;
 }
 
-static void PollApplyUpdates(Poll poll)
+static uint32_t PollApplyUpdates(Poll poll)
 {
 	struct _PollUpdate *update;
+	uint32_t count = 0;
 	
 	// Just read away all the notify-bytes that piled up
 	{
@@ -245,7 +345,7 @@ static void PollApplyUpdates(Poll poll)
 		read(poll->updateFDs[0], buffer, 255);
 	}
 	
-	while ((update = QueueDrain(poll->updateQueue)) != NULL) {
+	while ((update = RingQueueDrain(poll->updateQueue)) != NULL) {
 		// Add/Update
 		if (update->pollInfo.block) {
 			uint32_t foundIndex = UINT32_MAX;
@@ -283,6 +383,7 @@ static void PollApplyUpdates(Poll poll)
 			// Copy occoured when enqueued to update
 			poll->pollInfos[foundIndex].block = update->pollInfo.block;
 			poll->pollInfos[foundIndex].flags = update->pollInfo.flags;
+			poll->pollInfos[foundIndex].qos = update->pollInfo.qos;
 			if (poll->pollInfos[foundIndex].queue) {
 				Release(poll->pollInfos[foundIndex].queue);
 			}
@@ -315,8 +416,88 @@ static void PollApplyUpdates(Poll poll)
 			}
 		}
 		
+		ObjectClassUncount(&PollUpdateClass, 1);
 		free(update);
+		count++;
+	}
+	
+	return count;
+}
+
+static void PollCollectDispatch(Poll poll, DispatchQueue queue, DispatchQoS qos, int fd, void (^block)())
+{
+	// Expand
+	if (poll->numOfDispatches >= poll->numOfDispatchSlots) {
+		poll->numOfDispatchSlots = poll->numOfDispatchSlots ? poll->numOfDispatchSlots * 2 : 16;
+		poll->dispatches = realloc(poll->dispatches, sizeof(struct _PollDispatch) * poll->numOfDispatchSlots);
+		assert(poll->dispatches);
+		poll->dispatchBatch = realloc(poll->dispatchBatch, sizeof(void (^)()) * poll->numOfDispatchSlots);
+		assert(poll->dispatchBatch);
+		poll->dispatchKeys = realloc(poll->dispatchKeys, sizeof(uintptr_t) * poll->numOfDispatchSlots);
+		assert(poll->dispatchKeys);
+	}
+	
+	// The block lives on the stack of the loop, so copy it
+	poll->dispatches[poll->numOfDispatches].queue = queue;
+	poll->dispatches[poll->numOfDispatches].qos = qos;
+	poll->dispatches[poll->numOfDispatches].fd = fd;
+	poll->dispatches[poll->numOfDispatches].block = Block_copy(block);
+	poll->numOfDispatches++;
+}
+
+static void PollFlushDispatches(Poll poll)
+{
+	// There are only very few different queues, so
+	// just collect all blocks of the first remaining queue
+	// and qos until everything is dispatched
+	for (uint32_t i = 0; i < poll->numOfDispatches; i++) {
+		DispatchQueue queue = poll->dispatches[i].queue;
+		DispatchQoS qos = poll->dispatches[i].qos;
+		uint32_t count = 0;
+		
+		if (queue == NULL)
+			continue;
+		
+		for (uint32_t j = i; j < poll->numOfDispatches; j++) {
+			if (poll->dispatches[j].queue == queue && poll->dispatches[j].qos == qos) {
+				poll->dispatchKeys[count] = (uintptr_t)poll->dispatches[j].fd;
+				poll->dispatchBatch[count++] = poll->dispatches[j].block;
+				poll->dispatches[j].queue = NULL;
+			}
+		}
+		
+		DispatchAffineBatch(queue, qos, poll->dispatchKeys, poll->dispatchBatch, count);
+		
+		for (uint32_t j = 0; j < count; j++)
+			Block_release(poll->dispatchBatch[j]);
 	}
+	
+	poll->numOfDispatches = 0;
+}
+
+void PollGetStats(Poll poll, PollStats* stats)
+{
+	stats->wakeups = __atomic_load_n(&poll->stats.wakeups, __ATOMIC_RELAXED);
+	stats->timeouts = __atomic_load_n(&poll->stats.timeouts, __ATOMIC_RELAXED);
+	stats->pipeWakeups = __atomic_load_n(&poll->stats.pipeWakeups, __ATOMIC_RELAXED);
+	stats->updates = __atomic_load_n(&poll->stats.updates, __ATOMIC_RELAXED);
+	stats->inlineCallbacks = __atomic_load_n(&poll->stats.inlineCallbacks, __ATOMIC_RELAXED);
+	stats->dispatchedCallbacks = __atomic_load_n(&poll->stats.dispatchedCallbacks, __ATOMIC_RELAXED);
+	HistogramCopy(&stats->blockedTime, &poll->stats.blockedTime);
+	HistogramCopy(&stats->roundTime, &poll->stats.roundTime);
+	HistogramCopy(&stats->updateTime, &poll->stats.updateTime);
+	HistogramCopy(&stats->updatesPerRound, &poll->stats.updatesPerRound);
+	HistogramCopy(&stats->readyPerWakeup, &poll->stats.readyPerWakeup);
+	HistogramCopy(&stats->callbackTime, &poll->stats.callbackTime);
+}
+
+//
+// There is only one writer, so a plain add is enough. The
+// store is atomic to not tear for PollGetStats.
+//
+static void PollStatsAdd(uint64_t* value, uint64_t amount)
+{
+	__atomic_store_n(value, *value + amount, __ATOMIC_RELAXED);
 }
 
 static void PollDealloc(void* ptr)
@@ -333,5 +514,14 @@ static void PollDealloc(void* ptr)
 	if (poll->pollInfos)
 		free(poll->pollInfos);
 	
+	if (poll->dispatches)
+		free(poll->dispatches);
+	
+	if (poll->dispatchBatch)
+		free(poll->dispatchBatch);
+	
+	if (poll->dispatchKeys)
+		free(poll->dispatchKeys);
+	
 	free(poll);
 }
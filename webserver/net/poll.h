@@ -25,9 +25,74 @@
 
 #include "utils/object.h"
 #include "utils/dispatchqueue.h"
+#include "utils/histogram.h"
+
+#include <stdint.h>
 
 DECLARE_CLASS(Poll);
 
+//
+// What the poll thread spent its time on. Durations
+// are in nanoseconds.
+//
+typedef struct {
+	//
+	// Returns from poll(2), and how many of them
+	// were timeouts without any ready fd
+	//
+	uint64_t wakeups;
+	uint64_t timeouts;
+	
+	//
+	// Wakeups because of the update pipe, i.e. a
+	// register or unregister from another thread
+	//
+	uint64_t pipeWakeups;
+	
+	//
+	// Registrations and removals applied
+	//
+	uint64_t updates;
+	
+	//
+	// Ready fds whose block was called in the poll thread
+	// or dispatched to a queue
+	//
+	uint64_t inlineCallbacks;
+	uint64_t dispatchedCallbacks;
+	
+	//
+	// Time blocked in poll(2)
+	//
+	Histogram blockedTime;
+	
+	//
+	// Time from the wakeup until the next poll(2),
+	// everything below is part of this
+	//
+	Histogram roundTime;
+	
+	//
+	// Time applying updates, per round
+	//
+	Histogram updateTime;
+	
+	//
+	// Updates applied per round
+	//
+	Histogram updatesPerRound;
+	
+	//
+	// Ready fds per wakeup
+	//
+	Histogram readyPerWakeup;
+	
+	//
+	// Run time of a block called in the poll thread
+	//
+	Histogram callbackTime;
+} PollStats;
+
 typedef enum {
 	//
 	// This means that a registered block
@@ -49,13 +114,28 @@ Poll PollCreate();
 // with the specified flags
 //
 // The block will be dispatched on the given queue.
-// Null means that it is called inplace.
+// Null means that it is called inplace. On affine queues
+// all blocks of one fd run on the same worker.
 //
 void PollRegister(Poll poll, int fd, short events, PollFlags flags, DispatchQueue queue, void (^block)(short revents));
 
+//
+// Same as PollRegister but the block is dispatched
+// with the given quality of service. PollRegister
+// uses kDispatchQoSDefault.
+//
+void PollRegisterWithQoS(Poll poll, int fd, short events, PollFlags flags, DispatchQueue queue, DispatchQoS qos, void (^block)(short revents));
+
 //
 // Removes a registered listener (if any)
 //
 void PollUnregister(Poll poll, int fd);
 
+//
+// Copies the statistics of the poll thread. The counters
+// are read one by one while the thread goes on, so they
+// may be off by a round.
+//
+void PollGetStats(Poll poll, PollStats* stats);
+
 #endif /* _POLL_H_ */
@@ -24,8 +24,12 @@
 #include "utils/helper.h"
 #include "http/http.h"
 #include "http/httpconnection.h"
+#include "http/httpaccesslog.h"
 #include "utils/dispatchqueue.h"
 #include "utils/queue.h"
+#include "utils/metrics.h"
+#include "utils/slab.h"
+#include "utils/arena.h"
 
 #include <netinet/in.h>
 #include <netdb.h>
@@ -42,6 +46,11 @@
 #include <signal.h>
 #endif
 
+//
+// Workers per queue that get a utilization sample
+//
+#define kWebServerMaxWorkerStats 256
+
 struct _Server {
 	WebServer webServer;
 	
@@ -73,11 +82,19 @@ struct _WebServer {
 static bool CreateServers(WebServer webServer, char* port);
 static Server CreateServer(WebServer webServer, struct addrinfo *info);
 
-WebServer WebServerCreate(char* port)
+//
+// Exposes the queues, slabs and arenas as metrics
+//
+static void WebServerRegisterMetrics(WebServer webServer);
+static void WebServerWriteQueueMetrics(MetricsWriter writer, const DispatchQueue* queues, uint32_t count);
+static const char* WebServerGetQueueName(DispatchQueue queue);
+static void WebServerWritePollMetrics(MetricsWriter writer, Poll poll);
+
+WebServer WebServerCreate(char* port, WebServerFlags flags)
 {
 	WebServer webServer = malloc(sizeof(struct _WebServer));
 		
-	webServer->ioQueue = DispatchQueueCreate(0);
+	webServer->ioQueue = DispatchQueueCreate((flags & kWebServerAffine) ? kDispatchQueueAffine : 0);
 	
 	if (webServer->ioQueue == NULL) {
 		Release(webServer);
@@ -85,7 +102,12 @@ WebServer WebServerCreate(char* port)
 		return NULL;
 	}
 	
-	webServer->processingQueue = DispatchQueueCreate(0);
+	// A second set of workers would move the connection
+	// to another cpu again
+	if (flags & kWebServerAffine)
+		webServer->processingQueue = Retain(webServer->ioQueue);
+	else
+		webServer->processingQueue = DispatchQueueCreate(0);
 	
 	if (webServer->processingQueue == NULL) {
 		Release(webServer);
@@ -93,6 +115,13 @@ WebServer WebServerCreate(char* port)
 		return NULL;
 	}
 	
+	DispatchQueueSetName(webServer->ioQueue, "io");
+	DispatchQueueSetStatsEnabled(webServer->ioQueue, true);
+	if (webServer->processingQueue != webServer->ioQueue) {
+		DispatchQueueSetName(webServer->processingQueue, "processing");
+		DispatchQueueSetStatsEnabled(webServer->processingQueue, true);
+	}
+	
 	webServer->numberOfServers = 0;
 	webServer->poll = PollCreate();
 	
@@ -120,9 +149,16 @@ WebServer WebServerCreate(char* port)
 		return NULL;
 	}
 	
+	WebServerRegisterMetrics(webServer);
+	
 	return webServer;
 }
 
+void WebServerSetLoadShedding(WebServer webServer, uint32_t target, uint32_t interval)
+{
+	DispatchQueueSetCoDel(webServer->processingQueue, (uint64_t)target * 1000000, (uint64_t)interval * 1000000);
+}
+
 void WebServerRunloop(WebServer webServer)
 {
 	webServer->keepRunning = true;
@@ -243,6 +279,215 @@ static Server CreateServer(WebServer webServer, struct addrinfo *serverInfo)
 	return server;
 }
 
+static void WebServerRegisterMetrics(WebServer webServer)
+{
+	DispatchQueue ioQueue = webServer->ioQueue;
+	DispatchQueue processingQueue = webServer->processingQueue;
+	Poll poll = webServer->poll;
+	
+	MetricsRegisterCollector(^(MetricsWriter writer) {
+		WebServerWritePollMetrics(writer, poll);
+	});
+	
+	MetricsRegisterCollector(^(MetricsWriter writer) {
+		const DispatchQueue queues[] = { ioQueue, processingQueue };
+		
+		// Affine servers process on the io queue
+		WebServerWriteQueueMetrics(writer, queues, processingQueue != ioQueue ? 2 : 1);
+	});
+	
+	MetricsRegisterCollector(^(MetricsWriter writer) {
+		SlabStats stats[64];
+		uint32_t count = SlabCopyStats(stats, 64);
+		char labels[128];
+		
+		MetricsWriteHeader(writer, "webserver_slab_live_objects", "Objects allocated from a slab", kMetricGauge);
+		for (uint32_t i = 0; i < count; i++) {
+			snprintf(labels, sizeof(labels), "slab=\"%s\"", stats[i].name);
+			MetricsWriteSample(writer, "webserver_slab_live_objects", labels, (double)stats[i].live);
+		}
+		
+		MetricsWriteHeader(writer, "webserver_slab_allocations_total", "Allocations from a slab", kMetricCounter);
+		for (uint32_t i = 0; i < count; i++) {
+			snprintf(labels, sizeof(labels), "slab=\"%s\"", stats[i].name);
+			MetricsWriteSample(writer, "webserver_slab_allocations_total", labels, (double)stats[i].allocations);
+		}
+	});
+	
+	MetricsRegisterCollector(^(MetricsWriter writer) {
+		ObjectClassStats stats[64];
+		uint32_t count = ObjectCopyClassStats(stats, 64);
+		char labels[128];
+		
+		MetricsWriteHeader(writer, "webserver_objects_live", "Objects of a class alive right now", kMetricGauge);
+		for (uint32_t i = 0; i < count; i++) {
+			snprintf(labels, sizeof(labels), "class=\"%s\"", stats[i].name);
+			MetricsWriteSample(writer, "webserver_objects_live", labels, (double)stats[i].live);
+		}
+		
+		MetricsWriteHeader(writer, "webserver_objects_peak", "Most objects of a class alive at once", kMetricGauge);
+		for (uint32_t i = 0; i < count; i++) {
+			snprintf(labels, sizeof(labels), "class=\"%s\"", stats[i].name);
+			MetricsWriteSample(writer, "webserver_objects_peak", labels, (double)stats[i].peak);
+		}
+		
+		MetricsWriteHeader(writer, "webserver_object_allocations_total", "Objects of a class ever created", kMetricCounter);
+		for (uint32_t i = 0; i < count; i++) {
+			snprintf(labels, sizeof(labels), "class=\"%s\"", stats[i].name);
+			MetricsWriteSample(writer, "webserver_object_allocations_total", labels, (double)stats[i].allocations);
+		}
+		
+		MetricsWriteHeader(writer, "webserver_object_allocated_bytes_total", "Bytes of the objects of a class ever created", kMetricCounter);
+		for (uint32_t i = 0; i < count; i++) {
+			snprintf(labels, sizeof(labels), "class=\"%s\"", stats[i].name);
+			MetricsWriteSample(writer, "webserver_object_allocated_bytes_total", labels, (double)stats[i].allocations * (double)stats[i].size);
+		}
+	});
+	
+	MetricsRegisterCollector(^(MetricsWriter writer) {
+		ArenaStats stats;
+		
+		ArenaCopyStats(&stats);
+		
+		MetricsWriteHeader(writer, "webserver_arena_resets_total", "Arena resets, one per request", kMetricCounter);
+		MetricsWriteSample(writer, "webserver_arena_resets_total", NULL, (double)stats.resets);
+		MetricsWriteHeader(writer, "webserver_arena_overflows_total", "Resets of arenas that needed more than their first chunk", kMetricCounter);
+		MetricsWriteSample(writer, "webserver_arena_overflows_total", NULL, (double)stats.overflows);
+		MetricsWriteHeader(writer, "webserver_arena_high_water_bytes", "The most bytes an arena used for one request", kMetricGauge);
+		MetricsWriteSample(writer, "webserver_arena_high_water_bytes", NULL, (double)stats.highWater);
+	});
+	
+	MetricsRegisterCollector(^(MetricsWriter writer) {
+		uint64_t dropped = HTTPAccessLogGetDropped();
+		
+		MetricsWriteHeader(writer, "webserver_access_log_dropped_total", "Access log records dropped because the writer fell behind", kMetricCounter);
+		MetricsWriteSample(writer, "webserver_access_log_dropped_total", NULL, (double)dropped);
+	});
+}
+
+static void WebServerWriteQueueMetrics(MetricsWriter writer, const DispatchQueue* queues, uint32_t count)
+{
+	static const char* const kQoSNames[kDispatchQoSLevels] = {
+		[kDispatchQoSInteractive] = "interactive",
+		[kDispatchQoSDefault] = "default",
+		[kDispatchQoSBackground] = "background"
+	};
+	char labels[128];
+	
+	// All samples of a name have to follow its header
+	MetricsWriteHeader(writer, "webserver_queue_depth", "Blocks waiting in a dispatch queue", kMetricGauge);
+	for (uint32_t i = 0; i < count; i++) {
+		for (DispatchQoS qos = 0; qos < kDispatchQoSLevels; qos++) {
+			uint32_t depth = DispatchQueueGetDepth(queues[i], qos);
+			
+			snprintf(labels, sizeof(labels), "queue=\"%s\",qos=\"%s\"", WebServerGetQueueName(queues[i]), kQoSNames[qos]);
+			MetricsWriteSample(writer, "webserver_queue_depth", labels, depth);
+		}
+	}
+	
+	MetricsWriteHeader(writer, "webserver_queue_threads", "Worker threads of a dispatch queue", kMetricGauge);
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t threads = DispatchQueueGetThreadCount(queues[i]);
+		
+		snprintf(labels, sizeof(labels), "queue=\"%s\"", WebServerGetQueueName(queues[i]));
+		MetricsWriteSample(writer, "webserver_queue_threads", labels, threads);
+	}
+	
+	MetricsWriteHeader(writer, "webserver_queue_shed_total", "Requests a dispatch queue told to shed", kMetricCounter);
+	for (uint32_t i = 0; i < count; i++) {
+		uint64_t shed = DispatchQueueGetShedCount(queues[i]);
+		
+		snprintf(labels, sizeof(labels), "queue=\"%s\"", WebServerGetQueueName(queues[i]));
+		MetricsWriteSample(writer, "webserver_queue_shed_total", labels, (double)shed);
+	}
+	
+	MetricsWriteHeader(writer, "webserver_queue_sojourn_seconds", "Last measured wait of a block in a dispatch queue", kMetricGauge);
+	for (uint32_t i = 0; i < count; i++) {
+		uint64_t sojourn = DispatchQueueGetSojournTime(queues[i]);
+		
+		snprintf(labels, sizeof(labels), "queue=\"%s\"", WebServerGetQueueName(queues[i]));
+		MetricsWriteSample(writer, "webserver_queue_sojourn_seconds", labels, (double)sojourn / 1e9);
+	}
+	
+	MetricsWriteHeader(writer, "webserver_queue_wait_seconds", "Time from the dispatch until a block started", kMetricHistogram);
+	for (uint32_t i = 0; i < count; i++) {
+		DispatchQueueStats stats;
+		
+		DispatchQueueCopyStats(queues[i], &stats, NULL, 0);
+		snprintf(labels, sizeof(labels), "queue=\"%s\"", WebServerGetQueueName(queues[i]));
+		MetricsWriteHistogram(writer, "webserver_queue_wait_seconds", labels, &stats.waitTime, 1e-9);
+	}
+	
+	MetricsWriteHeader(writer, "webserver_queue_run_seconds", "Run time of the blocks of a dispatch queue", kMetricHistogram);
+	for (uint32_t i = 0; i < count; i++) {
+		DispatchQueueStats stats;
+		
+		DispatchQueueCopyStats(queues[i], &stats, NULL, 0);
+		snprintf(labels, sizeof(labels), "queue=\"%s\"", WebServerGetQueueName(queues[i]));
+		MetricsWriteHistogram(writer, "webserver_queue_run_seconds", labels, &stats.runTime, 1e-9);
+	}
+	
+	MetricsWriteHeader(writer, "webserver_queue_worker_utilization", "Share of its lifetime a worker spent running blocks", kMetricGauge);
+	for (uint32_t i = 0; i < count; i++) {
+		DispatchQueueStats stats;
+		DispatchWorkerStats workers[kWebServerMaxWorkerStats];
+		uint32_t numOfWorkers = DispatchQueueCopyStats(queues[i], &stats, workers, kWebServerMaxWorkerStats);
+		
+		for (uint32_t j = 0; j < numOfWorkers; j++) {
+			double utilization = workers[j].lifetime ? (double)workers[j].busyTime / (double)workers[j].lifetime : 0;
+			
+			snprintf(labels, sizeof(labels), "queue=\"%s\",worker=\"%u\"", WebServerGetQueueName(queues[i]), j);
+			MetricsWriteSample(writer, "webserver_queue_worker_utilization", labels, utilization);
+		}
+	}
+}
+
+static const char* WebServerGetQueueName(DispatchQueue queue)
+{
+	const char* name = DispatchQueueGetName(queue);
+	
+	return name ? name : "unnamed";
+}
+
+
+static void WebServerWritePollMetrics(MetricsWriter writer, Poll poll)
+{
+	PollStats stats;
+	
+	PollGetStats(poll, &stats);
+	
+	MetricsWriteHeader(writer, "webserver_poll_wakeups_total", "Returns from poll", kMetricCounter);
+	MetricsWriteSample(writer, "webserver_poll_wakeups_total", NULL, (double)stats.wakeups);
+	MetricsWriteHeader(writer, "webserver_poll_timeouts_total", "Returns from poll without any ready fd", kMetricCounter);
+	MetricsWriteSample(writer, "webserver_poll_timeouts_total", NULL, (double)stats.timeouts);
+	MetricsWriteHeader(writer, "webserver_poll_pipe_wakeups_total", "Wakeups by the update pipe", kMetricCounter);
+	MetricsWriteSample(writer, "webserver_poll_pipe_wakeups_total", NULL, (double)stats.pipeWakeups);
+	MetricsWriteHeader(writer, "webserver_poll_updates_total", "Registrations and removals applied by the poll thread", kMetricCounter);
+	MetricsWriteSample(writer, "webserver_poll_updates_total", NULL, (double)stats.updates);
+	
+	MetricsWriteHeader(writer, "webserver_poll_callbacks_total", "Ready fds handled by the poll thread", kMetricCounter);
+	MetricsWriteSample(writer, "webserver_poll_callbacks_total", "mode=\"inline\"", (double)stats.inlineCallbacks);
+	MetricsWriteSample(writer, "webserver_poll_callbacks_total", "mode=\"dispatched\"", (double)stats.dispatchedCallbacks);
+	
+	MetricsWriteHeader(writer, "webserver_poll_blocked_seconds", "Time blocked in poll", kMetricHistogram);
+	MetricsWriteHistogram(writer, "webserver_poll_blocked_seconds", NULL, &stats.blockedTime, 1e-9);
+	
+	MetricsWriteHeader(writer, "webserver_poll_round_seconds", "Time from a wakeup until the next poll", kMetricHistogram);
+	MetricsWriteHistogram(writer, "webserver_poll_round_seconds", NULL, &stats.roundTime, 1e-9);
+	
+	MetricsWriteHeader(writer, "webserver_poll_update_seconds", "Time applying updates per round", kMetricHistogram);
+	MetricsWriteHistogram(writer, "webserver_poll_update_seconds", NULL, &stats.updateTime, 1e-9);
+	
+	MetricsWriteHeader(writer, "webserver_poll_updates_per_round", "Updates applied per round", kMetricHistogram);
+	MetricsWriteHistogram(writer, "webserver_poll_updates_per_round", NULL, &stats.updatesPerRound, 1);
+	
+	MetricsWriteHeader(writer, "webserver_poll_ready_fds", "Ready fds per wakeup", kMetricHistogram);
+	MetricsWriteHistogram(writer, "webserver_poll_ready_fds", NULL, &stats.readyPerWakeup, 1);
+	
+	MetricsWriteHeader(writer, "webserver_poll_callback_seconds", "Run time of a block called in the poll thread", kMetricHistogram);
+	MetricsWriteHistogram(writer, "webserver_poll_callback_seconds", NULL, &stats.callbackTime, 1e-9);
+}
+
 int ServerGetSocket(Server server)
 {
 	return server->socket;
@@ -27,13 +27,33 @@
 #include "utils/dispatchqueue.h"
 #include "net/poll.h"
 
+#include <stdint.h>
+
 typedef struct _WebServer* WebServer;
 typedef struct _Server* Server;
 
+typedef enum {
+	//
+	// All work of a connection runs on the worker that
+	// owns its socket (see kDispatchQueueAffine). Input,
+	// output and processing share one queue then.
+	//
+	kWebServerAffine = (1 << 1)
+} WebServerFlags;
+
 //
 // Initialize the web server with the cmd arguments
 //
-WebServer WebServerCreate(char* port);
+WebServer WebServerCreate(char* port, WebServerFlags flags);
+
+//
+// Configures load shedding of the processing queue. New requests
+// are answered with 503 when queued requests waited longer than
+// target for at least interval (both in milliseconds).
+//
+// A target of 0 disables load shedding.
+//
+void WebServerSetLoadShedding(WebServer server, uint32_t target, uint32_t interval);
 
 //
 // Start handling request
@@ -0,0 +1,198 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+//
+// Renders access log segments written with -l in common
+// log format, or combined log format with -c. Referer and
+// user agent are not logged, they are always "-".
+//
+//   make logdecode && ./tools/logdecode access.log.1 access.log
+//
+
+#include "http/httpaccesslog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static bool LogDecodeFile(const char* file, bool combined);
+static void LogDecodeRequest(const HTTPAccessLogRequestEntry* entry, const char* path, bool combined);
+
+int main(int argc, char** argv)
+{
+	bool combined = false;
+	int result = EXIT_SUCCESS;
+	int c;
+	
+	while ((c = getopt(argc, argv, "ch")) != -1) {
+		switch (c) {
+			case 'c':
+				combined = true;
+				break;
+			default:
+				printf("Usage: %s [-c] segment...\n", argv[0]);
+				printf("  -c  Combined instead of common log format\n");
+				return EXIT_FAILURE;
+		}
+	}
+	
+	for (int i = optind; i < argc; i++) {
+		if (!LogDecodeFile(argv[i], combined))
+			result = EXIT_FAILURE;
+	}
+	
+	return result;
+}
+
+static bool LogDecodeFile(const char* file, bool combined)
+{
+	HTTPAccessLogSegmentHeader header;
+	struct stat stat;
+	char* segment;
+	const char** paths = NULL;
+	uint32_t pathCount = 0;
+	size_t offset;
+	int fd = open(file, O_RDONLY);
+	
+	if (fd < 0) {
+		perror(file);
+		return false;
+	}
+	
+	if (fstat(fd, &stat) < 0) {
+		perror("fstat");
+		close(fd);
+		return false;
+	}
+	
+	if ((size_t)stat.st_size < sizeof(header)) {
+		printf("%s: not an access log segment\n", file);
+		close(fd);
+		return false;
+	}
+	
+	segment = mmap(NULL, (size_t)stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	
+	if (segment == MAP_FAILED) {
+		perror("mmap");
+		return false;
+	}
+	
+	memcpy(&header, segment, sizeof(header));
+	
+	if (header.magic != kHTTPAccessLogMagic || header.version != kHTTPAccessLogVersion) {
+		printf("%s: not an access log segment\n", file);
+		munmap(segment, (size_t)stat.st_size);
+		return false;
+	}
+	
+	for (offset = sizeof(header); offset + sizeof(HTTPAccessLogPathEntry) <= (size_t)stat.st_size;) {
+		HTTPAccessLogPathEntry entry;
+		
+		// All entries start with type and length
+		memcpy(&entry, segment + offset, sizeof(entry));
+		
+		if (entry.type == kHTTPAccessLogEntryEnd || entry.length == 0 || offset + entry.length > (size_t)stat.st_size)
+			break;
+		
+		if (entry.type == kHTTPAccessLogEntryPath) {
+			if (entry.id >= pathCount) {
+				uint32_t count = entry.id + 64;
+				const char** newPaths = realloc(paths, sizeof(const char*) * count);
+				
+				if (newPaths == NULL) {
+					perror("realloc");
+					break;
+				}
+				
+				memset(newPaths + pathCount, 0, sizeof(const char*) * (count - pathCount));
+				paths = newPaths;
+				pathCount = count;
+			}
+			
+			paths[entry.id] = segment + offset + sizeof(entry);
+		}
+		else if (entry.type == kHTTPAccessLogEntryRequest && entry.length >= sizeof(HTTPAccessLogRequestEntry)) {
+			HTTPAccessLogRequestEntry request;
+			const char* path = NULL;
+			
+			memcpy(&request, segment + offset, sizeof(request));
+			
+			if (request.pathId < pathCount)
+				path = paths[request.pathId];
+			
+			LogDecodeRequest(&request, path, combined);
+		}
+		
+		// Unknown entries are skipped
+		offset += entry.length;
+	}
+	
+	free(paths);
+	munmap(segment, (size_t)stat.st_size);
+	
+	return true;
+}
+
+static void LogDecodeRequest(const HTTPAccessLogRequestEntry* entry, const char* path, bool combined)
+{
+	char address[INET6_ADDRSTRLEN];
+	char date[32];
+	const void* addr;
+	time_t second = (time_t)(entry->time / 1000000000ull);
+	struct tm tm;
+	const char* method = entry->method == kHTTPMethodGet ? "GET" : "-";
+	const char* version;
+	
+	if (entry->address.sin6_family == AF_INET6)
+		addr = &entry->address.sin6_addr;
+	else
+		addr = &((const struct sockaddr_in*)&entry->address)->sin_addr;
+	
+	if (!inet_ntop(entry->address.sin6_family, addr, address, sizeof(address)))
+		strcpy(address, "-");
+	
+	gmtime_r(&second, &tm);
+	strftime(date, sizeof(date), "%d/%b/%Y:%H:%M:%S +0000", &tm);
+	
+	if (entry->version == kHTTPVersion_1_0)
+		version = "HTTP/1.0";
+	else if (entry->version == kHTTPVersion_1_1)
+		version = "HTTP/1.1";
+	else
+		version = "-";
+	
+	printf("%s - - [%s] \"%s %s %s\" %u %" PRIu64, address, date, method, path ? path : "-", version, entry->status, entry->bytes);
+	
+	if (combined)
+		printf(" \"-\" \"-\"");
+	
+	printf("\n");
+}
@@ -0,0 +1,254 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#define kArenaAlignment 16
+
+//
+// The data of a chunk follows right after
+// its header
+//
+struct _ArenaChunk {
+	struct _ArenaChunk* next;
+	size_t size;
+	size_t used;
+};
+
+DEFINE_CLASS(Arena,
+	size_t chunkSize;
+	
+	//
+	// The chunk allocations are taken from. The first chunk
+	// is part of the arena allocation, later ones are
+	// linked in extraChunks.
+	//
+	struct _ArenaChunk* current;
+	struct _ArenaChunk* first;
+	struct _ArenaChunk* extraChunks;
+	
+	//
+	// The latest allocation, which can grow in place
+	//
+	char* last;
+	
+	size_t used;
+	size_t highWater;
+);
+
+static uint64_t _ArenaResets;
+static uint64_t _ArenaOverflows;
+static uint64_t _ArenaTotalUsed;
+static uint64_t _ArenaHighWater;
+
+static char* _ArenaChunkData(struct _ArenaChunk* chunk);
+static char* _ArenaChunkAlloc(struct _ArenaChunk* chunk, size_t size);
+static void _ArenaRecordUsage(Arena arena);
+static void _ArenaFreeExtraChunks(Arena arena);
+static void _ArenaDealloc(void* ptr);
+
+Arena ArenaCreate(size_t chunkSize)
+{
+	Arena arena = malloc(sizeof(struct _Arena) + sizeof(struct _ArenaChunk) + chunkSize);
+	
+	if (arena == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+	
+	memset(arena, 0, sizeof(struct _Arena));
+	
+	ObjectInit(arena, &ArenaClass, _ArenaDealloc);
+	
+	arena->chunkSize = chunkSize;
+	arena->first = (struct _ArenaChunk*)(arena + 1);
+	arena->first->next = NULL;
+	arena->first->size = chunkSize;
+	arena->first->used = 0;
+	arena->current = arena->first;
+	
+	return arena;
+}
+
+void* ArenaAlloc(Arena arena, size_t size)
+{
+	char* ptr = _ArenaChunkAlloc(arena->current, size);
+	
+	if (ptr == NULL) {
+		// Large allocations get a chunk of their own
+		size_t chunkSize = size + kArenaAlignment > arena->chunkSize ? size + kArenaAlignment : arena->chunkSize;
+		struct _ArenaChunk* chunk = malloc(sizeof(struct _ArenaChunk) + chunkSize);
+		
+		if (chunk == NULL) {
+			perror("malloc");
+			return NULL;
+		}
+		
+		chunk->size = chunkSize;
+		chunk->used = 0;
+		chunk->next = arena->extraChunks;
+		arena->extraChunks = chunk;
+		arena->current = chunk;
+		
+		ptr = _ArenaChunkAlloc(chunk, size);
+		assert(ptr != NULL);
+	}
+	
+	arena->last = ptr;
+	arena->used += size;
+	if (arena->used > arena->highWater)
+		arena->highWater = arena->used;
+	
+	return ptr;
+}
+
+void* ArenaRealloc(Arena arena, void* ptr, size_t oldSize, size_t newSize)
+{
+	struct _ArenaChunk* chunk = arena->current;
+	char* newPtr;
+	
+	if (ptr == NULL)
+		return ArenaAlloc(arena, newSize);
+	
+	if (newSize <= oldSize)
+		return ptr;
+	
+	// Grow in place
+	if (ptr == arena->last && (size_t)((char*)ptr - _ArenaChunkData(chunk)) + newSize <= chunk->size) {
+		chunk->used += newSize - oldSize;
+		arena->used += newSize - oldSize;
+		if (arena->used > arena->highWater)
+			arena->highWater = arena->used;
+		
+		return ptr;
+	}
+	
+	newPtr = ArenaAlloc(arena, newSize);
+	
+	if (newPtr)
+		memcpy(newPtr, ptr, oldSize);
+	
+	return newPtr;
+}
+
+char* ArenaStrdup(Arena arena, const char* string)
+{
+	size_t length = strlen(string) + 1;
+	char* copy = ArenaAlloc(arena, length);
+	
+	if (copy)
+		memcpy(copy, string, length);
+	
+	return copy;
+}
+
+void ArenaReset(Arena arena)
+{
+	_ArenaRecordUsage(arena);
+	_ArenaFreeExtraChunks(arena);
+	
+	arena->first->used = 0;
+	arena->current = arena->first;
+	arena->last = NULL;
+	arena->used = 0;
+}
+
+size_t ArenaGetHighWater(Arena arena)
+{
+	return arena->highWater;
+}
+
+void ArenaCopyStats(ArenaStats* stats)
+{
+	stats->resets = __atomic_load_n(&_ArenaResets, __ATOMIC_RELAXED);
+	stats->overflows = __atomic_load_n(&_ArenaOverflows, __ATOMIC_RELAXED);
+	stats->totalUsed = __atomic_load_n(&_ArenaTotalUsed, __ATOMIC_RELAXED);
+	stats->highWater = __atomic_load_n(&_ArenaHighWater, __ATOMIC_RELAXED);
+}
+
+static char* _ArenaChunkData(struct _ArenaChunk* chunk)
+{
+	return (char*)(chunk + 1);
+}
+
+static char* _ArenaChunkAlloc(struct _ArenaChunk* chunk, size_t size)
+{
+	char* chunkData = _ArenaChunkData(chunk);
+	uintptr_t data = (uintptr_t)chunkData;
+	uintptr_t start = (data + chunk->used + kArenaAlignment - 1) & ~(uintptr_t)(kArenaAlignment - 1);
+	
+	if (start + size > data + chunk->size)
+		return NULL;
+	
+	chunk->used = start + size - data;
+	
+	return (char*)start;
+}
+
+static void _ArenaRecordUsage(Arena arena)
+{
+	uint64_t highWater = __atomic_load_n(&_ArenaHighWater, __ATOMIC_RELAXED);
+	
+	// Nothing happend since the last reset
+	if (arena->used == 0)
+		return;
+	
+	__sync_add_and_fetch(&_ArenaResets, 1);
+	__sync_add_and_fetch(&_ArenaTotalUsed, arena->used);
+	if (arena->extraChunks)
+		__sync_add_and_fetch(&_ArenaOverflows, 1);
+	
+	while (arena->used > highWater) {
+		if (__sync_bool_compare_and_swap(&_ArenaHighWater, highWater, arena->used))
+			break;
+		highWater = __atomic_load_n(&_ArenaHighWater, __ATOMIC_RELAXED);
+	}
+}
+
+static void _ArenaFreeExtraChunks(Arena arena)
+{
+	struct _ArenaChunk* chunk = arena->extraChunks;
+	
+	while (chunk) {
+		struct _ArenaChunk* next = chunk->next;
+		
+		free(chunk);
+		chunk = next;
+	}
+	
+	arena->extraChunks = NULL;
+}
+
+static void _ArenaDealloc(void* ptr)
+{
+	Arena arena = ptr;
+	
+	_ArenaRecordUsage(arena);
+	_ArenaFreeExtraChunks(arena);
+	free(arena);
+}
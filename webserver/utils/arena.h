@@ -0,0 +1,104 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include "utils/object.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+DECLARE_CLASS(Arena);
+
+//
+// Usage of all arenas, to size their chunks
+//
+typedef struct {
+	//
+	// Number of times an arena was reset or released
+	//
+	uint64_t resets;
+	
+	//
+	// How many of those needed more than the first chunk
+	//
+	uint64_t overflows;
+	
+	//
+	// Bytes used by all arenas, summed up at each
+	// reset (totalUsed / resets is the mean)
+	//
+	uint64_t totalUsed;
+	
+	//
+	// The most bytes any arena used between two resets
+	//
+	uint64_t highWater;
+} ArenaStats;
+
+//
+// Creates a new arena. Memory is handed out from chunks of
+// chunkSize bytes, the first one is allocated right away.
+// Allocations never need to be freed one by one, instead all
+// of them are freed when the arena is reset or released.
+//
+// Is a Retainable
+//
+OBJECT_RETURNS_RETAINED
+Arena ArenaCreate(size_t chunkSize);
+
+//
+// Returns size bytes (aligned for any type) or NULL
+// if no memory is left
+//
+void* ArenaAlloc(Arena arena, size_t size);
+
+//
+// Resizes an allocation. If ptr is the latest allocation
+// of the arena it grows in place when possible, otherwise
+// the content is copied. ptr may be NULL.
+//
+void* ArenaRealloc(Arena arena, void* ptr, size_t oldSize, size_t newSize);
+
+//
+// Copies a string into the arena
+//
+char* ArenaStrdup(Arena arena, const char* string);
+
+//
+// Frees everything allocated from the arena at once. Only the
+// first chunk is kept.
+//
+void ArenaReset(Arena arena);
+
+//
+// Returns the most bytes the arena used between two resets
+//
+size_t ArenaGetHighWater(Arena arena);
+
+//
+// Copies the usage of all arenas
+//
+void ArenaCopyStats(ArenaStats* stats);
+
+#endif /* _ARENA_H_ */
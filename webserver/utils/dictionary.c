@@ -21,228 +21,386 @@
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "dictionary.h"
-#include "stack.h"
+#include "slab.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-DECLARE_CLASS(DictionaryEntry);
+//
+// The dictionary is an open addressing hash table in the
+// style of a swiss table: Every slot has a control byte, which
+// is either empty, deleted or holds the lower 7 bits of the hash
+// of its key. Lookups compare the control bytes of a group of 16
+// slots at once and only look at the keys of matching slots.
+//
+#define kDictionaryGroupSize 16
+#define kDictionaryMinCapacity kDictionaryGroupSize
 
-DEFINE_CLASS(DictionaryEntry,	
+#define kDictionaryEmpty ((int8_t)-128)
+#define kDictionaryDeleted ((int8_t)-2)
+
+struct _DictionarySlot {
 	const char* key;
 	const void* value;
 	
-	DictionaryEntry leftEntry;
-	DictionaryEntry rightEntry;
+	//
+	// Cached so that growing and mismatching keys
+	// need no strcmp/rehash
+	//
+	uint64_t hash;
+};
+
+DEFINE_CLASS(Dictionary,
+	//
+	// One allocation with capacity control bytes followed
+	// by capacity slots. NULL until the first insert.
+	//
+	int8_t* control;
+	struct _DictionarySlot* slots;
+	
+	//
+	// Number of slots, a power of two multiple
+	// of kDictionaryGroupSize
+	//
+	size_t capacity;
+	size_t count;
+	
+	//
+	// How many empty slots can be used before
+	// the table has to grow (7/8 max load)
+	//
+	size_t growthLeft;
 );
 
-OBJECT_RETURNS_RETAINED
-static DictionaryEntry DictionaryEntryCreate(const char* key, const char* value);
+DEFINE_SLAB(Dictionary, sizeof(struct _Dictionary));
+
+//
+// Counts the slots of the tables with their control byte
+//
+DEFINE_ALLOCATION_CLASS(DictionarySlot, 1 + sizeof(struct _DictionarySlot));
 
-static void DictionaryEntrySetLeftEntry(DictionaryEntry entry, DictionaryEntry left);
-static void DictionaryEntrySetRightEntry(DictionaryEntry entry, DictionaryEntry right);
-static void DictionaryEntryDealloc(void* ptr);
+static void DictionaryDealloc(void* ptr);
+
+static uint64_t DictionaryHash(const char* key);
+static uint32_t DictionaryGroupMatch(const int8_t* group, int8_t tag);
+static uint32_t DictionaryGroupMatchFree(const int8_t* group);
+static struct _DictionarySlot* DictionaryFind(Dictionary dict, const char* key, uint64_t hash);
+static size_t DictionaryFindFree(Dictionary dict, uint64_t hash);
+static bool DictionaryResize(Dictionary dict, size_t capacity);
 
 DEFINE_CLASS(DictionaryIterator,	
 	Dictionary dictionary;
-	DictionaryEntry currentEntry;
-	Stack stack;
+	size_t index;
 );
 
-static void DictionaryIteratorDealloc(void* ptr);
+DEFINE_SLAB(DictionaryIterator, sizeof(struct _DictionaryIterator));
 
-DEFINE_CLASS(Dictionary,	
-	DictionaryEntry headEntry;
-);
-
-static void DictionaryDealloc(void* ptr);
+static void DictionaryIteratorDealloc(void* ptr);
 
 Dictionary DictionaryCreate()
 {
-	Dictionary dict = malloc(sizeof(struct _Dictionary));
+	Dictionary dict = SlabAlloc(DictionarySlab);
 	
 	if (dict == NULL) {
-		perror("malloc");
+		perror("SlabAlloc");
 		return NULL;
 	}
 	
-	ObjectInit(dict, DictionaryDealloc);
-	
-	dict->headEntry = DictionaryEntryCreate("", NULL);
-	
-	if (dict->headEntry == NULL) {
-		printf("Could not create head entry.");
-		Release(dict);
-		return NULL;
-	}
+	ObjectInit(dict, &DictionaryClass, DictionaryDealloc);
 	
 	return dict;
 }
 
 void* DictionaryGet(Dictionary dict, const char* key)
 {
-	DictionaryEntry entry = dict->headEntry;
+	struct _DictionarySlot* slot = DictionaryFind(dict, key, DictionaryHash(key));
 	
-	while(entry != NULL) {
-		int cmp = strcmp(entry->key, key);
-		
-		if (cmp == 0)
-			return (void*)entry->value;
-		else if (cmp < 0)
-			entry = entry->leftEntry;
-		else
-			entry = entry->rightEntry;
-	}
+	if (slot == NULL)
+		return NULL;
 	
-	return NULL;
+	return (void*)slot->value;
 }
 
 void DictionarySet(Dictionary dict, const char* key, const void* value)
 {
-	DictionaryEntry entry = dict->headEntry;
+	uint64_t hash = DictionaryHash(key);
+	struct _DictionarySlot* slot = DictionaryFind(dict, key, hash);
+	size_t index;
+	
+	if (slot) {
+		slot->key = key;
+		slot->value = value;
+		return;
+	}
 	
-	while(entry != NULL) {
-		int cmp = strcmp(entry->key, key);
+	if (dict->growthLeft == 0) {
+		size_t capacity = dict->capacity;
+		
+		// Only grow when the table is really full, not
+		// just full of deleted slots
+		if (capacity == 0)
+			capacity = kDictionaryMinCapacity;
+		else if (dict->count >= capacity / 2)
+			capacity *= 2;
 		
-		if (cmp == 0) {
-			entry->value = value;
+		if (!DictionaryResize(dict, capacity)) {
+			printf("Could not grow dictionary.\n");
 			return;
 		}
-		else if (cmp < 0) {
-			if (entry->leftEntry)
-				entry = entry->leftEntry;
-			else {
-				DictionaryEntry e = DictionaryEntryCreate(key, value);
-				DictionaryEntrySetLeftEntry(entry, e);
-				Release(e);
-				return;
-			}
-		}
-		else {
-			if (entry->rightEntry)
-				entry = entry->rightEntry;
-			else {
-				DictionaryEntry e = DictionaryEntryCreate(key, value);
-				DictionaryEntrySetRightEntry(entry, e);
-				Release(e);
-				return;
-			}
-		}
 	}
+	
+	index = DictionaryFindFree(dict, hash);
+	
+	if (dict->control[index] == kDictionaryEmpty)
+		dict->growthLeft--;
+	
+	dict->control[index] = (int8_t)(hash & 0x7f);
+	dict->slots[index].key = key;
+	dict->slots[index].value = value;
+	dict->slots[index].hash = hash;
+	dict->count++;
+}
+
+void DictionaryRemove(Dictionary dict, const char* key)
+{
+	struct _DictionarySlot* slot = DictionaryFind(dict, key, DictionaryHash(key));
+	size_t index;
+	
+	if (slot == NULL)
+		return;
+	
+	index = (size_t)(slot - dict->slots);
+	
+	// Lookups stop at a group with an empty slot, so no key
+	// behind this group can depend on it being full
+	if (DictionaryGroupMatch(dict->control + (index & ~(size_t)(kDictionaryGroupSize - 1)), kDictionaryEmpty)) {
+		dict->control[index] = kDictionaryEmpty;
+		dict->growthLeft++;
+	}
+	else
+		dict->control[index] = kDictionaryDeleted;
+	
+	dict->count--;
+}
+
+size_t DictionaryGetCount(Dictionary dict)
+{
+	return dict->count;
 }
 
 void DictionaryDealloc(void* ptr)
 {
 	Dictionary dict = ptr;
 	
-	Release(dict->headEntry);
-	free(dict);
+	if (dict->control)
+		ObjectClassUncount(&DictionarySlotClass, dict->capacity);
+	
+	free(dict->control);
+	SlabFree(DictionarySlab, dict);
 }
 
-static DictionaryEntry DictionaryEntryCreate(const char* key, const char* value)
+static uint64_t DictionaryHash(const char* key)
 {
-	DictionaryEntry entry = malloc(sizeof(struct _DictionaryEntry));
+	uint64_t hash = 0xcbf29ce484222325ULL;
 	
-	if (entry == NULL) {
-		perror("malloc");
-		return NULL;
+	// FNV-1a
+	while (*key) {
+		hash ^= (uint8_t)*key++;
+		hash *= 0x100000001b3ULL;
 	}
 	
-	memset(entry, 0, sizeof(struct _DictionaryEntry));
+	// Mix, so that the lower 7 bits and the
+	// group index are independent
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
 	
-	ObjectInit(entry, DictionaryEntryDealloc);
+	return hash;
+}
+
+static uint32_t DictionaryGroupMatch(const int8_t* group, int8_t tag)
+{
+#ifdef __SSE2__
+	__m128i control = _mm_loadu_si128((const void*)group);
+	
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(tag)));
+#else
+	uint32_t mask = 0;
 	
-	entry->key = key;
-	entry->value = value;
+	for (uint32_t i = 0; i < kDictionaryGroupSize; i++) {
+		if (group[i] == tag)
+			mask |= 1u << i;
+	}
 	
-	return entry;
+	return mask;
+#endif
 }
 
-static void DictionaryEntrySetLeftEntry(DictionaryEntry entry, DictionaryEntry left)
+static uint32_t DictionaryGroupMatchFree(const int8_t* group)
 {
-	Release(entry->leftEntry);
-	entry->leftEntry = Retain(left);
+#ifdef __SSE2__
+	// Empty and deleted are the only control
+	// bytes with the sign bit set
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const void*)group));
+#else
+	uint32_t mask = 0;
+	
+	for (uint32_t i = 0; i < kDictionaryGroupSize; i++) {
+		if (group[i] < 0)
+			mask |= 1u << i;
+	}
+	
+	return mask;
+#endif
 }
 
-static void DictionaryEntrySetRightEntry(DictionaryEntry entry, DictionaryEntry right)
+static struct _DictionarySlot* DictionaryFind(Dictionary dict, const char* key, uint64_t hash)
 {
-	Release(entry->rightEntry);
-	entry->rightEntry = Retain(right);
+	size_t groupMask;
+	size_t group;
+	int8_t tag = (int8_t)(hash & 0x7f);
+	
+	if (dict->capacity == 0)
+		return NULL;
+	
+	groupMask = dict->capacity / kDictionaryGroupSize - 1;
+	group = (hash >> 7) & groupMask;
+	
+	// Triangular probing visits every group once
+	for (size_t step = 1; step <= groupMask + 1; step++) {
+		const int8_t* control = dict->control + group * kDictionaryGroupSize;
+		uint32_t match = DictionaryGroupMatch(control, tag);
+		
+		while (match) {
+			struct _DictionarySlot* slot = &dict->slots[group * kDictionaryGroupSize + (size_t)__builtin_ctz(match)];
+			
+			if (slot->hash == hash && strcmp(slot->key, key) == 0)
+				return slot;
+			
+			match &= match - 1;
+		}
+		
+		if (DictionaryGroupMatch(control, kDictionaryEmpty))
+			return NULL;
+		
+		group = (group + step) & groupMask;
+	}
+	
+	return NULL;
 }
 
-static void DictionaryEntryDealloc(void* ptr)
+static size_t DictionaryFindFree(Dictionary dict, uint64_t hash)
 {
-	DictionaryEntry entry = ptr;
+	size_t groupMask = dict->capacity / kDictionaryGroupSize - 1;
+	size_t group = (hash >> 7) & groupMask;
 	
-	Release(entry->leftEntry);
-	Release(entry->rightEntry);
-	free(ptr);
+	for (size_t step = 1;; step++) {
+		uint32_t match = DictionaryGroupMatchFree(dict->control + group * kDictionaryGroupSize);
+		
+		if (match)
+			return group * kDictionaryGroupSize + (size_t)__builtin_ctz(match);
+		
+		// There is always a free slot
+		assert(step <= groupMask);
+		group = (group + step) & groupMask;
+	}
 }
 
-DictionaryIterator DictionaryGetIterator(Dictionary dict)
+static bool DictionaryResize(Dictionary dict, size_t capacity)
 {
-	assert(dict != NULL);
-	DictionaryIterator iter = malloc(sizeof(struct _DictionaryIterator));
+	int8_t* oldControl = dict->control;
+	struct _DictionarySlot* oldSlots = dict->slots;
+	size_t oldCapacity = dict->capacity;
+	int8_t* control = malloc(capacity * (1 + sizeof(struct _DictionarySlot)));
 	
-	if (iter == NULL) {
+	if (control == NULL) {
 		perror("malloc");
-		return NULL;
+		return false;
 	}
 	
-	memset(iter, 0, sizeof(struct _DictionaryIterator));
-	ObjectInit(iter, DictionaryIteratorDealloc);
+	ObjectClassCount(&DictionarySlotClass, capacity);
+	memset(control, kDictionaryEmpty, capacity);
 	
-	iter->stack = StackCreate();
+	dict->control = control;
+	dict->slots = (struct _DictionarySlot*)(void*)(control + capacity);
+	dict->capacity = capacity;
+	dict->growthLeft = capacity - capacity / 8 - dict->count;
 	
-	if (iter->stack == NULL) {
-		printf("Could not create stack.\n");
-		Release(iter);
+	for (size_t i = 0; i < oldCapacity; i++) {
+		size_t index;
+		
+		if (oldControl[i] < 0)
+			continue;
+		
+		index = DictionaryFindFree(dict, oldSlots[i].hash);
+		dict->control[index] = oldControl[i];
+		dict->slots[index] = oldSlots[i];
+	}
+	
+	if (oldControl)
+		ObjectClassUncount(&DictionarySlotClass, oldCapacity);
+	
+	free(oldControl);
+	
+	return true;
+}
+
+DictionaryIterator DictionaryGetIterator(Dictionary dict)
+{
+	assert(dict != NULL);
+	DictionaryIterator iter = SlabAlloc(DictionaryIteratorSlab);
+	
+	if (iter == NULL) {
+		perror("SlabAlloc");
 		return NULL;
 	}
 	
-	iter->dictionary = Retain(dict);
+	ObjectInit(iter, &DictionaryIteratorClass, DictionaryIteratorDealloc);
 	
-	// Push the head dummy entry
-	StackPush(iter->stack, dict->headEntry);
+	iter->dictionary = Retain(dict);
+	iter->index = 0;
 	
-	// Now advance twice to get to the first real entry
-	DictionaryIteratorNext(iter);
-	DictionaryIteratorNext(iter);
+	// Move to the first used slot
+	if (dict->capacity > 0 && dict->control[0] < 0)
+		DictionaryIteratorNext(iter);
 	
 	return iter;
 }
 
 char* DictionaryIteratorGetKey(DictionaryIterator iter)
 {
-	if (!iter->currentEntry)
+	if (iter->index >= iter->dictionary->capacity)
 		return NULL;
 	
-	return (char*)iter->currentEntry->key;
+	return (char*)iter->dictionary->slots[iter->index].key;
 }
 
 void* DictionaryIteratorGetValue(DictionaryIterator iter)
 {
-	if (!iter->currentEntry)
+	if (iter->index >= iter->dictionary->capacity)
 		return NULL;
 	
-	return (void*)iter->currentEntry->value;
+	return (void*)iter->dictionary->slots[iter->index].value;
 }
 
 bool DictionaryIteratorNext(DictionaryIterator iter)
 {
-	iter->currentEntry = StackPop(iter->stack);
+	Dictionary dict = iter->dictionary;
 	
-	if (!iter->currentEntry)
+	if (iter->index >= dict->capacity)
 		return false;
 	
-	if (iter->currentEntry->leftEntry)
-		StackPush(iter->stack, iter->currentEntry->leftEntry);
-	if (iter->currentEntry->rightEntry)
-		StackPush(iter->stack, iter->currentEntry->rightEntry);
+	do {
+		iter->index++;
+	} while (iter->index < dict->capacity && dict->control[iter->index] < 0);
 	
-	return true;
+	return iter->index < dict->capacity;
 }
 
 static void DictionaryIteratorDealloc(void* ptr)
@@ -250,6 +408,5 @@ static void DictionaryIteratorDealloc(void* ptr)
 	DictionaryIterator iter = ptr;
 	
 	Release(iter->dictionary);
-	Release(iter->stack);
-	free(iter);
+	SlabFree(DictionaryIteratorSlab, iter);
 }
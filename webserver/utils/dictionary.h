@@ -26,6 +26,7 @@
 #include "utils/object.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 
 DECLARE_CLASS(Dictionary);
 DECLARE_CLASS(DictionaryIterator);
@@ -49,9 +50,20 @@ void* DictionaryGet(Dictionary dict, const char* key);
 //
 void DictionarySet(Dictionary dict, const char* key, const void* value);
 
+//
+// Removes a given key
+//
+void DictionaryRemove(Dictionary dict, const char* key);
+
+//
+// Returns the number of keys in the dictionary
+//
+size_t DictionaryGetCount(Dictionary dict);
+
 //
 // Gets a iterator. The order which will be iterated
-// is implemation detail.
+// is implemation detail. The dictionary must not be
+// modified while iterating.
 //
 OBJECT_RETURNS_RETAINED
 DictionaryIterator DictionaryGetIterator(Dictionary dict);
@@ -20,31 +20,232 @@
 // (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#ifdef LINUX
+#define _GNU_SOURCE
+#endif
+
 #include "dispatchqueue.h"
-#include "queue.h"
+#include "ringqueue.h"
 #include "helper.h"
+#include "probes.h"
 
 #include <pthread.h>
-#include <semaphore.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
 #include <Block.h>
 
+//
+// Number of blocks that fit into the ring, everything
+// above that spills into a linked queue
+//
+#define kDispatchQueueCapacity 1024
+
+//
+// Maximum number of blocks a worker drains at once
+//
+#define kDispatchQueueDrainBatchSize 16
+
+//
+// Maximum number of blocks DispatchBatch enqueues at once
+//
+#define kDispatchQueueEnqueueBatchSize 64
+
+//
+// A concurrent queue never grows above this many
+// workers per cpu
+//
+#define kDispatchQueueMaxThreadsPerCPU 8
+
+//
+// Seconds an additional worker may be idle before it exits
+//
+#define kDispatchQueueIdleTimeout 5
+
+//
+// A level that was passed over this often while it had work
+// is served before the more important levels
+//
+#define kDispatchQueueAgingLimit 8
+
+//
+// Number of unused work items that are kept for reuse
+//
+#define kDispatchQueueFreeWorkItems 256
+
+//
+// Number of grow/shrink events that are kept
+//
+#define kDispatchQueuePoolEventLogSize 64
+
+//
+// Other workers only take work from an affine lane when
+// this many blocks wait on it
+//
+#define kDispatchQueueStealThreshold 32
+
+//
+// Longest name of a queue
+//
+#define kDispatchQueueNameLength 32
+
+//
+// A dispatched block and when it was enqueued
+//
+struct _DispatchWorkItem {
+	void (^block)();
+	uint64_t enqueueTime;
+};
+
+//
+// Work items with one queue per quality of service. Every queue
+// has a shared lane, affine queues have one more lane per
+// initial worker.
+//
+struct _DispatchLane {
+	RingQueue queues[kDispatchQoSLevels];
+	
+	//
+	// How often each level was passed over for
+	// a more important one
+	//
+	uint32_t passedOver[kDispatchQoSLevels];
+	
+	//
+	// The owner of an affine lane waits on its own
+	// condition so it can be woken up alone
+	//
+	pthread_cond_t condition;
+	uint32_t waiting;
+};
+
+//
+// Statistics of one worker slot. A worker takes a free slot
+// when it starts and gives it back when it exits, so there
+// is only ever one writer. The histograms are kept when the
+// slot is reused, the rest starts over.
+//
+struct _DispatchWorker {
+	bool active;
+	uint64_t startTime;
+	uint64_t blocks;
+	uint64_t busyTime;
+	Histogram waitTime;
+	Histogram runTime;
+} __attribute__((aligned(64)));
+
 DEFINE_CLASS(DispatchQueue,	
-	Queue queue;
+	struct _DispatchLane shared;
+	
+	//
+	// Lanes of affine queues, one per initial worker.
+	// Workers claim them in order when they start.
+	//
+	struct _DispatchLane* lanes;
+	uint32_t numOfLanes;
+	uint32_t numOfClaimedLanes;
+	
+	//
+	// Work items that can be reused
+	//
+	RingQueue freeWorkItems;
 	
-	pthread_t* threads;
+	//
+	// The pool of worker threads. numOfThreads is changed
+	// with the mutex held only.
+	//
 	uint32_t numOfThreads;
+	uint32_t minThreads;
 	uint32_t maxThreads;
 	
-	sem_t* semaphore;
+	//
+	// Workers currently in a blocking region
+	//
+	uint32_t blockedThreads;
+	
+	//
+	// Idle workers wait on the condition (or the one of their
+	// lane). Dispatchers only take the mutex when somebody is
+	// waiting. waitingThreads includes waitingLaneThreads.
+	//
+	pthread_mutex_t mutex;
+	pthread_cond_t condition;
+	uint32_t waitingThreads;
+	uint32_t waitingLaneThreads;
+	
+	//
+	// Signaled by exiting workers when stopping
+	//
+	pthread_cond_t exitCondition;
+	bool stopping;
+	
+	DispatchQueuePoolEvent poolEvents[kDispatchQueuePoolEventLogSize];
+	uint32_t numOfPoolEvents;
+	
+	//
+	// Load shedding (CoDel). The queue counts as overloaded
+	// when the sojourn time stayed above the target for a
+	// whole interval. A target of 0 disables it.
+	//
+	uint64_t codelTarget;
+	uint64_t codelInterval;
+	uint64_t firstAboveTime;
+	uint64_t sojournTime;
+	bool overloaded;
+	uint64_t shedCount;
+	
+	char name[kDispatchQueueNameLength];
+	bool hasName;
+	
+	//
+	// One slot per possible worker (maxThreads), slots
+	// are taken and given back with the mutex held
+	//
+	struct _DispatchWorker* workers;
+	bool statsEnabled;
 );
 
+//
+// The queue the current thread is a worker of
+// and the lane it owns (if any)
+//
+static __thread DispatchQueue _DispatchQueueCurrent;
+static __thread struct _DispatchLane* _DispatchQueueCurrentLane;
+static __thread struct _DispatchWorker* _DispatchQueueCurrentWorker;
+
 static void* _DispatchQueueThread(void* ptr);
-static void _DispatchQueueDrainAndRelease(DispatchQueue queue);
+static bool _DispatchLaneInit(struct _DispatchLane* lane);
+static void _DispatchLaneDestroy(struct _DispatchLane* lane);
+static uint32_t _DispatchLaneGetCount(struct _DispatchLane* lane);
+static struct _DispatchLane* _DispatchQueueGetLane(DispatchQueue queue, uintptr_t key);
+static void _DispatchQueueClaimLane(DispatchQueue queue);
+static void _DispatchQueueClaimWorker(DispatchQueue queue);
+static uint64_t _DispatchQueueEnqueueTime(DispatchQueue queue);
+static struct _DispatchWorkItem* _DispatchQueueCreateWorkItem(DispatchQueue queue, void (^block)(), uint64_t enqueueTime);
+static void _DispatchQueueFreeWorkItem(DispatchQueue queue, struct _DispatchWorkItem* item);
+static void _DispatchQueueDropWorkItems(DispatchQueue queue, struct _DispatchWorkItem** items, uint32_t count);
+static void _DispatchQueueTrackSojourn(DispatchQueue queue, uint64_t enqueueTime);
+static uint32_t _DispatchQueueGetCount(DispatchQueue queue);
+static DispatchQoS _DispatchLaneNextLevel(struct _DispatchLane* lane);
+static void _DispatchQueueRunWithStats(DispatchQueue queue, struct _DispatchWorkItem** items, uint32_t count);
+static bool _DispatchQueueDrainLane(DispatchQueue queue, struct _DispatchLane* lane);
+static struct _DispatchLane* _DispatchQueueFindStealableLane(DispatchQueue queue, struct _DispatchLane* own);
+static bool _DispatchQueueHasWork(DispatchQueue queue, struct _DispatchLane* own);
+static bool _DispatchQueueDrainAndRelease(DispatchQueue queue);
+static bool _DispatchQueueWait(DispatchQueue queue);
+static void _DispatchQueueWakeup(DispatchQueue queue, struct _DispatchLane* lane, uint32_t count);
+static bool _DispatchQueueStartThread(DispatchQueue queue);
+static void _DispatchQueueGrowIfNeeded(DispatchQueue queue);
+static void _DispatchQueueLogPoolEvent(DispatchQueue queue, DispatchQueuePoolEventType type);
 static void _DisptachQueueDealloc(void* ptr);
+static uint32_t _DispatchQueueGetNumOfCPUs(void);
 
 DispatchQueue DispatchQueueCreate(DispatchQueueFlags flags)
 {
@@ -57,93 +258,993 @@ DispatchQueue DispatchQueueCreate(DispatchQueueFlags flags)
 	
 	memset(queue, 0, sizeof(struct _DispatchQueue));
 	
-	ObjectInit(queue, _DisptachQueueDealloc);
-		
-	queue->semaphore = sem_open_anon();
+	ObjectInit(queue, &DispatchQueueClass, _DisptachQueueDealloc);
 	
-	if (queue->semaphore == SEM_FAILED) {
-		perror("sem_init");
+	pthread_mutex_init(&queue->mutex, NULL);
+	pthread_cond_init(&queue->condition, NULL);
+	pthread_cond_init(&queue->exitCondition, NULL);
+	
+	if (!_DispatchLaneInit(&queue->shared)) {
+		printf("Could not create queue.\n");
 		Release(queue);
 		return NULL;
 	}
 	
-	queue->queue = QueueCreate();
+	queue->freeWorkItems = RingQueueCreate(kDispatchQueueFreeWorkItems, kRingQueueOverflowFail);
 	
-	if (queue->queue == NULL) {
+	if (queue->freeWorkItems == NULL) {
 		printf("Could not create queue.\n");
 		Release(queue);
 		return NULL;
 	}
 	
-	queue->maxThreads = (flags & kDispatchQueueSerial) ? 1 : 10;
-	
-	queue->threads = malloc(sizeof(pthread_t) * queue->maxThreads);
+	if (flags & kDispatchQueueSerial) {
+		queue->minThreads = 1;
+		queue->maxThreads = 1;
+	}
+	else {
+		uint32_t cpus = _DispatchQueueGetNumOfCPUs();
+		
+		queue->minThreads = cpus;
+		queue->maxThreads = cpus * kDispatchQueueMaxThreadsPerCPU;
+	}
 	
-	if (queue->threads == NULL) {
-		perror("malloc");
+	if (posix_memalign((void**)&queue->workers, 64, sizeof(struct _DispatchWorker) * queue->maxThreads) != 0) {
+		perror("posix_memalign");
+		queue->workers = NULL;
 		Release(queue);
 		return NULL;
 	}
 	
+	memset(queue->workers, 0, sizeof(struct _DispatchWorker) * queue->maxThreads);
+	
+	// A serial queue has only one worker anyway
+	if ((flags & kDispatchQueueAffine) && (flags & kDispatchQueueSerial) == 0) {
+		queue->lanes = calloc(queue->minThreads, sizeof(struct _DispatchLane));
+		
+		if (queue->lanes == NULL) {
+			perror("calloc");
+			Release(queue);
+			return NULL;
+		}
+		
+		for (uint32_t i = 0; i < queue->minThreads; i++) {
+			queue->numOfLanes++;
+			
+			if (!_DispatchLaneInit(&queue->lanes[i])) {
+				printf("Could not create queue.\n");
+				Release(queue);
+				return NULL;
+			}
+		}
+	}
+	
 	// Start our threads
-	for (uint32_t i = 0; i < queue->maxThreads; i++) {
-		if (pthread_create(&queue->threads[i], NULL, _DispatchQueueThread, queue)) {
-			perror("pthread_create");
+	pthread_mutex_lock(&queue->mutex);
+	for (uint32_t i = 0; i < queue->minThreads; i++) {
+		if (!_DispatchQueueStartThread(queue)) {
+			pthread_mutex_unlock(&queue->mutex);
 			Release(queue);
 			return NULL;
 		}
-		queue->numOfThreads++;
 	}
+	pthread_mutex_unlock(&queue->mutex);
 	
 	return queue;
 }
 
 void Dispatch(DispatchQueue queue, void(^block)())
 {
-	QueueEnqueue(queue->queue, Block_copy(block));
-	sem_post(queue->semaphore);
+	DispatchWithQoS(queue, kDispatchQoSDefault, block);
+}
+
+void DispatchWithQoS(DispatchQueue queue, DispatchQoS qos, void(^block)())
+{
+	uint64_t now = _DispatchQueueEnqueueTime(queue);
+	struct _DispatchWorkItem* item = _DispatchQueueCreateWorkItem(queue, block, now);
+	
+	if (!RingQueueEnqueue(queue->shared.queues[qos], item)) {
+		_DispatchQueueDropWorkItems(queue, &item, 1);
+		return;
+	}
+	
+	_DispatchQueueWakeup(queue, NULL, 1);
+}
+
+void DispatchBatch(DispatchQueue queue, void(^blocks[])(), uint32_t count)
+{
+	DispatchBatchWithQoS(queue, kDispatchQoSDefault, blocks, count);
+}
+
+void DispatchBatchWithQoS(DispatchQueue queue, DispatchQoS qos, void(^blocks[])(), uint32_t count)
+{
+	struct _DispatchWorkItem* items[kDispatchQueueEnqueueBatchSize];
+	uint64_t now;
+	
+	if (count == 0)
+		return;
+	
+	now = _DispatchQueueEnqueueTime(queue);
+	
+	for (uint32_t offset = 0; offset < count; offset += kDispatchQueueEnqueueBatchSize) {
+		uint32_t chunk = count - offset;
+		
+		if (chunk > kDispatchQueueEnqueueBatchSize)
+			chunk = kDispatchQueueEnqueueBatchSize;
+		
+		uint32_t enqueued;
+		
+		for (uint32_t i = 0; i < chunk; i++)
+			items[i] = _DispatchQueueCreateWorkItem(queue, blocks[offset + i], now);
+		
+		enqueued = RingQueueEnqueueBatch(queue->shared.queues[qos], (void**)items, chunk);
+		
+		if (enqueued < chunk)
+			_DispatchQueueDropWorkItems(queue, items + enqueued, chunk - enqueued);
+	}
+	
+	_DispatchQueueWakeup(queue, NULL, count);
+}
+
+void DispatchAffine(DispatchQueue queue, uintptr_t key, DispatchQoS qos, void(^block)())
+{
+	struct _DispatchLane* lane = _DispatchQueueGetLane(queue, key);
+	struct _DispatchWorkItem* item;
+	uint64_t now;
+	
+	if (lane == NULL) {
+		DispatchWithQoS(queue, qos, block);
+		return;
+	}
+	
+	now = _DispatchQueueEnqueueTime(queue);
+	item = _DispatchQueueCreateWorkItem(queue, block, now);
+	
+	if (!RingQueueEnqueue(lane->queues[qos], item)) {
+		_DispatchQueueDropWorkItems(queue, &item, 1);
+		return;
+	}
+	
+	_DispatchQueueWakeup(queue, lane, 1);
+}
+
+void DispatchAffineBatch(DispatchQueue queue, DispatchQoS qos, uintptr_t keys[], void(^blocks[])(), uint32_t count)
+{
+	uint64_t now;
+	
+	if (queue->numOfLanes == 0) {
+		DispatchBatchWithQoS(queue, qos, blocks, count);
+		return;
+	}
+	
+	now = _DispatchQueueEnqueueTime(queue);
+	
+	// The blocks go to different lanes, so there is
+	// nothing to gain from batching the enqueue
+	for (uint32_t i = 0; i < count; i++) {
+		struct _DispatchLane* lane = _DispatchQueueGetLane(queue, keys[i]);
+		struct _DispatchWorkItem* item = _DispatchQueueCreateWorkItem(queue, blocks[i], now);
+		
+		if (!RingQueueEnqueue(lane->queues[qos], item)) {
+			_DispatchQueueDropWorkItems(queue, &item, 1);
+			continue;
+		}
+		
+		_DispatchQueueWakeup(queue, lane, 1);
+	}
+}
+
+uint32_t DispatchQueueGetDepth(DispatchQueue queue, DispatchQoS qos)
+{
+	uint32_t count = RingQueueGetCount(queue->shared.queues[qos]);
+	
+	for (uint32_t i = 0; i < queue->numOfLanes; i++)
+		count += RingQueueGetCount(queue->lanes[i].queues[qos]);
+	
+	return count;
+}
+
+uint32_t DispatchQueueGetLaneDepth(DispatchQueue queue, uint32_t lane)
+{
+	if (lane >= queue->numOfLanes)
+		return 0;
+	
+	return _DispatchLaneGetCount(&queue->lanes[lane]);
+}
+
+uint32_t DispatchQueueGetNumberOfLanes(DispatchQueue queue)
+{
+	return queue->numOfLanes;
+}
+
+void DispatchQueueSetCoDel(DispatchQueue queue, uint64_t target, uint64_t interval)
+{
+	queue->codelInterval = interval;
+	queue->firstAboveTime = 0;
+	queue->overloaded = false;
+	__atomic_store_n(&queue->codelTarget, target, __ATOMIC_RELEASE);
+}
+
+bool DispatchQueueShouldShed(DispatchQueue queue)
+{
+	if (!__atomic_load_n(&queue->overloaded, __ATOMIC_RELAXED))
+		return false;
+	
+	__sync_add_and_fetch(&queue->shedCount, 1);
+	return true;
+}
+
+uint64_t DispatchQueueGetShedCount(DispatchQueue queue)
+{
+	return __atomic_load_n(&queue->shedCount, __ATOMIC_RELAXED);
+}
+
+uint64_t DispatchQueueGetSojournTime(DispatchQueue queue)
+{
+	return __atomic_load_n(&queue->sojournTime, __ATOMIC_RELAXED);
+}
+
+uint32_t DispatchQueueGetThreadCount(DispatchQueue queue)
+{
+	return __atomic_load_n(&queue->numOfThreads, __ATOMIC_RELAXED);
+}
+
+void DispatchQueueSetName(DispatchQueue queue, const char* name)
+{
+	pthread_mutex_lock(&queue->mutex);
+	
+	queue->hasName = name != NULL;
+	if (name)
+		snprintf(queue->name, sizeof(queue->name), "%s", name);
+	
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+const char* DispatchQueueGetName(DispatchQueue queue)
+{
+	return queue->hasName ? queue->name : NULL;
+}
+
+void DispatchQueueSetStatsEnabled(DispatchQueue queue, bool enabled)
+{
+	__atomic_store_n(&queue->statsEnabled, enabled, __ATOMIC_RELAXED);
+}
+
+uint32_t DispatchQueueCopyStats(DispatchQueue queue, DispatchQueueStats* stats, DispatchWorkerStats* workers, uint32_t max)
+{
+	uint64_t now = monotonicTime();
+	uint32_t count = 0;
+	
+	memset(stats, 0, sizeof(DispatchQueueStats));
+	stats->depth = _DispatchQueueGetCount(queue);
+	stats->numOfThreads = DispatchQueueGetThreadCount(queue);
+	
+	// The mutex keeps workers from taking or giving
+	// back slots meanwhile
+	pthread_mutex_lock(&queue->mutex);
+	
+	for (uint32_t i = 0; i < queue->maxThreads; i++) {
+		struct _DispatchWorker* worker = &queue->workers[i];
+		
+		HistogramMerge(&stats->waitTime, &worker->waitTime);
+		HistogramMerge(&stats->runTime, &worker->runTime);
+		
+		if (!worker->active || count >= max)
+			continue;
+		
+		workers[count].blocks = __atomic_load_n(&worker->blocks, __ATOMIC_RELAXED);
+		workers[count].busyTime = __atomic_load_n(&worker->busyTime, __ATOMIC_RELAXED);
+		workers[count].lifetime = now - worker->startTime;
+		count++;
+	}
+	
+	pthread_mutex_unlock(&queue->mutex);
+	
+	return count;
+}
+
+uint32_t DispatchQueueCopyPoolEvents(DispatchQueue queue, DispatchQueuePoolEvent* events, uint32_t max)
+{
+	uint32_t count;
+	uint32_t first;
+	
+	pthread_mutex_lock(&queue->mutex);
+	
+	count = queue->numOfPoolEvents;
+	if (count > kDispatchQueuePoolEventLogSize)
+		count = kDispatchQueuePoolEventLogSize;
+	if (count > max)
+		count = max;
+	
+	first = queue->numOfPoolEvents - count;
+	for (uint32_t i = 0; i < count; i++)
+		events[i] = queue->poolEvents[(first + i) % kDispatchQueuePoolEventLogSize];
+	
+	pthread_mutex_unlock(&queue->mutex);
+	
+	return count;
+}
+
+void DispatchBlockingRegionBegin(void)
+{
+	DispatchQueue queue = _DispatchQueueCurrent;
+	
+	if (queue == NULL)
+		return;
+	
+	__sync_add_and_fetch(&queue->blockedThreads, 1);
+	_DispatchQueueGrowIfNeeded(queue);
+}
+
+void DispatchBlockingRegionEnd(void)
+{
+	DispatchQueue queue = _DispatchQueueCurrent;
+	
+	if (queue == NULL)
+		return;
+	
+	__sync_sub_and_fetch(&queue->blockedThreads, 1);
 }
 
 static void* _DispatchQueueThread(void* ptr)
 {
 	DispatchQueue queue = ptr;
 	
+	_DispatchQueueCurrent = queue;
+	_DispatchQueueClaimLane(queue);
+	_DispatchQueueClaimWorker(queue);
+	
 	for (;;) {
-		_DispatchQueueDrainAndRelease(queue);
+		if (!_DispatchQueueDrainAndRelease(queue)) {
+			if (!_DispatchQueueWait(queue))
+				break;
+		}
+	}
+	
+	return NULL;
+}
+
+static bool _DispatchLaneInit(struct _DispatchLane* lane)
+{
+	pthread_cond_init(&lane->condition, NULL);
+	
+	for (uint32_t i = 0; i < kDispatchQoSLevels; i++) {
+		lane->queues[i] = RingQueueCreate(kDispatchQueueCapacity, kRingQueueOverflowSpill);
+		
+		if (lane->queues[i] == NULL)
+			return false;
+	}
+	
+	return true;
+}
+
+static void _DispatchLaneDestroy(struct _DispatchLane* lane)
+{
+	// Never initialized
+	if (lane->queues[0] == NULL)
+		return;
+	
+	for (uint32_t i = 0; i < kDispatchQoSLevels; i++)
+		Release(lane->queues[i]);
+	
+	pthread_cond_destroy(&lane->condition);
+}
+
+static uint32_t _DispatchLaneGetCount(struct _DispatchLane* lane)
+{
+	uint32_t count = 0;
+	
+	for (uint32_t i = 0; i < kDispatchQoSLevels; i++)
+		count += RingQueueGetCount(lane->queues[i]);
+	
+	return count;
+}
+
+//
+// Returns the lane for the key or NULL if
+// the queue is not affine
+//
+static struct _DispatchLane* _DispatchQueueGetLane(DispatchQueue queue, uintptr_t key)
+{
+	if (queue->numOfLanes == 0)
+		return NULL;
+	
+	return &queue->lanes[key % queue->numOfLanes];
+}
+
+//
+// The first workers of an affine queue each own a lane and
+// stay on one cpu, so the data of a connection stays in its caches.
+// Additional workers only help out with shared and stolen work.
+//
+static void _DispatchQueueClaimLane(DispatchQueue queue)
+{
+	uint32_t index;
+	
+	if (queue->numOfLanes == 0)
+		return;
+	
+	pthread_mutex_lock(&queue->mutex);
+	index = queue->numOfClaimedLanes;
+	if (index < queue->numOfLanes) {
+		queue->numOfClaimedLanes++;
+		_DispatchQueueCurrentLane = &queue->lanes[index];
+	}
+	pthread_mutex_unlock(&queue->mutex);
+	
+#ifdef LINUX
+	cpu_set_t allowed;
+	
+	// The process may be restricted to some cpus by taskset
+	// or a cpuset, so lane n goes to the n-th allowed one.
+	// Ask for the main thread, this one may already be
+	// pinned by the worker that started it.
+	if (_DispatchQueueCurrentLane && sched_getaffinity(getpid(), sizeof(allowed), &allowed) == 0) {
+		uint32_t nth = index % (uint32_t)CPU_COUNT(&allowed);
+		cpu_set_t set;
+		int error;
+		
+		CPU_ZERO(&set);
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, &allowed) && nth-- == 0) {
+				CPU_SET(cpu, &set);
+				break;
+			}
+		}
+		
+		error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (error) {
+			errno = error;
+			perror("pthread_setaffinity_np");
+		}
+	}
+#endif
+}
+
+//
+// Every worker has a slot for its statistics
+//
+static void _DispatchQueueClaimWorker(DispatchQueue queue)
+{
+	pthread_mutex_lock(&queue->mutex);
+	
+	for (uint32_t i = 0; i < queue->maxThreads; i++) {
+		struct _DispatchWorker* worker = &queue->workers[i];
+		
+		if (!worker->active) {
+			worker->active = true;
+			worker->startTime = monotonicTime();
+			worker->blocks = 0;
+			worker->busyTime = 0;
+			_DispatchQueueCurrentWorker = worker;
+			break;
+		}
+	}
+	
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+//
+// Blocks only need an enqueue time for load
+// shedding or statistics
+//
+static uint64_t _DispatchQueueEnqueueTime(DispatchQueue queue)
+{
+	if (__atomic_load_n(&queue->codelTarget, __ATOMIC_RELAXED) == 0
+		&& !__atomic_load_n(&queue->statsEnabled, __ATOMIC_RELAXED))
+		return 0;
+	
+	return monotonicTime();
+}
+
+static struct _DispatchWorkItem* _DispatchQueueCreateWorkItem(DispatchQueue queue, void (^block)(), uint64_t enqueueTime)
+{
+	struct _DispatchWorkItem* item = RingQueueTryDrain(queue->freeWorkItems);
+	
+	if (item == NULL) {
+		item = malloc(sizeof(struct _DispatchWorkItem));
+		
+		// Nothing sensible we can do
+		if (item == NULL) {
+			perror("malloc");
+			abort();
+		}
+	}
+	
+	item->block = Block_copy(block);
+	item->enqueueTime = enqueueTime;
+	
+	PROBE2(dispatch__enqueue, queue, item);
+	
+	return item;
+}
+
+static void _DispatchQueueFreeWorkItem(DispatchQueue queue, struct _DispatchWorkItem* item)
+{
+	if (!RingQueueTryEnqueue(queue->freeWorkItems, item))
+		free(item);
+}
+
+//
+// Gives up on items the ring did not take, which only
+// happens when the spill can not allocate anymore
+//
+static void _DispatchQueueDropWorkItems(DispatchQueue queue, struct _DispatchWorkItem** items, uint32_t count)
+{
+	printf("Dropped %u blocks, could not enqueue them.\n", count);
+	
+	for (uint32_t i = 0; i < count; i++) {
+		Block_release(items[i]->block);
+		_DispatchQueueFreeWorkItem(queue, items[i]);
+	}
+}
+
+//
+// Called with the enqueue time of the oldest block of each
+// batch a worker takes
+//
+static void _DispatchQueueTrackSojourn(DispatchQueue queue, uint64_t enqueueTime)
+{
+	uint64_t target = __atomic_load_n(&queue->codelTarget, __ATOMIC_ACQUIRE);
+	uint64_t now;
+	uint64_t sojourn;
+	
+	// Disabled or enqueued before it was enabled
+	if (target == 0 || enqueueTime == 0)
+		return;
+	
+	now = monotonicTime();
+	sojourn = now > enqueueTime ? now - enqueueTime : 0;
+	__atomic_store_n(&queue->sojournTime, sojourn, __ATOMIC_RELAXED);
+	
+	if (sojourn < target) {
+		__atomic_store_n(&queue->firstAboveTime, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&queue->overloaded, false, __ATOMIC_RELAXED);
+	}
+	else if (__atomic_load_n(&queue->firstAboveTime, __ATOMIC_RELAXED) == 0) {
+		__atomic_store_n(&queue->firstAboveTime, now + queue->codelInterval, __ATOMIC_RELAXED);
+	}
+	else if (now >= __atomic_load_n(&queue->firstAboveTime, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&queue->overloaded, true, __ATOMIC_RELAXED);
+	}
+}
+
+static uint32_t _DispatchQueueGetCount(DispatchQueue queue)
+{
+	uint32_t count = _DispatchLaneGetCount(&queue->shared);
+	
+	for (uint32_t i = 0; i < queue->numOfLanes; i++)
+		count += _DispatchLaneGetCount(&queue->lanes[i]);
+	
+	return count;
+}
+
+//
+// Picks the level to drain from: A level that was passed over
+// too often first, otherwise the most important one with work.
+//
+static DispatchQoS _DispatchLaneNextLevel(struct _DispatchLane* lane)
+{
+	uint32_t depths[kDispatchQoSLevels];
+	uint32_t level = kDispatchQoSLevels;
+	
+	for (uint32_t i = 0; i < kDispatchQoSLevels; i++)
+		depths[i] = RingQueueGetCount(lane->queues[i]);
+	
+	// Aged levels, the least important one first as
+	// it waited the longest
+	for (uint32_t i = kDispatchQoSLevels - 1; i > 0; i--) {
+		if (depths[i] > 0 && __atomic_load_n(&lane->passedOver[i], __ATOMIC_RELAXED) >= kDispatchQueueAgingLimit) {
+			level = i;
+			break;
+		}
+	}
+	
+	// Strict order
+	if (level == kDispatchQoSLevels) {
+		for (uint32_t i = 0; i < kDispatchQoSLevels; i++) {
+			if (depths[i] > 0) {
+				level = i;
+				break;
+			}
+		}
+	}
+	
+	// Nothing to do at all
+	if (level == kDispatchQoSLevels)
+		return kDispatchQoSLevels;
+	
+	// Account for everybody we passed over
+	for (uint32_t i = 0; i < kDispatchQoSLevels; i++) {
+		if (i == level)
+			__atomic_store_n(&lane->passedOver[i], 0, __ATOMIC_RELAXED);
+		else if (depths[i] > 0 && i > level)
+			__sync_add_and_fetch(&lane->passedOver[i], 1);
+	}
+	
+	return (DispatchQoS)level;
+}
+
+//
+// Same as the loop in _DispatchQueueDrainLane, but records
+// how long every block waited and ran
+//
+static void _DispatchQueueRunWithStats(DispatchQueue queue, struct _DispatchWorkItem** items, uint32_t count)
+{
+	struct _DispatchWorker* worker = _DispatchQueueCurrentWorker;
+	uint64_t start = monotonicTime();
+	
+	for (uint32_t i = 0; i < count; i++) {
+		void (^block)() = items[i]->block;
+		uint64_t enqueueTime = items[i]->enqueueTime;
+		uint64_t end;
+		
+		PROBE2(dispatch__dequeue, queue, items[i]);
+		_DispatchQueueFreeWorkItem(queue, items[i]);
+		
+		// Enqueued before statistics were enabled
+		if (enqueueTime != 0)
+			HistogramRecord(&worker->waitTime, start > enqueueTime ? start - enqueueTime : 0);
+		
+		block();
+		PROBE1(dispatch__done, queue);
+		Block_release(block);
+		
+		end = monotonicTime();
+		HistogramRecord(&worker->runTime, end - start);
+		__atomic_store_n(&worker->busyTime, worker->busyTime + end - start, __ATOMIC_RELAXED);
+		__atomic_store_n(&worker->blocks, worker->blocks + 1, __ATOMIC_RELAXED);
+		start = end;
 	}
 }
 
-static void _DispatchQueueDrainAndRelease(DispatchQueue queue)
+static bool _DispatchQueueDrainLane(DispatchQueue queue, struct _DispatchLane* lane)
 {
-	sem_wait(queue->semaphore);
-	void (^block)() = QueueDrain(queue->queue);
+	struct _DispatchWorkItem* items[kDispatchQueueDrainBatchSize];
+	uint32_t max = kDispatchQueueDrainBatchSize;
+	uint32_t numOfThreads = __atomic_load_n(&queue->numOfThreads, __ATOMIC_RELAXED);
+	DispatchQoS level = _DispatchLaneNextLevel(lane);
+	uint32_t count;
+	
+	if (level == kDispatchQoSLevels)
+		return false;
 	
-	if (block) {
+	// Don't take more than our share, other workers should be
+	// able to run the rest in parallel. An affine lane has only
+	// its owner, unless work is stolen.
+	if (numOfThreads > 1 && lane == &queue->shared) {
+		max = RingQueueGetCount(lane->queues[level]) / numOfThreads;
+		
+		if (max < 1)
+			max = 1;
+		else if (max > kDispatchQueueDrainBatchSize)
+			max = kDispatchQueueDrainBatchSize;
+	}
+	
+	count = RingQueueDrainBatch(lane->queues[level], (void**)items, max);
+	
+	if (count > 0)
+		_DispatchQueueTrackSojourn(queue, items[0]->enqueueTime);
+	
+	if (__atomic_load_n(&queue->statsEnabled, __ATOMIC_RELAXED) && _DispatchQueueCurrentWorker) {
+		_DispatchQueueRunWithStats(queue, items, count);
+		return count > 0;
+	}
+	
+	for (uint32_t i = 0; i < count; i++) {
+		void (^block)() = items[i]->block;
+		
+		// The item is only a key for the tracer, it is
+		// reused as soon as it is freed
+		PROBE2(dispatch__dequeue, queue, items[i]);
+		_DispatchQueueFreeWorkItem(queue, items[i]);
+		
 		block();
+		PROBE1(dispatch__done, queue);
 		Block_release(block);
 	}
+	
+	return count > 0;
 }
 
-static void _DisptachQueueDealloc(void* ptr)
+//
+// Returns a lane of another worker that is so far behind
+// that it is worth to take work from it
+//
+static struct _DispatchLane* _DispatchQueueFindStealableLane(DispatchQueue queue, struct _DispatchLane* own)
 {
-	DispatchQueue queue = ptr;
-	// We need to stop all remaining threads, so we just enqueue
-	// One exit block for everh thread
-	for (uint32_t i = 0; i < queue->numOfThreads; i++) {
-		Dispatch(queue, ^ __attribute__((noreturn)) {
-			pthread_exit(NULL);
-		});
+	// When stopping every lane has to be drained, even
+	// if the owner already left
+	uint32_t threshold = queue->stopping ? 1 : kDispatchQueueStealThreshold;
+	uint32_t start;
+	
+	if (queue->numOfLanes == 0)
+		return NULL;
+	
+	// Start behind our own lane so not all thiefs
+	// go for the same victim
+	start = own ? (uint32_t)(own - queue->lanes) + 1 : 0;
+	
+	for (uint32_t i = 0; i < queue->numOfLanes; i++) {
+		struct _DispatchLane* lane = &queue->lanes[(start + i) % queue->numOfLanes];
+		
+		if (lane != own && _DispatchLaneGetCount(lane) >= threshold)
+			return lane;
+	}
+	
+	return NULL;
+}
+
+static bool _DispatchQueueHasWork(DispatchQueue queue, struct _DispatchLane* own)
+{
+	if (own && _DispatchLaneGetCount(own) > 0)
+		return true;
+	
+	if (_DispatchLaneGetCount(&queue->shared) > 0)
+		return true;
+	
+	return _DispatchQueueFindStealableLane(queue, own) != NULL;
+}
+
+static bool _DispatchQueueDrainAndRelease(DispatchQueue queue)
+{
+	struct _DispatchLane* own = _DispatchQueueCurrentLane;
+	struct _DispatchLane* victim;
+	
+	// Our own lane first, then shared work and
+	// only then work of others
+	if (own && _DispatchQueueDrainLane(queue, own))
+		return true;
+	
+	if (_DispatchQueueDrainLane(queue, &queue->shared))
+		return true;
+	
+	victim = _DispatchQueueFindStealableLane(queue, own);
+	if (victim && _DispatchQueueDrainLane(queue, victim))
+		return true;
+	
+	// Nothing waits, so nothing waits too long
+	if (__atomic_load_n(&queue->overloaded, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&queue->firstAboveTime, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&queue->overloaded, false, __ATOMIC_RELAXED);
+	}
+	
+	return false;
+}
+
+//
+// Waits for new blocks. Returns false if the calling
+// worker should exit.
+//
+static bool _DispatchQueueWait(DispatchQueue queue)
+{
+	struct _DispatchLane* own = _DispatchQueueCurrentLane;
+	bool keepRunning = true;
+	
+	pthread_mutex_lock(&queue->mutex);
+	
+	// Announce us before checking the queue again (full barrier),
+	// dispatchers enqueue before they look for waiting threads
+	__sync_add_and_fetch(&queue->waitingThreads, 1);
+	if (own) {
+		__sync_add_and_fetch(&queue->waitingLaneThreads, 1);
+		__sync_add_and_fetch(&own->waiting, 1);
+	}
+	
+	// The count includes elements that are still being
+	// published, so we might spin shortly but never miss one
+	if (!_DispatchQueueHasWork(queue, own) && !queue->stopping) {
+		struct timeval now;
+		struct timespec timeout;
+		
+		gettimeofday(&now, NULL);
+		timeout.tv_sec = now.tv_sec + kDispatchQueueIdleTimeout;
+		timeout.tv_nsec = now.tv_usec * 1000;
+		
+		// Lane owners stay for the lifetime of the queue
+		if (pthread_cond_timedwait(own ? &own->condition : &queue->condition, &queue->mutex, &timeout) == ETIMEDOUT
+			&& own == NULL
+			&& queue->numOfThreads > queue->minThreads
+			&& !_DispatchQueueHasWork(queue, own)) {
+			// We were idle for too long and are not needed
+			keepRunning = false;
+		}
+	}
+	
+	__sync_sub_and_fetch(&queue->waitingThreads, 1);
+	if (own) {
+		__sync_sub_and_fetch(&queue->waitingLaneThreads, 1);
+		__sync_sub_and_fetch(&own->waiting, 1);
+	}
+	
+	if (queue->stopping && _DispatchQueueGetCount(queue) == 0)
+		keepRunning = false;
+	
+	if (!keepRunning) {
+		__sync_sub_and_fetch(&queue->numOfThreads, 1);
+		
+		if (_DispatchQueueCurrentWorker) {
+			_DispatchQueueCurrentWorker->active = false;
+			_DispatchQueueCurrentWorker = NULL;
+		}
+		
+		if (queue->stopping)
+			pthread_cond_signal(&queue->exitCondition);
+		else
+			_DispatchQueueLogPoolEvent(queue, kDispatchQueuePoolShrink);
+	}
+	
+	pthread_mutex_unlock(&queue->mutex);
+	
+	return keepRunning;
+}
+
+//
+// Wakes up workers for count new blocks, on the given
+// lane or the shared one if lane is NULL
+//
+static void _DispatchQueueWakeup(DispatchQueue queue, struct _DispatchLane* lane, uint32_t count)
+{
+	// The owner is busy and will get to it, nobody
+	// else should take it yet
+	if (lane && __sync_fetch_and_add(&lane->waiting, 0) == 0
+		&& _DispatchLaneGetCount(lane) < kDispatchQueueStealThreshold)
+		return;
+	
+	// Enqueuing was a full barrier, nobody waits
+	// so nobody needs to be woken up
+	if (__sync_fetch_and_add(&queue->waitingThreads, 0) == 0) {
+		// But maybe everybody is stuck
+		if (__atomic_load_n(&queue->blockedThreads, __ATOMIC_RELAXED) > 0)
+			_DispatchQueueGrowIfNeeded(queue);
+		
+		return;
+	}
+	
+	pthread_mutex_lock(&queue->mutex);
+	
+	if (lane && lane->waiting) {
+		pthread_cond_signal(&lane->condition);
+	}
+	// Prefer workers without a lane for shared work,
+	// they have nothing better to do
+	else if (queue->waitingThreads > queue->waitingLaneThreads) {
+		if (count > 1)
+			pthread_cond_broadcast(&queue->condition);
+		else
+			pthread_cond_signal(&queue->condition);
+	}
+	else {
+		for (uint32_t i = 0; i < queue->numOfLanes && count > 0; i++) {
+			if (queue->lanes[i].waiting) {
+				pthread_cond_signal(&queue->lanes[i].condition);
+				count--;
+			}
+		}
 	}
 	
-	// Now we join all the threads to let them finish before
-	// we remove any data
-	for (uint32_t i = 0; i < queue->numOfThreads; i++) {
-		pthread_join(queue->threads[i], NULL);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+//
+// Must be called with the mutex held
+//
+static bool _DispatchQueueStartThread(DispatchQueue queue)
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+	int error;
+	
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	error = pthread_create(&thread, &attr, _DispatchQueueThread, queue);
+	pthread_attr_destroy(&attr);
+	
+	if (error) {
+		errno = error;
+		perror("pthread_create");
+		return false;
 	}
 	
+	__sync_add_and_fetch(&queue->numOfThreads, 1);
+	_DispatchQueueLogPoolEvent(queue, kDispatchQueuePoolGrow);
+	
+	return true;
+}
+
+//
+// Starts a new worker when work piles up while too
+// many workers are stuck in blocking regions.
+//
+static void _DispatchQueueGrowIfNeeded(DispatchQueue queue)
+{
+	// Quick check without the lock
+	if (__atomic_load_n(&queue->numOfThreads, __ATOMIC_RELAXED) >= queue->maxThreads)
+		return;
+	
+	pthread_mutex_lock(&queue->mutex);
+	
+	uint32_t blocked = __atomic_load_n(&queue->blockedThreads, __ATOMIC_RELAXED);
+	
+	if (!queue->stopping
+		&& queue->numOfThreads < queue->maxThreads
+		&& queue->waitingThreads == 0
+		&& queue->numOfThreads - blocked < queue->minThreads
+		&& _DispatchQueueGetCount(queue) > 0) {
+		_DispatchQueueStartThread(queue);
+	}
+	
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+//
+// Must be called with the mutex held
+//
+static void _DispatchQueueLogPoolEvent(DispatchQueue queue, DispatchQueuePoolEventType type)
+{
+	DispatchQueuePoolEvent* event = &queue->poolEvents[queue->numOfPoolEvents % kDispatchQueuePoolEventLogSize];
+	
+	event->type = type;
+	event->numOfThreads = queue->numOfThreads;
+	event->timestamp = monotonicTime();
+	
+	queue->numOfPoolEvents++;
+}
+
+//
+// Returns the number of cpus this process may run on
+//
+static uint32_t _DispatchQueueGetNumOfCPUs(void)
+{
+	long cpus;
+	
+#ifdef LINUX
+	cpu_set_t allowed;
+	
+	if (sched_getaffinity(getpid(), sizeof(allowed), &allowed) == 0)
+		return (uint32_t)CPU_COUNT(&allowed);
+#endif
+	
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	
+	return cpus < 1 ? 1 : (uint32_t)cpus;
+}
+
+static void _DisptachQueueDealloc(void* ptr)
+{
+	DispatchQueue queue = ptr;
+	
+	// Let all threads finish the remaining blocks and
+	// wait for them to exit before we remove any data
+	pthread_mutex_lock(&queue->mutex);
+	queue->stopping = true;
+	pthread_cond_broadcast(&queue->condition);
+	for (uint32_t i = 0; i < queue->numOfLanes; i++)
+		pthread_cond_broadcast(&queue->lanes[i].condition);
+	
+	while (queue->numOfThreads > 0)
+		pthread_cond_wait(&queue->exitCondition, &queue->mutex);
+	pthread_mutex_unlock(&queue->mutex);
+	
 	// Now we can release the data
-	Release(queue->queue);
-	if (queue->threads)
-		free(queue->threads);
+	_DispatchLaneDestroy(&queue->shared);
+	
+	if (queue->lanes) {
+		for (uint32_t i = 0; i < queue->numOfLanes; i++)
+			_DispatchLaneDestroy(&queue->lanes[i]);
+		free(queue->lanes);
+	}
+	
+	if (queue->freeWorkItems) {
+		struct _DispatchWorkItem* item;
+		
+		while ((item = RingQueueTryDrain(queue->freeWorkItems)) != NULL)
+			free(item);
+		Release(queue->freeWorkItems);
+	}
+	free(queue->workers);
+	pthread_cond_destroy(&queue->exitCondition);
+	pthread_cond_destroy(&queue->condition);
+	pthread_mutex_destroy(&queue->mutex);
 	free(queue);
 }
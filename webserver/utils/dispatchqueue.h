@@ -24,6 +24,10 @@
 #define _DISPATCH_QUEUE_H_
 
 #include "utils/object.h"
+#include "utils/histogram.h"
+
+#include <stdint.h>
+#include <stdbool.h>
 
 DECLARE_CLASS(DispatchQueue);
 
@@ -33,20 +37,240 @@ typedef enum {
 	// queue will use only one thread and therefor
 	// ensures the correct order of execution
 	//
-	kDispatchQueueSerial = (1 << 1)
+	kDispatchQueueSerial = (1 << 1),
+	
+	//
+	// Each initial worker owns a lane and is pinned
+	// to a cpu (where supported). Blocks dispatched with
+	// DispatchAffine and the same key always run on the
+	// same worker, unless it falls so far behind that
+	// others steal from it.
+	//
+	kDispatchQueueAffine = (1 << 2)
 } DispatchQueueFlags;
 
+//
+// Quality of service of a dispatched block. Workers always
+// take the most important work first, but less important
+// work that was passed over too often gets its turn too.
+//
+typedef enum {
+	//
+	// Work somebody is actively waiting for, like
+	// continuing a started response
+	//
+	kDispatchQoSInteractive,
+	
+	//
+	// Regular work
+	//
+	kDispatchQoSDefault,
+	
+	//
+	// Housekeeping that can wait
+	//
+	kDispatchQoSBackground,
+	
+	kDispatchQoSLevels
+} DispatchQoS;
+
+typedef enum {
+	kDispatchQueuePoolGrow,
+	kDispatchQueuePoolShrink
+} DispatchQueuePoolEventType;
+
+//
+// Records a change of the number of worker threads
+//
+typedef struct {
+	DispatchQueuePoolEventType type;
+	
+	//
+	// Number of threads after the change
+	//
+	uint32_t numOfThreads;
+	
+	//
+	// When it happend (see monotonicTime)
+	//
+	uint64_t timestamp;
+} DispatchQueuePoolEvent;
+
+//
+// What a queue spent its time on, see DispatchQueueCopyStats.
+// Durations are in nanoseconds.
+//
+typedef struct {
+	//
+	// Blocks waiting and worker threads right now
+	//
+	uint32_t depth;
+	uint32_t numOfThreads;
+	
+	//
+	// Time from the enqueue until a block started
+	//
+	Histogram waitTime;
+	
+	//
+	// Run time of the blocks
+	//
+	Histogram runTime;
+} DispatchQueueStats;
+
+//
+// A single worker of a queue
+//
+typedef struct {
+	//
+	// Blocks the worker ran
+	//
+	uint64_t blocks;
+	
+	//
+	// Time the worker ran blocks and time since the
+	// worker started, busyTime / lifetime is its
+	// utilization
+	//
+	uint64_t busyTime;
+	uint64_t lifetime;
+} DispatchWorkerStats;
+
 //
 // Creates a new dispatch queue.
 //
+// A concurrent queue starts with one worker per cpu. It grows
+// when workers are stuck in blocking regions while work piles up
+// and shrinks again when workers stay idle for some time.
+//
 // Is a Retainable
 //	
 OBJECT_RETURNS_RETAINED
 DispatchQueue DispatchQueueCreate(DispatchQueueFlags flags);
 
+//
+// Returns the current number of worker threads
+//
+uint32_t DispatchQueueGetThreadCount(DispatchQueue queue);
+
+//
+// Gives the queue a name for statistics and debugging,
+// it is copied. Queues have no name (NULL) by default.
+//
+void DispatchQueueSetName(DispatchQueue queue, const char* name);
+const char* DispatchQueueGetName(DispatchQueue queue);
+
+//
+// Enables recording of wait and run times. Disabled
+// (the default) it costs one check per drained batch,
+// enabled two clock reads per block.
+//
+void DispatchQueueSetStatsEnabled(DispatchQueue queue, bool enabled);
+
+//
+// Copies the statistics of the queue and of up to max of its
+// workers. Returns the number of copied workers. Times are
+// only recorded while enabled.
+//
+uint32_t DispatchQueueCopyStats(DispatchQueue queue, DispatchQueueStats* stats, DispatchWorkerStats* workers, uint32_t max);
+
+//
+// Copies up to max of the latest grow/shrink events
+// (oldest first) and returns the number of copied events.
+//
+uint32_t DispatchQueueCopyPoolEvents(DispatchQueue queue, DispatchQueuePoolEvent* events, uint32_t max);
+
+//
+// Hints that the calling block is about to do something
+// that blocks (like disk io). When called from a worker, the
+// queue may start an additional worker to keep the other
+// blocks going. Each begin must be balanced by an end.
+//
+// Calling these outside of a dispatch queue has no effect.
+//
+void DispatchBlockingRegionBegin(void);
+void DispatchBlockingRegionEnd(void);
+
 //
 // Enqueue a block to be dispatched.
 //
+// Same as DispatchWithQoS with kDispatchQoSDefault.
+//
 void Dispatch(DispatchQueue queue, void(^block)());
 
+//
+// Enqueue a block to be dispatched with the given
+// quality of service.
+//
+void DispatchWithQoS(DispatchQueue queue, DispatchQoS qos, void(^block)());
+
+//
+// Enqueue count blocks at once. They are enqueued with
+// one atomic operation and idle workers are woken up
+// at most once.
+//
+void DispatchBatch(DispatchQueue queue, void(^blocks[])(), uint32_t count);
+
+//
+// Same as DispatchBatch but with the given quality of service
+//
+void DispatchBatchWithQoS(DispatchQueue queue, DispatchQoS qos, void(^blocks[])(), uint32_t count);
+
+//
+// Enqueue a block on the lane of key. Blocks with the same
+// key run on the same worker.
+//
+// Same as DispatchWithQoS if the queue is not affine.
+//
+void DispatchAffine(DispatchQueue queue, uintptr_t key, DispatchQoS qos, void(^block)());
+
+//
+// Same as DispatchAffine for count blocks with a key each
+//
+void DispatchAffineBatch(DispatchQueue queue, DispatchQoS qos, uintptr_t keys[], void(^blocks[])(), uint32_t count);
+
+//
+// Returns the number of lanes, 0 if the queue is not affine
+//
+uint32_t DispatchQueueGetNumberOfLanes(DispatchQueue queue);
+
+//
+// Returns the number of blocks waiting on a lane
+//
+uint32_t DispatchQueueGetLaneDepth(DispatchQueue queue, uint32_t lane);
+
+//
+// Returns the number of blocks waiting with the
+// given quality of service
+//
+uint32_t DispatchQueueGetDepth(DispatchQueue queue, DispatchQoS qos);
+
+//
+// Enables load shedding. The queue tracks how long blocks wait
+// before they run (the sojourn time). When the sojourn time stays
+// above target for at least interval (both in nanoseconds) the
+// queue is overloaded until a block runs faster again or the
+// queue runs empty.
+//
+// A target of 0 disables load shedding, which is the default.
+//
+void DispatchQueueSetCoDel(DispatchQueue queue, uint64_t target, uint64_t interval);
+
+//
+// Returns true if new work should be rejected instead of
+// being dispatched. Every true result is counted as shed.
+//
+bool DispatchQueueShouldShed(DispatchQueue queue);
+
+//
+// Returns the number of times DispatchQueueShouldShed
+// returned true
+//
+uint64_t DispatchQueueGetShedCount(DispatchQueue queue);
+
+//
+// Returns the last measured sojourn time in nanoseconds
+//
+uint64_t DispatchQueueGetSojournTime(DispatchQueue queue);
+
 #endif /* _DISPATCH_QUEUE_H_ */
@@ -0,0 +1,258 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifdef DARWIN
+// ucontext is only available with this on darwin
+#define _XOPEN_SOURCE 600
+#endif
+
+#include "fiber.h"
+#include "ringqueue.h"
+#include "slab.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <Block.h>
+
+//
+// Usable size of a fiber stack. Handlers are
+// expected to keep large buffers on the heap.
+//
+#define kFiberStackSize (64 * 1024)
+
+//
+// Number of unused stacks kept around for reuse
+//
+#define kFiberStackPoolSize 256
+
+DEFINE_CLASS(Fiber,
+	ucontext_t context;
+	
+	//
+	// The context of the thread that resumed the fiber,
+	// the fiber switches back to it when it suspends or
+	// finishes
+	//
+	ucontext_t callerContext;
+	
+	//
+	// The mapping including the guard page
+	//
+	void* stack;
+	
+	void (^block)();
+	void (^afterSuspend)();
+	
+	bool finished;
+);
+
+DEFINE_SLAB(Fiber, sizeof(struct _Fiber));
+
+//
+// Unused stacks
+//
+static RingQueue _FiberStackPool;
+static pthread_once_t _FiberStackPoolOnce = PTHREAD_ONCE_INIT;
+static size_t _FiberPageSize;
+
+static __thread Fiber _FiberCurrent;
+
+static void _FiberStackPoolInit(void);
+static void* _FiberAllocateStack(void);
+static void _FiberFreeStack(void* stack);
+static void _FiberEntry(void);
+static void _FiberDealloc(void* ptr);
+
+Fiber FiberCreate(void (^block)())
+{
+	Fiber fiber = SlabAlloc(FiberSlab);
+	
+	if (fiber == NULL) {
+		perror("SlabAlloc");
+		return NULL;
+	}
+	
+	ObjectInit(fiber, &FiberClass, _FiberDealloc);
+	
+	fiber->stack = _FiberAllocateStack();
+	
+	if (fiber->stack == NULL) {
+		Release(fiber);
+		return NULL;
+	}
+	
+	if (getcontext(&fiber->context) < 0) {
+		perror("getcontext");
+		Release(fiber);
+		return NULL;
+	}
+	
+	// The first page is the guard page
+	fiber->context.uc_stack.ss_sp = (char*)fiber->stack + _FiberPageSize;
+	fiber->context.uc_stack.ss_size = kFiberStackSize;
+	fiber->context.uc_link = &fiber->callerContext;
+	makecontext(&fiber->context, _FiberEntry, 0);
+	
+	fiber->block = Block_copy(block);
+	
+	return fiber;
+}
+
+void FiberResume(Fiber fiber)
+{
+	void (^afterSuspend)();
+	bool finished;
+	
+	assert(_FiberCurrent == NULL);
+	assert(!fiber->finished);
+	
+	// Keep it alive while it runs, the block
+	// may drop the last other reference
+	Retain(fiber);
+	
+	_FiberCurrent = fiber;
+	swapcontext(&fiber->callerContext, &fiber->context);
+	_FiberCurrent = NULL;
+	
+	// Once afterSuspend ran, the fiber may already
+	// run on another thread, so don't touch it anymore
+	finished = fiber->finished;
+	afterSuspend = fiber->afterSuspend;
+	fiber->afterSuspend = NULL;
+	
+	if (finished) {
+		_FiberFreeStack(fiber->stack);
+		fiber->stack = NULL;
+		
+		// Let go of everything the block captured
+		Block_release(fiber->block);
+		fiber->block = NULL;
+	}
+	else if (afterSuspend) {
+		afterSuspend();
+		Block_release(afterSuspend);
+	}
+	
+	Release(fiber);
+}
+
+void FiberSuspend(void (^afterSuspend)())
+{
+	Fiber fiber = _FiberCurrent;
+	
+	assert(fiber != NULL);
+	
+	fiber->afterSuspend = Block_copy(afterSuspend);
+	swapcontext(&fiber->context, &fiber->callerContext);
+}
+
+Fiber FiberGetCurrent(void)
+{
+	return _FiberCurrent;
+}
+
+bool FiberIsFinished(Fiber fiber)
+{
+	return fiber->finished;
+}
+
+static void _FiberStackPoolInit(void)
+{
+	_FiberPageSize = (size_t)sysconf(_SC_PAGESIZE);
+	_FiberStackPool = RingQueueCreate(kFiberStackPoolSize, kRingQueueOverflowFail);
+}
+
+static void* _FiberAllocateStack(void)
+{
+	void* stack;
+	
+	pthread_once(&_FiberStackPoolOnce, _FiberStackPoolInit);
+	
+	if (_FiberStackPool) {
+		stack = RingQueueTryDrain(_FiberStackPool);
+		
+		if (stack)
+			return stack;
+	}
+	
+	stack = mmap(NULL, kFiberStackSize + _FiberPageSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+	
+	if (stack == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+	
+	// Stacks grow down, so an overflow hits the
+	// guard page instead of the neighbouring memory
+	if (mprotect(stack, _FiberPageSize, PROT_NONE) < 0) {
+		perror("mprotect");
+		munmap(stack, kFiberStackSize + _FiberPageSize);
+		return NULL;
+	}
+	
+	return stack;
+}
+
+static void _FiberFreeStack(void* stack)
+{
+	if (stack == NULL)
+		return;
+	
+	if (_FiberStackPool && RingQueueTryEnqueue(_FiberStackPool, stack))
+		return;
+	
+	munmap(stack, kFiberStackSize + _FiberPageSize);
+}
+
+static void _FiberEntry(void)
+{
+	Fiber fiber = _FiberCurrent;
+	
+	fiber->block();
+	
+	// Returns to the caller context through uc_link
+	fiber->finished = true;
+}
+
+static void _FiberDealloc(void* ptr)
+{
+	Fiber fiber = ptr;
+	
+	// A fiber that never finished loses whatever
+	// was left on its stack
+	_FiberFreeStack(fiber->stack);
+	
+	if (fiber->block)
+		Block_release(fiber->block);
+	
+	if (fiber->afterSuspend)
+		Block_release(fiber->afterSuspend);
+	
+	SlabFree(FiberSlab, fiber);
+}
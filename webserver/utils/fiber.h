@@ -0,0 +1,77 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _FIBER_H_
+#define _FIBER_H_
+
+#include "utils/object.h"
+
+#include <stdbool.h>
+
+DECLARE_CLASS(Fiber);
+
+//
+// Creates a new fiber that runs block on a stack of its own.
+// The fiber does not run until it is resumed.
+//
+// Is a Retainable
+//
+OBJECT_RETURNS_RETAINED
+Fiber FiberCreate(void (^block)());
+
+//
+// Runs the fiber on the calling thread until it suspends
+// itself or the block returns. A suspended fiber may be
+// resumed on any thread, but only once per suspend.
+//
+// Must not be called from within a fiber.
+//
+void FiberResume(Fiber fiber);
+
+//
+// Suspends the calling fiber and returns to the thread
+// that resumed it. afterSuspend is then called on that
+// thread, outside of the fiber. This is the place to
+// arrange for the fiber to be resumed (e.g. register for
+// an event), as the fiber may not be resumed before it
+// is suspended completly.
+//
+// The fiber may be resumed on another thread. Addresses of
+// thread local variables (including errno, whose location
+// the compiler may cache) must not be kept across a suspend.
+//
+// Must be called from within a fiber.
+//
+void FiberSuspend(void (^afterSuspend)());
+
+//
+// Returns the fiber running on the calling thread
+// or NULL if none is running
+//
+Fiber FiberGetCurrent(void);
+
+//
+// Returns true if the block of the fiber returned
+//
+bool FiberIsFinished(Fiber fiber);
+
+#endif /* _FIBER_H_ */
@@ -26,6 +26,10 @@
 #include <fcntl.h>
 #include <netinet/tcp.h>
 #include <unistd.h>
+#include <time.h>
+#ifdef DARWIN
+#include <sys/time.h>
+#endif
 
 #include "helper.h"
 
@@ -124,3 +128,37 @@ sem_t* sem_open_anon()
 	
 	return sem;
 }
+
+uint64_t monotonicTime(void)
+{
+#ifdef DARWIN
+	struct timeval tv;
+	
+	gettimeofday(&tv, NULL);
+	
+	return (uint64_t)tv.tv_sec * 1000000000ull + (uint64_t)tv.tv_usec * 1000ull;
+#else
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+uint64_t wallClockTime(void)
+{
+#ifdef DARWIN
+	struct timeval tv;
+	
+	gettimeofday(&tv, NULL);
+	
+	return (uint64_t)tv.tv_sec * 1000000000ull + (uint64_t)tv.tv_usec * 1000ull;
+#else
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_REALTIME, &ts);
+	
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
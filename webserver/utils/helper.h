@@ -23,6 +23,7 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <semaphore.h>
 
 char* stringFromSockaddrIn(struct sockaddr_in6 const* sockaddr);
@@ -46,3 +47,25 @@ bool setTCPNoPush(int socket, bool noPush);
 // Because sem_init is not avaiable under darwin
 //
 sem_t* sem_open_anon();
+
+//
+// Returns a monotonic timestamp in nanoseconds. Only
+// usable to measure intervals.
+//
+uint64_t monotonicTime(void);
+
+//
+// Returns the wall clock time in nanoseconds
+// since the epoch
+//
+uint64_t wallClockTime(void);
+
+//
+// printf for tracing what the server does, compiled
+// out unless built with DEBUG=1
+//
+#ifdef DEBUG
+#define DEBUG_LOG(...) printf(__VA_ARGS__)
+#else
+#define DEBUG_LOG(...) do {} while (0)
+#endif
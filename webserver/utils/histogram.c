@@ -0,0 +1,92 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "histogram.h"
+
+#include <string.h>
+
+static void HistogramAdd(uint64_t* value, uint64_t amount);
+
+void HistogramRecord(Histogram* histogram, uint64_t value)
+{
+	HistogramAdd(&histogram->buckets[HistogramGetBucket(value)], 1);
+	HistogramAdd(&histogram->sum, value);
+	HistogramAdd(&histogram->count, 1);
+}
+
+void HistogramCopy(Histogram* to, const Histogram* from)
+{
+	memset(to, 0, sizeof(Histogram));
+	HistogramMerge(to, from);
+}
+
+void HistogramMerge(Histogram* to, const Histogram* from)
+{
+	to->count += __atomic_load_n(&from->count, __ATOMIC_RELAXED);
+	to->sum += __atomic_load_n(&from->sum, __ATOMIC_RELAXED);
+	
+	for (uint32_t i = 0; i < kHistogramBuckets; i++)
+		to->buckets[i] += __atomic_load_n(&from->buckets[i], __ATOMIC_RELAXED);
+}
+
+uint32_t HistogramGetBucket(uint64_t value)
+{
+	uint32_t shift;
+	
+	if (value < kHistogramSubBuckets)
+		return (uint32_t)value;
+	
+	shift = 63 - (uint32_t)__builtin_clzll(value);
+	
+	if (shift >= kHistogramMaxShift)
+		return kHistogramBuckets - 1;
+	
+	// The bits right below the highest one pick the sub bucket
+	return kHistogramSubBuckets + (shift - kHistogramSubShift) * kHistogramSubBuckets
+		+ (uint32_t)((value >> (shift - kHistogramSubShift)) & (kHistogramSubBuckets - 1));
+}
+
+uint64_t HistogramGetBucketBound(uint32_t bucket)
+{
+	uint32_t shift;
+	uint32_t sub;
+	
+	if (bucket >= kHistogramBuckets - 1)
+		return UINT64_MAX;
+	
+	if (bucket < kHistogramSubBuckets)
+		return bucket;
+	
+	shift = kHistogramSubShift + (bucket - kHistogramSubBuckets) / kHistogramSubBuckets;
+	sub = (bucket - kHistogramSubBuckets) % kHistogramSubBuckets;
+	
+	return (1ull << shift) + ((uint64_t)(sub + 1) << (shift - kHistogramSubShift)) - 1;
+}
+
+//
+// There is only one writer, so a plain add is enough. The
+// store is atomic to not tear for readers.
+//
+static void HistogramAdd(uint64_t* value, uint64_t amount)
+{
+	__atomic_store_n(value, *value + amount, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,77 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdint.h>
+
+//
+// A histogram for statistics that have a single writer at a
+// time (a poll thread, a worker). The writer updates it
+// without any read-modify-write, others can copy it at any
+// time and see every field untorn.
+//
+// The buckets are log-linear, metrics histograms use the
+// same ones. Values below 2^kHistogramSubShift get a bucket
+// each, above that every power of two up to
+// 2^kHistogramMaxShift is split into 2^kHistogramSubShift
+// buckets (at most 25% wide). The last bucket holds the rest,
+// for nanoseconds that is everything above about 69s.
+//
+#define kHistogramSubShift 2
+#define kHistogramSubBuckets (1 << kHistogramSubShift)
+#define kHistogramMaxShift 36
+#define kHistogramBuckets (kHistogramSubBuckets + (kHistogramMaxShift - kHistogramSubShift) * kHistogramSubBuckets + 1)
+
+typedef struct {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t buckets[kHistogramBuckets];
+} Histogram;
+
+//
+// Records value, only one thread may do so at a time
+//
+void HistogramRecord(Histogram* histogram, uint64_t value);
+
+//
+// Copies from while it may be written to
+//
+void HistogramCopy(Histogram* to, const Histogram* from);
+
+//
+// Adds from (which may be written to) to to
+//
+void HistogramMerge(Histogram* to, const Histogram* from);
+
+//
+// Returns the bucket value is counted in
+//
+uint32_t HistogramGetBucket(uint64_t value);
+
+//
+// Returns the inclusive upper bound of a bucket
+//
+uint64_t HistogramGetBucketBound(uint32_t bucket);
+
+#endif /* _HISTOGRAM_H_ */
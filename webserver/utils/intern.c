@@ -0,0 +1,139 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "intern.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+//
+// Open addressing with linear probing, kept at most half full.
+// Strings are never removed, so lookups only need the
+// read lock.
+//
+#define kInternTableSize (kInternMaxStrings * 2)
+
+struct InternEntry {
+	const char* string;
+	uint32_t length;
+	uint32_t hash;
+};
+
+static struct InternEntry InternTable[kInternTableSize];
+static size_t InternCount;
+static pthread_rwlock_t InternLock = PTHREAD_RWLOCK_INITIALIZER;
+
+static uint32_t InternHash(Slice string);
+static struct InternEntry* InternLookup(Slice string, uint32_t hash);
+
+const char* InternSlice(Slice string)
+{
+	uint32_t hash;
+	struct InternEntry* entry;
+	const char* interned;
+	char* copy;
+	
+	if (string.length > kInternMaxLength)
+		return NULL;
+	
+	hash = InternHash(string);
+	
+	pthread_rwlock_rdlock(&InternLock);
+	interned = InternLookup(string, hash)->string;
+	pthread_rwlock_unlock(&InternLock);
+	
+	if (interned != NULL)
+		return interned;
+	
+	pthread_rwlock_wrlock(&InternLock);
+	
+	// Somebody else may have added it meanwhile
+	entry = InternLookup(string, hash);
+	if (entry->string != NULL) {
+		pthread_rwlock_unlock(&InternLock);
+		return entry->string;
+	}
+	
+	if (InternCount >= kInternMaxStrings) {
+		pthread_rwlock_unlock(&InternLock);
+		return NULL;
+	}
+	
+	copy = SliceCopy(string);
+	if (copy == NULL) {
+		pthread_rwlock_unlock(&InternLock);
+		return NULL;
+	}
+	
+	entry->length = (uint32_t)string.length;
+	entry->hash = hash;
+	entry->string = copy;
+	InternCount++;
+	
+	pthread_rwlock_unlock(&InternLock);
+	
+	return copy;
+}
+
+const char* InternString(const char* string)
+{
+	return InternSlice(SliceFromString(string));
+}
+
+//
+// FNV-1a
+//
+static uint32_t InternHash(Slice string)
+{
+	uint32_t hash = 2166136261u;
+	
+	for (size_t i = 0; i < string.length; i++) {
+		hash ^= (uint8_t)string.data[i];
+		hash *= 16777619u;
+	}
+	
+	return hash;
+}
+
+//
+// Returns the entry of string or the empty
+// entry where it belongs
+//
+static struct InternEntry* InternLookup(Slice string, uint32_t hash)
+{
+	size_t index = hash % kInternTableSize;
+	
+	for (;;) {
+		struct InternEntry* entry = &InternTable[index];
+		
+		if (entry->string == NULL)
+			return entry;
+		
+		if (entry->hash == hash && entry->length == string.length && memcmp(entry->string, string.data, string.length) == 0)
+			return entry;
+		
+		index = (index + 1) % kInternTableSize;
+	}
+}
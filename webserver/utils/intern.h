@@ -0,0 +1,55 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _INTERN_H_
+#define _INTERN_H_
+
+#include "utils/slice.h"
+
+//
+// Interning keeps one shared copy of strings that repeat a lot,
+// like the header names the server sets. Interning equal strings
+// returns the same pointer, so interned strings can be compared
+// with ==.
+//
+// Never intern what a client sends, it would fill the table
+// for good and every lookup takes a global read lock.
+//
+// Interned strings live until the process exits. The table is
+// bounded, once it is full (or the string is longer than
+// kInternMaxLength) NULL is returned and the caller has to
+// keep a copy of its own.
+//
+#define kInternMaxStrings 2048
+#define kInternMaxLength 128
+
+//
+// Returns the interned copy of string or NULL
+//
+const char* InternSlice(Slice string);
+
+//
+// Same as InternSlice for a \0 terminated string
+//
+const char* InternString(const char* string);
+
+#endif /* _INTERN_H_ */
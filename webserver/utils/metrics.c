@@ -0,0 +1,335 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "metrics.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <Block.h>
+
+//
+// Number of shards of every metric, threads beyond
+// that share shards (updates stay atomic)
+//
+#define kMetricShards 16
+
+struct MetricCounterShard {
+	int64_t value;
+} __attribute__((aligned(64)));
+
+struct MetricHistogramShard {
+	uint64_t count;
+	uint64_t sum;
+	// Laid out like the buckets of a Histogram
+	uint64_t buckets[kHistogramBuckets];
+} __attribute__((aligned(64)));
+
+struct _Metric {
+	struct _Metric* next;
+	
+	const char* name;
+	const char* help;
+	MetricType type;
+	
+	union {
+		struct MetricCounterShard* counters;
+		struct MetricHistogramShard* histograms;
+	} shards;
+};
+
+struct MetricsCollectorEntry {
+	struct MetricsCollectorEntry* next;
+	MetricsCollector collector;
+};
+
+struct _MetricsWriter {
+	char* data;
+	size_t length;
+	size_t capacity;
+	bool failed;
+};
+
+static pthread_mutex_t MetricsLock = PTHREAD_MUTEX_INITIALIZER;
+static Metric MetricsFirst;
+static Metric* MetricsLast = &MetricsFirst;
+static struct MetricsCollectorEntry* MetricsCollectors;
+static struct MetricsCollectorEntry** MetricsCollectorsLast = &MetricsCollectors;
+
+static uint32_t MetricsNextShard;
+static __thread uint32_t MetricsShard;
+
+static uint32_t MetricGetShard(void);
+static void MetricWrite(MetricsWriter writer, Metric metric);
+static void MetricsWriterAppend(MetricsWriter writer, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+Metric MetricCreate(const char* name, const char* help, MetricType type)
+{
+	Metric metric = calloc(1, sizeof(struct _Metric));
+	size_t size = type == kMetricHistogram ? sizeof(struct MetricHistogramShard) : sizeof(struct MetricCounterShard);
+	void* shards;
+	
+	if (metric == NULL) {
+		perror("calloc");
+		return NULL;
+	}
+	
+	if (posix_memalign(&shards, 64, size * kMetricShards) != 0) {
+		printf("Could not allocate metric %s.\n", name);
+		free(metric);
+		return NULL;
+	}
+	
+	memset(shards, 0, size * kMetricShards);
+	
+	metric->name = name;
+	metric->help = help;
+	metric->type = type;
+	
+	if (type == kMetricHistogram)
+		metric->shards.histograms = shards;
+	else
+		metric->shards.counters = shards;
+	
+	// Keep the order of creation in the output
+	pthread_mutex_lock(&MetricsLock);
+	*MetricsLast = metric;
+	MetricsLast = &metric->next;
+	pthread_mutex_unlock(&MetricsLock);
+	
+	return metric;
+}
+
+void MetricAdd(Metric metric, int64_t value)
+{
+	if (metric == NULL)
+		return;
+	
+	__atomic_fetch_add(&metric->shards.counters[MetricGetShard()].value, value, __ATOMIC_RELAXED);
+}
+
+void MetricObserve(Metric metric, uint64_t value)
+{
+	struct MetricHistogramShard* shard;
+	
+	if (metric == NULL)
+		return;
+	
+	shard = &metric->shards.histograms[MetricGetShard()];
+	
+	__atomic_fetch_add(&shard->buckets[HistogramGetBucket(value)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&shard->sum, value, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&shard->count, 1, __ATOMIC_RELAXED);
+}
+
+int64_t MetricGetValue(Metric metric)
+{
+	int64_t value = 0;
+	
+	if (metric == NULL || metric->type == kMetricHistogram)
+		return 0;
+	
+	for (uint32_t i = 0; i < kMetricShards; i++)
+		value += __atomic_load_n(&metric->shards.counters[i].value, __ATOMIC_RELAXED);
+	
+	return value;
+}
+
+void MetricsRegisterCollector(MetricsCollector collector)
+{
+	struct MetricsCollectorEntry* entry = calloc(1, sizeof(struct MetricsCollectorEntry));
+	
+	if (entry == NULL) {
+		perror("calloc");
+		return;
+	}
+	
+	entry->collector = Block_copy(collector);
+	
+	pthread_mutex_lock(&MetricsLock);
+	*MetricsCollectorsLast = entry;
+	MetricsCollectorsLast = &entry->next;
+	pthread_mutex_unlock(&MetricsLock);
+}
+
+void MetricsWriteHeader(MetricsWriter writer, const char* name, const char* help, MetricType type)
+{
+	static const char* const kMetricTypeNames[] = {
+		[kMetricCounter] = "counter",
+		[kMetricGauge] = "gauge",
+		[kMetricHistogram] = "histogram"
+	};
+	
+	MetricsWriterAppend(writer, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, kMetricTypeNames[type]);
+}
+
+void MetricsWriteSample(MetricsWriter writer, const char* name, const char* labels, double value)
+{
+	if (labels)
+		MetricsWriterAppend(writer, "%s{%s} %.17g\n", name, labels, value);
+	else
+		MetricsWriterAppend(writer, "%s %.17g\n", name, value);
+}
+
+void MetricsWriteHistogram(MetricsWriter writer, const char* name, const char* labels, const Histogram* histogram, double scale)
+{
+	const char* separator = labels ? "," : "";
+	uint64_t cumulative = 0;
+	
+	if (labels == NULL)
+		labels = "";
+	
+	for (uint32_t i = 0; i < kHistogramBuckets - 1; i++) {
+		uint64_t bound = HistogramGetBucketBound(i);
+		
+		cumulative += histogram->buckets[i];
+		MetricsWriterAppend(writer, "%s_bucket{%s%sle=\"%.9g\"} %llu\n", name, labels, separator, (double)bound * scale, (unsigned long long)cumulative);
+	}
+	MetricsWriterAppend(writer, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, separator, (unsigned long long)histogram->count);
+	
+	if (*labels) {
+		MetricsWriterAppend(writer, "%s_sum{%s} %.17g\n", name, labels, (double)histogram->sum * scale);
+		MetricsWriterAppend(writer, "%s_count{%s} %llu\n", name, labels, (unsigned long long)histogram->count);
+	}
+	else {
+		MetricsWriterAppend(writer, "%s_sum %.17g\n", name, (double)histogram->sum * scale);
+		MetricsWriterAppend(writer, "%s_count %llu\n", name, (unsigned long long)histogram->count);
+	}
+}
+
+char* MetricsCopyPrometheusText(void)
+{
+	struct _MetricsWriter writer = { NULL, 0, 0, false };
+	
+	// Metrics and collectors are only ever appended, the
+	// lock keeps a half linked one out
+	pthread_mutex_lock(&MetricsLock);
+	
+	for (Metric metric = MetricsFirst; metric != NULL; metric = metric->next)
+		MetricWrite(&writer, metric);
+	
+	for (struct MetricsCollectorEntry* entry = MetricsCollectors; entry != NULL; entry = entry->next)
+		entry->collector(&writer);
+	
+	pthread_mutex_unlock(&MetricsLock);
+	
+	if (writer.failed) {
+		free(writer.data);
+		return NULL;
+	}
+	
+	// Nothing registered
+	if (writer.data == NULL)
+		return strdup("");
+	
+	return writer.data;
+}
+
+static uint32_t MetricGetShard(void)
+{
+	// 0 means no shard assigned yet
+	if (MetricsShard == 0)
+		MetricsShard = __sync_add_and_fetch(&MetricsNextShard, 1);
+	
+	return MetricsShard % kMetricShards;
+}
+
+static void MetricWrite(MetricsWriter writer, Metric metric)
+{
+	Histogram histogram;
+	
+	MetricsWriteHeader(writer, metric->name, metric->help, metric->type);
+	
+	if (metric->type != kMetricHistogram) {
+		int64_t value = MetricGetValue(metric);
+		
+		MetricsWriteSample(writer, metric->name, NULL, (double)value);
+		return;
+	}
+	
+	memset(&histogram, 0, sizeof(histogram));
+	
+	for (uint32_t i = 0; i < kMetricShards; i++) {
+		struct MetricHistogramShard* shard = &metric->shards.histograms[i];
+		
+		for (uint32_t j = 0; j < kHistogramBuckets; j++)
+			histogram.buckets[j] += __atomic_load_n(&shard->buckets[j], __ATOMIC_RELAXED);
+		
+		histogram.sum += __atomic_load_n(&shard->sum, __ATOMIC_RELAXED);
+	}
+	
+	// Buckets, sum and count are read one after another, taking
+	// the count from the buckets keeps at least those consistent
+	for (uint32_t j = 0; j < kHistogramBuckets; j++)
+		histogram.count += histogram.buckets[j];
+	
+	MetricsWriteHistogram(writer, metric->name, NULL, &histogram, 1e-9);
+}
+
+static void MetricsWriterAppend(MetricsWriter writer, const char* format, ...)
+{
+	va_list args;
+	int length;
+	
+	if (writer->failed)
+		return;
+	
+	for (;;) {
+		size_t available = writer->capacity - writer->length;
+		
+		va_start(args, format);
+		length = vsnprintf(writer->data ? writer->data + writer->length : NULL, available, format, args);
+		va_end(args);
+		
+		if (length < 0) {
+			writer->failed = true;
+			return;
+		}
+		
+		if ((size_t)length < available) {
+			writer->length += (size_t)length;
+			return;
+		}
+		
+		// Grow and try again
+		size_t capacity = writer->capacity * 2;
+		char* data;
+		
+		if (capacity < writer->length + (size_t)length + 1)
+			capacity = writer->length + (size_t)length + 1;
+		if (capacity < 4096)
+			capacity = 4096;
+		
+		data = realloc(writer->data, capacity);
+		
+		if (data == NULL) {
+			perror("realloc");
+			writer->failed = true;
+			return;
+		}
+		
+		writer->data = data;
+		writer->capacity = capacity;
+	}
+}
@@ -0,0 +1,131 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include "utils/histogram.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Counters, gauges and latency histograms that are cheap
+// enough for the request path. Every metric is split into
+// shards, a thread only updates the shard it was assigned
+// to, so threads do not fight over cache lines. The shards
+// are summed up when the metrics are read.
+//
+// Metrics are created once and live as long as the process.
+// Use DEFINE_METRIC next to the code that updates them.
+//
+typedef struct _Metric* Metric;
+
+typedef enum {
+	//
+	// Only goes up
+	//
+	kMetricCounter,
+	
+	//
+	// Goes up and down
+	//
+	kMetricGauge,
+	
+	//
+	// Distribution of durations in nanoseconds, in the
+	// buckets of a Histogram (up to about 69s)
+	//
+	kMetricHistogram
+} MetricType;
+
+//
+// Defines the static metric variable which is created before
+// main runs. Use it like
+// DEFINE_METRIC(FooMetric, "foo_total", "Number of foos", kMetricCounter);
+//
+#define DEFINE_METRIC(variable, name, help, type)\
+static Metric variable;\
+__attribute__((constructor)) static void _##variable##Init(void) { variable = MetricCreate(name, help, type); }\
+static Metric variable
+
+//
+// Creates a new metric, name and help must stay valid.
+// Names follow the Prometheus conventions (seconds for
+// histograms, _total for counters).
+//
+Metric MetricCreate(const char* name, const char* help, MetricType type);
+
+//
+// Adds value to a counter or gauge
+//
+void MetricAdd(Metric metric, int64_t value);
+
+//
+// Records a duration in nanoseconds in a histogram
+//
+void MetricObserve(Metric metric, uint64_t value);
+
+//
+// Returns the sum of all shards of a counter or gauge
+//
+int64_t MetricGetValue(Metric metric);
+
+//
+// Values that are tracked elsewhere (queue depths, slab
+// usage...) are written by collectors when the metrics are
+// read.
+//
+typedef struct _MetricsWriter* MetricsWriter;
+typedef void (^MetricsCollector)(MetricsWriter writer);
+
+//
+// Adds a collector, it is called with every read
+//
+void MetricsRegisterCollector(MetricsCollector collector);
+
+//
+// Writes the HELP and TYPE lines, once for each name
+//
+void MetricsWriteHeader(MetricsWriter writer, const char* name, const char* help, MetricType type);
+
+//
+// Writes a sample of name. labels are written as they are
+// (like slab="Foo") and may be NULL.
+//
+void MetricsWriteSample(MetricsWriter writer, const char* name, const char* labels, double value);
+
+//
+// Writes the bucket, sum and count samples of a histogram
+// that is kept elsewhere. scale converts the values (like
+// 1e-9 for nanoseconds to seconds), labels may be NULL.
+//
+void MetricsWriteHistogram(MetricsWriter writer, const char* name, const char* labels, const Histogram* histogram, double scale);
+
+//
+// Returns all metrics in the Prometheus text exposition
+// format. The string has to be freed.
+//
+char* MetricsCopyPrometheusText(void);
+
+#endif /* _METRICS_H_ */
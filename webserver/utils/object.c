@@ -21,14 +21,30 @@
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "object.h"
+#include "probes.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <Block_private.h>
-#include <string.h>
 
-static const char* kObjectMagic = "OBJ ";
-static const char* kZombieObjectMagic = "ZOMB";
+// "OBJ ", "OBJC" and "ZOMB" read as big endian
+static const uint32_t kObjectMagic = 0x4f424a20;
+static const uint32_t kConfinedObjectMagic = 0x4f424a43;
+static const uint32_t kZombieObjectMagic = 0x5a4f4d42;
+
+//
+// The peak of a class is checked whenever a shard
+// counted this many allocations
+//
+#define kObjectClassPeakInterval 64
+
+static ObjectClass ObjectClasses;
+static uint32_t ObjectNextShard;
+static __thread uint32_t ObjectShard;
+
+static struct _ObjectClassShard* ObjectClassGetShard(ObjectClass objectClass);
+static int64_t ObjectClassGetLive(ObjectClass objectClass);
+static void ObjectClassUpdatePeak(ObjectClass objectClass, int64_t live);
 
 bool ObjectRuntimeInit()
 {
@@ -37,7 +53,7 @@ bool ObjectRuntimeInit()
 	return true;
 }
 
-bool ObjectInit(void* _obj, void (*Dealloc)(void* ptr))
+bool ObjectInit(void* _obj, ObjectClass objectClass, void (*Dealloc)(void* ptr))
 {
 	assert(_obj != NULL);
 	
@@ -45,19 +61,94 @@ bool ObjectInit(void* _obj, void (*Dealloc)(void* ptr))
 	
 	obj->retainCount = 1;
 	obj->Dealloc = Dealloc;
-	memcpy(obj->magic, kObjectMagic, 4);
+	obj->objectClass = objectClass;
+	obj->magic = kObjectMagic;
+	
+	if (objectClass)
+		ObjectClassCount(objectClass, 1);
 	
 	return true;
 }
 
+void ObjectClassCount(ObjectClass objectClass, uint64_t count)
+{
+	struct _ObjectClassShard* shard = ObjectClassGetShard(objectClass);
+	uint64_t allocations;
+	
+	__atomic_fetch_add(&shard->live, (int64_t)count, __ATOMIC_RELAXED);
+	allocations = __atomic_add_fetch(&shard->allocations, count, __ATOMIC_RELAXED);
+	
+	// Crossed a multiple of the interval
+	if (allocations / kObjectClassPeakInterval != (allocations - count) / kObjectClassPeakInterval)
+		ObjectClassUpdatePeak(objectClass, ObjectClassGetLive(objectClass));
+}
+
+void ObjectClassUncount(ObjectClass objectClass, uint64_t count)
+{
+	__atomic_fetch_sub(&ObjectClassGetShard(objectClass)->live, (int64_t)count, __ATOMIC_RELAXED);
+}
+
+void ObjectClassRegister(ObjectClass objectClass)
+{
+	ObjectClass head;
+	
+	do {
+		head = __atomic_load_n(&ObjectClasses, __ATOMIC_ACQUIRE);
+		objectClass->next = head;
+	} while (!__sync_bool_compare_and_swap(&ObjectClasses, head, objectClass));
+}
+
+uint32_t ObjectCopyClassStats(ObjectClassStats* stats, uint32_t max)
+{
+	uint32_t count = 0;
+	
+	for (ObjectClass objectClass = __atomic_load_n(&ObjectClasses, __ATOMIC_ACQUIRE); objectClass != NULL && count < max; objectClass = objectClass->next) {
+		ObjectClassStats* classStats = &stats[count++];
+		
+		classStats->name = objectClass->name;
+		classStats->size = objectClass->size;
+		classStats->live = ObjectClassGetLive(objectClass);
+		classStats->allocations = 0;
+		
+		for (uint32_t i = 0; i < kObjectClassShards; i++)
+			classStats->allocations += __atomic_load_n(&objectClass->shards[i].allocations, __ATOMIC_RELAXED);
+		
+		ObjectClassUpdatePeak(objectClass, classStats->live);
+		classStats->peak = __atomic_load_n(&objectClass->peak, __ATOMIC_RELAXED);
+	}
+	
+	return count;
+}
+
+void ObjectSetConfined(void* _obj)
+{
+	assert(_obj != NULL);
+	
+	Object obj = _obj;
+	
+	assert(obj->magic == kObjectMagic);
+	assert(obj->retainCount == 1);
+	
+#ifndef NO_CONFINED
+	obj->magic = kConfinedObjectMagic;
+#endif
+}
+
 Object _Retain(Object obj)
 {
 	if (obj == NULL)
 		return NULL;
 	
 	int rc;
-		
-	rc = __sync_add_and_fetch(&obj->retainCount, 1);
+	// Read before the increment like in _Release
+	void (*Dealloc)(void* ptr) = obj->Dealloc;
+	
+	if (obj->magic == kConfinedObjectMagic)
+		rc = ++obj->retainCount;
+	else {
+		assert(obj->magic == kObjectMagic);
+		rc = __sync_add_and_fetch(&obj->retainCount, 1);
+	}
 	
 	//
 	// The retaincount must be greater than 1 because
@@ -66,6 +157,10 @@ Object _Retain(Object obj)
 	//
 	assert(rc > 1);
 	
+	// The dealloc function tells the class apart,
+	// filter on usym(arg2) to follow one class
+	PROBE3(object__retain, obj, rc, Dealloc);
+	
 	return obj;
 }
 
@@ -75,18 +170,62 @@ void _Release(Object obj)
 		return;
 		
 	int rc;
+	// Once we dropped our reference another thread may
+	// free obj, the probe must not read from it
+	void (*Dealloc)(void* ptr) = obj->Dealloc;
 	
-	assert(memcmp(obj->magic, kObjectMagic, 4) == 0);
-	
-	rc = __sync_sub_and_fetch(&obj->retainCount, 1);
+	if (obj->magic == kConfinedObjectMagic)
+		rc = --obj->retainCount;
+	else {
+		assert(obj->magic == kObjectMagic);
+		rc = __sync_sub_and_fetch(&obj->retainCount, 1);
+	}
 		
 	//
 	// < 0 Would mean double free
 	//
 	assert(rc >= 0);
 	
-	if (rc == 0 && obj->Dealloc) {
-		memcpy(obj->magic, kZombieObjectMagic, 4);
-		obj->Dealloc(obj);
+	PROBE3(object__release, obj, rc, Dealloc);
+	
+	if (rc == 0 && obj->objectClass)
+		ObjectClassUncount(obj->objectClass, 1);
+	
+	if (rc == 0 && Dealloc) {
+		obj->magic = kZombieObjectMagic;
+		Dealloc(obj);
+	}
+}
+
+static struct _ObjectClassShard* ObjectClassGetShard(ObjectClass objectClass)
+{
+	// 0 means no shard assigned yet
+	if (ObjectShard == 0)
+		ObjectShard = __sync_add_and_fetch(&ObjectNextShard, 1);
+	
+	return &objectClass->shards[ObjectShard % kObjectClassShards];
+}
+
+//
+// The sum over all shards, a single shard goes negative
+// when objects die on another thread than they were born
+//
+static int64_t ObjectClassGetLive(ObjectClass objectClass)
+{
+	int64_t live = 0;
+	
+	for (uint32_t i = 0; i < kObjectClassShards; i++)
+		live += __atomic_load_n(&objectClass->shards[i].live, __ATOMIC_RELAXED);
+	
+	return live;
+}
+
+static void ObjectClassUpdatePeak(ObjectClass objectClass, int64_t live)
+{
+	int64_t peak = __atomic_load_n(&objectClass->peak, __ATOMIC_RELAXED);
+	
+	while (live > peak) {
+		if (__atomic_compare_exchange_n(&objectClass->peak, &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
 	}
 }
@@ -24,6 +24,59 @@
 #define _OBJECT_H_
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Number of shards of the counters of a class, threads
+// beyond that share shards (updates stay atomic)
+//
+#define kObjectClassShards 16
+
+struct _ObjectClassShard {
+	int64_t live;
+	uint64_t allocations;
+} __attribute__((aligned(64)));
+
+//
+// Describes a class defined with DEFINE_CLASS and counts
+// its objects. Internal, use ObjectCopyClassStats.
+//
+struct _ObjectClass {
+	const char* name;
+	size_t size;
+	int64_t peak;
+	struct _ObjectClass* next;
+	struct _ObjectClassShard shards[kObjectClassShards];
+};
+
+typedef struct _ObjectClass* ObjectClass;
+
+//
+// Counters of one class
+//
+typedef struct {
+	const char* name;
+	
+	//
+	// sizeof the object structure
+	//
+	size_t size;
+	
+	//
+	// Objects alive right now and the most that were
+	// alive at once. The peak is only checked every
+	// few allocations, so short spikes may be missed.
+	//
+	int64_t live;
+	int64_t peak;
+	
+	//
+	// Objects ever created, times size are the
+	// allocated bytes
+	//
+	uint64_t allocations;
+} ObjectClassStats;
 
 //
 // Internal opaque object structure. Do NOT use
@@ -31,9 +84,10 @@
 //
 struct _Object {
 	//
-	// A magic to look if its really an object
+	// A magic to look if its really an object. Confined
+	// objects use a magic of their own.
 	//
-	char magic[4];
+	uint32_t magic;
 	
 	//
 	// Count how many objects hold a reference to this
@@ -44,6 +98,11 @@ struct _Object {
 	// Is called when retain Count reaches zero
 	//
 	void (*Dealloc)(void* ptr);
+	
+	//
+	// The class the object is counted for (may be NULL)
+	//
+	ObjectClass objectClass;
 };
 
 //
@@ -54,13 +113,27 @@ struct _Object {
 
 //
 // Call this (usually in the implementation) to define your
-// class and this member variables
+// class and this member variables. It also defines the class
+// descriptor A##Class, which is registered before main runs.
+// Pass it to ObjectInit.
 //
 #define DEFINE_CLASS(A, x)\
 struct _##A {\
 	struct _Object object;\
 	x\
-}
+};\
+DEFINE_ALLOCATION_CLASS(A, sizeof(struct _##A))
+
+//
+// Defines and registers the descriptor A##Class for internal
+// allocations of size bytes that are no objects (like the
+// nodes of a container). Count them with ObjectClassCount
+// and ObjectClassUncount.
+//
+#define DEFINE_ALLOCATION_CLASS(A, s)\
+static struct _ObjectClass A##Class = { .name = #A, .size = (s) };\
+__attribute__((constructor)) static void _##A##ClassRegister(void) { ObjectClassRegister(&A##Class); }\
+static struct _ObjectClass A##Class
 
 //
 // Some helper methods to declare ownership, so
@@ -94,9 +167,46 @@ bool ObjectRuntimeInit();
 
 //
 // Call this at the beginning of the object creation
-// it will set the retaincount to 1.
+// it will set the retaincount to 1. The object is counted
+// as an object of objectClass (like &FooClass) until it
+// is deallocated.
+//
+bool ObjectInit(void* object, ObjectClass objectClass, void (*Dealloc)(void* ptr));
+
+//
+// Counts count allocations of objectClass as created or
+// freed. Objects are counted by ObjectInit and their last
+// Release, this is for allocations of a class defined with
+// DEFINE_ALLOCATION_CLASS.
+//
+void ObjectClassCount(ObjectClass objectClass, uint64_t count);
+void ObjectClassUncount(ObjectClass objectClass, uint64_t count);
+
+//
+// Adds a class to the ones ObjectCopyClassStats reports,
+// DEFINE_CLASS does this
+//
+void ObjectClassRegister(ObjectClass objectClass);
+
+//
+// Copies the counters of up to max registered classes and
+// returns the number of copied classes
+//
+uint32_t ObjectCopyClassStats(ObjectClassStats* stats, uint32_t max);
+
+//
+// Marks the object as confined: it is only retained and released
+// by one thread at a time, and handing it to another thread goes
+// through a lock (e.g. a dispatch queue). Retain and Release
+// then use plain increments instead of locked instructions.
+//
+// Typical candidates are objects that never leave the fiber of
+// a connection. Call this right after creation, before anybody
+// else holds a reference.
+//
+// Does nothing in builds with NO_CONFINED.
 //
-bool ObjectInit(void* object, void (*Dealloc)(void* ptr));
+void ObjectSetConfined(void* object);
 
 //
 // Increases the retain count by 1.
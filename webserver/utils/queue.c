@@ -22,6 +22,7 @@
 
 #include "queue.h"
 #include "helper.h"
+#include "slab.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -35,6 +36,11 @@
 //
 // dequeue and queue borrowed from http://www.cs.rochester.edu/research/synchronization/pseudocode/queues.html
 //
+// Drains are serialized with a head lock (like in the two-lock queue of
+// the same paper). We free dequeued nodes and have no counted pointers,
+// so concurrent drains would otherwise run into ABA on head. Enqueues
+// stay lock free.
+//
 
 struct _QueueElement {
 	void* element;
@@ -46,30 +52,33 @@ struct _QueueElement {
 DEFINE_CLASS(Queue,
 	struct _QueueElement* head;
 	struct _QueueElement* tail;
+	
+	pthread_mutex_t headLock;
 );
 
+DEFINE_SLAB(Queue, sizeof(struct _Queue));
+DEFINE_SLAB(QueueElement, sizeof(struct _QueueElement));
+
 Queue QueueCreate() {
-	Queue queue = malloc(sizeof(struct _Queue));
+	Queue queue = SlabAlloc(QueueSlab);
 	
 	if (queue == NULL) {
-		perror("malloc");
+		perror("SlabAlloc");
 		return NULL;
 	}
 	
-	memset(queue, 0, sizeof(struct _Queue));
+	ObjectInit(queue, &QueueClass, (void (*)(void *))QueueDestroy);
 	
-	ObjectInit(queue, (void (*)(void *))QueueDestroy);
+	pthread_mutex_init(&queue->headLock, NULL);
 	
-	struct _QueueElement* node = malloc(sizeof(struct _QueueElement));
+	struct _QueueElement* node = SlabAlloc(QueueElementSlab);
 	
 	if (node == NULL) {
-		perror("malloc");
+		perror("SlabAlloc");
 		Release(queue);
 		return NULL;
 	}
 	
-	memset(node, 0, sizeof(struct _QueueElement));
-	
 	queue->head = node;
 	queue->tail = node;
 	
@@ -81,24 +90,23 @@ void QueueDestroy(Queue queue) {
 	while (element != NULL) {
 		struct _QueueElement* old = element;
 		element = old->next;
-		free(old);
+		SlabFree(QueueElementSlab, old);
 	}
 	
-	free(queue);
+	pthread_mutex_destroy(&queue->headLock);
+	SlabFree(QueueSlab, queue);
 }
 
-void QueueEnqueue(Queue queue, void* e) {
-	struct _QueueElement* node = malloc(sizeof(struct _QueueElement));
+bool QueueEnqueue(Queue queue, void* e) {
+	struct _QueueElement* node = SlabAlloc(QueueElementSlab);
 	struct _QueueElement* tail;
 	struct _QueueElement* next;
 	
 	if (node == NULL) {
-		perror("malloc");
-		return;
+		perror("SlabAlloc");
+		return false;
 	}
 	
-	memset(node, 0, sizeof(struct _QueueElement));
-	
 	node->element = e;
 	node->dequeued = false;
 	
@@ -122,6 +130,8 @@ void QueueEnqueue(Queue queue, void* e) {
 	
 	// Enqueue is done.  Try to swing Tail to the inserted node
 	__sync_bool_compare_and_swap(&queue->tail, tail, node);
+	
+	return true;
 }
 
 void* QueueDrain(Queue queue)
@@ -131,14 +141,18 @@ void* QueueDrain(Queue queue)
 	struct _QueueElement* head;
 	struct _QueueElement* next;
 	
+	pthread_mutex_lock(&queue->headLock);
+	
 	while (1) { // Keep trying until Dequeue is done
 		head = queue->head; // Read Head
 		tail = queue->tail; // Read Tail
 		next = head->next;
 		if (head == queue->head) { // Are head, tail, and next consistent?
 			if (head == tail) { // Is queue empty or Tail falling behind?
-				if (next == NULL) // Is queue empty?
+				if (next == NULL) { // Is queue empty?
+					pthread_mutex_unlock(&queue->headLock);
 					return NULL; // Queue is empty, couldn't dequeue
+				}
 				
 				// Tail is falling behind.  Try to advance it
 				__sync_bool_compare_and_swap(&queue->tail, tail, next);
@@ -155,6 +169,126 @@ void* QueueDrain(Queue queue)
 	}
 	assert(next->dequeued == false);
 	next->dequeued = true;
-	free(head);
+	pthread_mutex_unlock(&queue->headLock);
+	SlabFree(QueueElementSlab, head);
 	return element;
 }
+
+uint32_t QueueEnqueueBatch(Queue queue, void** elements, uint32_t count)
+{
+	struct _QueueElement* first = NULL;
+	struct _QueueElement* last = NULL;
+	struct _QueueElement* tail;
+	struct _QueueElement* next;
+	uint32_t linked = 0;
+	
+	// Link the nodes together first, so we only
+	// need to splice the whole chain in
+	for (; linked < count; linked++) {
+		struct _QueueElement* node = SlabAlloc(QueueElementSlab);
+		
+		if (node == NULL) {
+			perror("SlabAlloc");
+			break;
+		}
+		
+		node->element = elements[linked];
+		node->dequeued = false;
+		
+		if (last)
+			last->next = node;
+		else
+			first = node;
+		last = node;
+	}
+	
+	if (first == NULL)
+		return 0;
+	
+	while(1) {
+		tail = queue->tail;
+		next = tail->next;
+		if (tail == queue->tail) {
+			if (next == NULL) {
+				if (__sync_bool_compare_and_swap(&tail->next, next, first)) {
+					break;
+				}
+			}
+			else {
+				__sync_bool_compare_and_swap(&queue->tail, tail, next);
+			}
+		}
+	}
+	
+	// If this fails somebody else is already helping
+	// to move the tail along our chain
+	__sync_bool_compare_and_swap(&queue->tail, tail, last);
+	
+	return linked;
+}
+
+uint32_t QueueDrainBatch(Queue queue, void** elements, uint32_t max)
+{
+	struct _QueueElement* tail;
+	struct _QueueElement* head;
+	struct _QueueElement* next;
+	struct _QueueElement* last;
+	uint32_t count;
+	
+	if (max == 0)
+		return 0;
+	
+	pthread_mutex_lock(&queue->headLock);
+	
+	while (1) {
+		head = queue->head;
+		tail = queue->tail;
+		next = head->next;
+		if (head == queue->head) {
+			if (head == tail) {
+				if (next == NULL) {
+					pthread_mutex_unlock(&queue->headLock);
+					return 0;
+				}
+				
+				__sync_bool_compare_and_swap(&queue->tail, tail, next);
+			}
+			else {
+				// Collect the values before the CAS like the single
+				// drain does. Never walk past tail, otherwise
+				// tail could point to a freed node.
+				last = next;
+				elements[0] = last->element;
+				count = 1;
+				
+				while (count < max && last != tail && last->next != NULL) {
+					last = last->next;
+					elements[count++] = last->element;
+				}
+				
+				if (__sync_bool_compare_and_swap(&queue->head, head, last))
+					break;
+			}
+		}
+	}
+	
+	// The old head and all nodes up to (excluding) last are ours now,
+	// last is the new dummy head
+	next = head;
+	do {
+		next = next->next;
+		assert(next->dequeued == false);
+		next->dequeued = true;
+	} while (next != last);
+	
+	pthread_mutex_unlock(&queue->headLock);
+	
+	while (head != last) {
+		struct _QueueElement* old = head;
+		
+		head = head->next;
+		SlabFree(QueueElementSlab, old);
+	}
+	
+	return count;
+}
@@ -25,6 +25,8 @@
 
 #include "utils/object.h"
 
+#include <stdint.h>
+
 DECLARE_CLASS(Queue);
 
 //
@@ -46,11 +48,30 @@ void QueueDestroy(Queue queue);
 // Note: this may block in order to enqueue.
 // However the block should be minor.
 //
-void QueueEnqueue(Queue queue, void* element);
+// Returns false when no node could be allocated.
+//
+bool QueueEnqueue(Queue queue, void* element);
 
 //
 // Drain a element from the queue.
 //
 void* QueueDrain(Queue queue);
 
+//
+// Enqueue count elements at once. They are linked
+// together beforehand and appended with one atomic splice.
+//
+// Returns the number of enqueued elements, which is less
+// than count when nodes could not be allocated. Those
+// are the first ones of elements.
+//
+uint32_t QueueEnqueueBatch(Queue queue, void** elements, uint32_t count);
+
+//
+// Drain up to max elements at once with one atomic splice.
+//
+// Returns the number of drained elements.
+//
+uint32_t QueueDrainBatch(Queue queue, void** elements, uint32_t max);
+
 #endif
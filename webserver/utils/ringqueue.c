@@ -0,0 +1,406 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "ringqueue.h"
+#include "queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <sched.h>
+#include <assert.h>
+
+//
+// Bounded queue as described by Dmitry Vyukov
+// http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+//
+// Every slot carries a sequence number which tells producers
+// and consumers in which lap the slot is. Producers and consumers
+// only contend on their own position, which live on different
+// cache lines.
+//
+
+#define kRingQueueCacheLineSize 64
+
+struct _RingQueueSlot {
+	size_t sequence;
+	void* element;
+};
+
+DEFINE_CLASS(RingQueue,
+	struct _RingQueueSlot* slots;
+	size_t mask;
+	
+	RingQueueOverflowPolicy policy;
+	
+	//
+	// Only used by kRingQueueOverflowSpill
+	//
+	Queue spillQueue;
+	uint32_t spilled;
+	
+	char padding0[kRingQueueCacheLineSize];
+	size_t enqueuePosition;
+	char padding1[kRingQueueCacheLineSize - sizeof(size_t)];
+	size_t dequeuePosition;
+	char padding2[kRingQueueCacheLineSize - sizeof(size_t)];
+);
+
+static void RingQueueDealloc(void* ptr);
+static bool RingQueueSpill(RingQueue queue, void* element);
+static void* RingQueueDrainSpill(RingQueue queue);
+
+RingQueue RingQueueCreate(uint32_t capacity, RingQueueOverflowPolicy policy)
+{
+	RingQueue queue;
+	size_t size = 2;
+	
+	// Keep the positions on their own cache lines
+	if (posix_memalign((void**)&queue, kRingQueueCacheLineSize, sizeof(struct _RingQueue)) != 0) {
+		perror("posix_memalign");
+		return NULL;
+	}
+	
+	memset(queue, 0, sizeof(struct _RingQueue));
+	
+	ObjectInit(queue, &RingQueueClass, RingQueueDealloc);
+	
+	while (size < capacity)
+		size *= 2;
+	
+	queue->mask = size - 1;
+	queue->policy = policy;
+	
+	queue->slots = malloc(sizeof(struct _RingQueueSlot) * size);
+	
+	if (queue->slots == NULL) {
+		perror("malloc");
+		Release(queue);
+		return NULL;
+	}
+	
+	for (size_t i = 0; i < size; i++) {
+		queue->slots[i].sequence = i;
+		queue->slots[i].element = NULL;
+	}
+	
+	if (policy == kRingQueueOverflowSpill) {
+		queue->spillQueue = QueueCreate();
+		
+		if (queue->spillQueue == NULL) {
+			printf("Could not create spill queue.\n");
+			Release(queue);
+			return NULL;
+		}
+	}
+	
+	return queue;
+}
+
+static void RingQueueDealloc(void* ptr)
+{
+	RingQueue queue = ptr;
+	
+	if (queue->spillQueue)
+		Release(queue->spillQueue);
+	
+	if (queue->slots)
+		free(queue->slots);
+	
+	free(queue);
+}
+
+bool RingQueueTryEnqueue(RingQueue queue, void* element)
+{
+	struct _RingQueueSlot* slot;
+	size_t position = __atomic_load_n(&queue->enqueuePosition, __ATOMIC_RELAXED);
+	
+	for (;;) {
+		slot = &queue->slots[position & queue->mask];
+		size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+		
+		// Slot is free in this lap, try to claim it
+		if (diff == 0) {
+			if (__sync_bool_compare_and_swap(&queue->enqueuePosition, position, position + 1))
+				break;
+		}
+		// Slot still holds an element of the last lap, we're full
+		else if (diff < 0) {
+			return false;
+		}
+		
+		// Somebody else was faster
+		position = __atomic_load_n(&queue->enqueuePosition, __ATOMIC_RELAXED);
+	}
+	
+	slot->element = element;
+	__atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+	
+	return true;
+}
+
+void* RingQueueTryDrain(RingQueue queue)
+{
+	struct _RingQueueSlot* slot;
+	size_t position = __atomic_load_n(&queue->dequeuePosition, __ATOMIC_RELAXED);
+	void* element;
+	
+	for (;;) {
+		slot = &queue->slots[position & queue->mask];
+		size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)(position + 1);
+		
+		// Slot is filled in this lap, try to claim it
+		if (diff == 0) {
+			if (__sync_bool_compare_and_swap(&queue->dequeuePosition, position, position + 1))
+				break;
+		}
+		// Slot was not filled yet, we're empty
+		else if (diff < 0) {
+			return NULL;
+		}
+		
+		position = __atomic_load_n(&queue->dequeuePosition, __ATOMIC_RELAXED);
+	}
+	
+	element = slot->element;
+	slot->element = NULL;
+	// Free the slot for the next lap
+	__atomic_store_n(&slot->sequence, position + queue->mask + 1, __ATOMIC_RELEASE);
+	
+	return element;
+}
+
+bool RingQueueEnqueue(RingQueue queue, void* element)
+{
+	assert(element != NULL);
+	
+	// As long as there are spilled elements we must
+	// go to the spill too, otherwise we would overtake them
+	if (queue->policy == kRingQueueOverflowSpill && __atomic_load_n(&queue->spilled, __ATOMIC_ACQUIRE) > 0)
+		return RingQueueSpill(queue, element);
+	
+	while (!RingQueueTryEnqueue(queue, element)) {
+		switch (queue->policy) {
+		case kRingQueueOverflowFail:
+			return false;
+		case kRingQueueOverflowWait:
+			sched_yield();
+			break;
+		case kRingQueueOverflowSpill:
+			return RingQueueSpill(queue, element);
+		}
+	}
+	
+	return true;
+}
+
+void* RingQueueDrain(RingQueue queue)
+{
+	void* element = RingQueueTryDrain(queue);
+	
+	if (element == NULL)
+		element = RingQueueDrainSpill(queue);
+	
+	return element;
+}
+
+uint32_t RingQueueEnqueueBatch(RingQueue queue, void** elements, uint32_t count)
+{
+	uint32_t claimed = 0;
+	size_t position;
+	
+	if (count == 0)
+		return 0;
+	
+	if (queue->policy != kRingQueueOverflowSpill || __atomic_load_n(&queue->spilled, __ATOMIC_ACQUIRE) == 0) {
+		position = __atomic_load_n(&queue->enqueuePosition, __ATOMIC_RELAXED);
+		
+		for (;;) {
+			claimed = 0;
+			
+			// Look how many slots in a row are free in this lap
+			while (claimed < count) {
+				struct _RingQueueSlot* slot = &queue->slots[(position + claimed) & queue->mask];
+				size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+				
+				if ((intptr_t)sequence - (intptr_t)(position + claimed) != 0)
+					break;
+				
+				claimed++;
+			}
+			
+			if (claimed == 0) {
+				struct _RingQueueSlot* slot = &queue->slots[position & queue->mask];
+				size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+				
+				// Full
+				if ((intptr_t)sequence - (intptr_t)position < 0)
+					break;
+			}
+			// Claim them all at once
+			else if (__sync_bool_compare_and_swap(&queue->enqueuePosition, position, position + claimed)) {
+				for (uint32_t i = 0; i < claimed; i++) {
+					struct _RingQueueSlot* slot = &queue->slots[(position + i) & queue->mask];
+					
+					slot->element = elements[i];
+					__atomic_store_n(&slot->sequence, position + i + 1, __ATOMIC_RELEASE);
+				}
+				break;
+			}
+			
+			position = __atomic_load_n(&queue->enqueuePosition, __ATOMIC_RELAXED);
+		}
+	}
+	
+	// Everything that did not fit goes through the overflow policy
+	if (claimed < count && queue->policy == kRingQueueOverflowSpill) {
+		uint32_t spilled;
+		
+		// Account before enqueuing like RingQueueSpill and
+		// take back what could not be enqueued, otherwise
+		// consumers would look for elements that never come
+		__sync_add_and_fetch(&queue->spilled, count - claimed);
+		spilled = QueueEnqueueBatch(queue->spillQueue, elements + claimed, count - claimed);
+		
+		if (spilled < count - claimed)
+			__sync_sub_and_fetch(&queue->spilled, count - claimed - spilled);
+		
+		return claimed + spilled;
+	}
+	
+	for (uint32_t i = claimed; i < count; i++) {
+		if (!RingQueueEnqueue(queue, elements[i]))
+			return i;
+	}
+	
+	return count;
+}
+
+uint32_t RingQueueDrainBatch(RingQueue queue, void** elements, uint32_t max)
+{
+	uint32_t claimed = 0;
+	size_t position = __atomic_load_n(&queue->dequeuePosition, __ATOMIC_RELAXED);
+	
+	if (max == 0)
+		return 0;
+	
+	for (;;) {
+		claimed = 0;
+		
+		// Look how many slots in a row are filled in this lap
+		while (claimed < max) {
+			struct _RingQueueSlot* slot = &queue->slots[(position + claimed) & queue->mask];
+			size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+			
+			if ((intptr_t)sequence - (intptr_t)(position + claimed + 1) != 0)
+				break;
+			
+			claimed++;
+		}
+		
+		if (claimed == 0) {
+			struct _RingQueueSlot* slot = &queue->slots[position & queue->mask];
+			size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+			
+			// Empty
+			if ((intptr_t)sequence - (intptr_t)(position + 1) < 0)
+				break;
+		}
+		// Claim them all at once
+		else if (__sync_bool_compare_and_swap(&queue->dequeuePosition, position, position + claimed)) {
+			for (uint32_t i = 0; i < claimed; i++) {
+				struct _RingQueueSlot* slot = &queue->slots[(position + i) & queue->mask];
+				
+				elements[i] = slot->element;
+				slot->element = NULL;
+				__atomic_store_n(&slot->sequence, position + i + queue->mask + 1, __ATOMIC_RELEASE);
+			}
+			break;
+		}
+		
+		position = __atomic_load_n(&queue->dequeuePosition, __ATOMIC_RELAXED);
+	}
+	
+	// Fill up with spilled elements
+	if (claimed < max && queue->spillQueue && __atomic_load_n(&queue->spilled, __ATOMIC_ACQUIRE) > 0) {
+		uint32_t spilled = QueueDrainBatch(queue->spillQueue, elements + claimed, max - claimed);
+		
+		__sync_sub_and_fetch(&queue->spilled, spilled);
+		claimed += spilled;
+	}
+	
+	return claimed;
+}
+
+uint32_t RingQueueGetCount(RingQueue queue)
+{
+	size_t dequeuePosition = __atomic_load_n(&queue->dequeuePosition, __ATOMIC_RELAXED);
+	size_t enqueuePosition = __atomic_load_n(&queue->enqueuePosition, __ATOMIC_RELAXED);
+	size_t count = 0;
+	
+	// Both are read independently, so they may be
+	// slightly off
+	if (enqueuePosition > dequeuePosition)
+		count = enqueuePosition - dequeuePosition;
+	
+	if (count > queue->mask + 1)
+		count = queue->mask + 1;
+	
+	return (uint32_t)count + __atomic_load_n(&queue->spilled, __ATOMIC_RELAXED);
+}
+
+uint32_t RingQueueGetCapacity(RingQueue queue)
+{
+	return (uint32_t)(queue->mask + 1);
+}
+
+static bool RingQueueSpill(RingQueue queue, void* element)
+{
+	// Account before enqueuing, so that producers
+	// after us see that there is a spill
+	__sync_add_and_fetch(&queue->spilled, 1);
+	
+	if (!QueueEnqueue(queue->spillQueue, element)) {
+		__sync_sub_and_fetch(&queue->spilled, 1);
+		return false;
+	}
+	
+	return true;
+}
+
+static void* RingQueueDrainSpill(RingQueue queue)
+{
+	void* element;
+	
+	if (queue->spillQueue == NULL || __atomic_load_n(&queue->spilled, __ATOMIC_ACQUIRE) == 0)
+		return NULL;
+	
+	element = QueueDrain(queue->spillQueue);
+	
+	if (element)
+		__sync_sub_and_fetch(&queue->spilled, 1);
+	
+	return element;
+}
@@ -0,0 +1,118 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _RING_QUEUE_H_
+#define _RING_QUEUE_H_
+
+#include "utils/object.h"
+
+#include <stdint.h>
+
+DECLARE_CLASS(RingQueue);
+
+typedef enum {
+	//
+	// Enqueueing into a full queue fails
+	//
+	kRingQueueOverflowFail,
+	
+	//
+	// Enqueueing into a full queue yields until
+	// a consumer made room.
+	//
+	// Note: never use this when the enqueueing thread
+	// is also the only consumer.
+	//
+	kRingQueueOverflowWait,
+	
+	//
+	// Elements that do not fit are spilled into
+	// an unbounded linked queue. Consumers drain the
+	// ring first and the spill afterwards, so the order
+	// of a single producer is kept.
+	//
+	kRingQueueOverflowSpill
+} RingQueueOverflowPolicy;
+
+//
+// Creates a new bounded multi producer/multi consumer
+// FIFO queue with room for at least capacity elements.
+// (The capacity is rounded up to the next power of two)
+//
+OBJECT_RETURNS_RETAINED
+RingQueue RingQueueCreate(uint32_t capacity, RingQueueOverflowPolicy policy);
+
+//
+// Tries to enqueue an element, returns false
+// if the ring is full. The overflow policy is not
+// considered.
+//
+bool RingQueueTryEnqueue(RingQueue queue, void* element);
+
+//
+// Tries to drain an element, returns NULL if the
+// ring is empty. Spilled elements are not considered.
+//
+void* RingQueueTryDrain(RingQueue queue);
+
+//
+// Enqueues an element with respect to the overflow policy.
+//
+// Returns false when the element could not be enqueued.
+//
+bool RingQueueEnqueue(RingQueue queue, void* element);
+
+//
+// Drains an element, including spilled ones.
+//
+void* RingQueueDrain(RingQueue queue);
+
+//
+// Enqueues up to count elements with one atomic
+// operation. Elements which do not fit in the
+// ring are handled by the overflow policy.
+//
+// Returns the number of enqueued elements. The ones
+// behind them were not enqueued and still belong
+// to the caller.
+//
+uint32_t RingQueueEnqueueBatch(RingQueue queue, void** elements, uint32_t count);
+
+//
+// Drains up to max elements into elements.
+//
+// Returns the number of drained elements.
+//
+uint32_t RingQueueDrainBatch(RingQueue queue, void** elements, uint32_t max);
+
+//
+// Returns the (approximate) number of elements in
+// the queue, including spilled ones.
+//
+uint32_t RingQueueGetCount(RingQueue queue);
+
+//
+// Returns the number of slots in the ring
+//
+uint32_t RingQueueGetCapacity(RingQueue queue);
+
+#endif /* _RING_QUEUE_H_ */
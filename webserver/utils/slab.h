@@ -0,0 +1,99 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+//
+// Allocator for objects of one size. Every thread keeps
+// a few freed objects at hand (in magazines), so allocating
+// and freeing usually takes neither a lock nor the system
+// allocator. Threads exchange full and empty magazines
+// through a global depot.
+//
+// Memory of a slab is never given back to the system.
+//
+typedef struct _Slab* Slab;
+
+typedef struct {
+	const char* name;
+	size_t objectSize;
+	
+	//
+	// Objects currently allocated and the highest
+	// number of them any SlabCopyStats saw
+	//
+	uint64_t live;
+	uint64_t peak;
+	
+	//
+	// Allocations and frees since the slab was created.
+	// The allocation rate is the difference of two
+	// snapshots over the time between them.
+	//
+	uint64_t allocations;
+	uint64_t frees;
+} SlabStats;
+
+//
+// Defines the static slab name##Slab for objects of size
+// which is created before main runs. Use it like
+// DEFINE_SLAB(Foo, sizeof(struct _Foo));
+//
+#define DEFINE_SLAB(name, size)\
+static Slab name##Slab;\
+__attribute__((constructor)) static void _##name##SlabInit(void) { name##Slab = SlabCreate(#name, size); }\
+static Slab name##Slab
+
+//
+// Creates a new slab for objects of size bytes. The name
+// is used for the stats and must stay valid.
+//
+// Slabs live as long as the process.
+//
+Slab SlabCreate(const char* name, size_t size);
+
+//
+// Returns a zeroed object or NULL if no memory is left
+//
+void* SlabAlloc(Slab slab);
+
+//
+// Gives an object back to the slab it was allocated from
+//
+void SlabFree(Slab slab, void* object);
+
+//
+// Copies the stats of up to max slabs and returns the
+// number of copied stats.
+//
+// Every thread counts its allocations and frees, and this
+// adds up the counts of all threads. Operations that run
+// concurrently may be missing, but nothing stays behind.
+// Peaks between two calls are not seen.
+//
+uint32_t SlabCopyStats(SlabStats* stats, uint32_t max);
+
+#endif /* _SLAB_H_ */
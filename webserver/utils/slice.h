@@ -0,0 +1,109 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _SLICE_H_
+#define _SLICE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// A piece of a string which carries its length, so it is never
+// rescanned. Slices do not own their data and need no \0.
+//
+typedef struct {
+	const char* data;
+	size_t length;
+} Slice;
+
+//
+// Returned by the find functions when there is no match
+//
+#define kSliceNotFound SIZE_MAX
+
+//
+// Creates a slice of length bytes at data
+//
+Slice SliceMake(const char* data, size_t length);
+
+//
+// Creates a slice of a \0 terminated string
+//
+Slice SliceFromString(const char* string);
+
+//
+// Returns the part of the slice after start
+//
+Slice SliceFrom(Slice slice, size_t start);
+
+//
+// Returns the first length bytes of the slice
+//
+Slice SliceTo(Slice slice, size_t length);
+
+//
+// Removes whitespace from the beginning and the end
+//
+Slice SliceTrim(Slice slice);
+
+//
+// Returns the index of the first c in the slice
+// or kSliceNotFound
+//
+size_t SliceFind(Slice slice, char c);
+
+//
+// Returns the index of the first occurrence of needle
+// in the slice or kSliceNotFound
+//
+size_t SliceFindSlice(Slice slice, Slice needle);
+
+//
+// Takes the next token up to delimiter from rest and advances
+// rest past it. Empty tokens are skipped (like strsep_ext).
+// Returns false when no token is left.
+//
+bool SliceNextToken(Slice* rest, char delimiter, Slice* token);
+
+//
+// Compares like strcmp
+//
+int SliceCompare(Slice a, Slice b);
+
+//
+// Returns true when the slice equals string
+//
+bool SliceEqualsString(Slice slice, const char* string);
+
+//
+// Returns true when both are equal ignoring the
+// case of ASCII letters
+//
+bool SliceEqualsCaseInsensitive(Slice a, Slice b);
+
+//
+// Returns a \0 terminated copy, to be freed
+//
+char* SliceCopy(Slice slice);
+
+#endif /* _SLICE_H_ */
@@ -30,17 +30,23 @@ char* strsep_ext(char** stringp, const char* delim) {
 	
 	do {
 		value = strsep(stringp, delim);
-	} while (value && strlen(value) == 0);
+	} while (value && value[0] == '\0');
 		
 	return value;
 }
 
 char* strtrim(char* string) {
-	while(isspace(*string)) 
+	char* end;
+	
+	while(isspace((unsigned char)*string)) 
 		string++;
 	
-	while(strlen(string) > 0 && isspace(string[strlen(string)]))
-		string[strlen(string)] = '\0';
+	end = string + strlen(string);
+	
+	while(end > string && isspace((unsigned char)end[-1]))
+		end--;
+	
+	*end = '\0';
 	
 	return string;
 }
@@ -0,0 +1,307 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "trace.h"
+
+#include "utils/helper.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+//
+// Events kept, must be a power of two
+//
+#define kTraceRingSize 65536
+
+//
+// Upper bound of the JSON of one event
+//
+#define kTraceEventJSONLength 256
+
+struct TraceSlot {
+	//
+	// Index + 1 of the event in the slot, 0 while
+	// it is written
+	//
+	uint64_t sequence;
+	
+	uint64_t id;
+	uint64_t time;
+	const char* name;
+	uint32_t thread;
+};
+
+struct TraceEntry {
+	uint64_t id;
+	uint64_t time;
+	const char* name;
+	uint32_t thread;
+};
+
+static uint32_t TraceSampling;
+static uint64_t TraceRequests;
+static uint64_t TraceHead;
+static struct TraceSlot TraceRing[kTraceRingSize];
+
+static uint32_t TraceNextThread;
+static __thread uint32_t TraceThread;
+
+static const char* TraceDumpPath;
+static int TraceSignalPipe[2] = { -1, -1 };
+
+static int TraceCompareEntries(const void* a, const void* b);
+static void TraceSignalHandler(int signal);
+static void* TraceDumpThread(void* context);
+
+void TraceSetSampling(uint32_t rate)
+{
+	__atomic_store_n(&TraceSampling, rate, __ATOMIC_RELAXED);
+}
+
+uint64_t TraceSample(void)
+{
+	uint32_t rate = __atomic_load_n(&TraceSampling, __ATOMIC_RELAXED);
+	uint64_t request;
+	
+	if (rate == 0)
+		return 0;
+	
+	request = __sync_add_and_fetch(&TraceRequests, 1);
+	
+	if (request % rate != 0)
+		return 0;
+	
+	return request;
+}
+
+void TraceEvent(uint64_t id, const char* name)
+{
+	struct TraceSlot* slot;
+	uint64_t index;
+	
+	if (id == 0)
+		return;
+	
+	if (TraceThread == 0)
+		TraceThread = __sync_add_and_fetch(&TraceNextThread, 1);
+	
+	index = __sync_fetch_and_add(&TraceHead, 1);
+	slot = &TraceRing[index & (kTraceRingSize - 1)];
+	
+	// Readers skip the slot until it is complete
+	__atomic_store_n(&slot->sequence, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	
+	slot->id = id;
+	slot->time = monotonicTime();
+	slot->name = name;
+	slot->thread = TraceThread;
+	
+	__atomic_store_n(&slot->sequence, index + 1, __ATOMIC_RELEASE);
+}
+
+char* TraceCopyChromeJSON(void)
+{
+	struct TraceEntry* entries = malloc(sizeof(struct TraceEntry) * kTraceRingSize);
+	size_t count = 0;
+	char* json;
+	size_t length = 0;
+	size_t capacity;
+	
+	if (entries == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+	
+	// Copy what is complete, writers keep going meanwhile
+	for (size_t i = 0; i < kTraceRingSize; i++) {
+		struct TraceSlot* slot = &TraceRing[i];
+		uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		struct TraceEntry* entry = &entries[count];
+		
+		if (sequence == 0)
+			continue;
+		
+		entry->id = slot->id;
+		entry->time = slot->time;
+		entry->name = slot->name;
+		entry->thread = slot->thread;
+		
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		
+		if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == sequence)
+			count++;
+	}
+	
+	qsort(entries, count, sizeof(struct TraceEntry), TraceCompareEntries);
+	
+	capacity = 64 + count * kTraceEventJSONLength;
+	json = malloc(capacity);
+	
+	if (json == NULL) {
+		perror("malloc");
+		free(entries);
+		return NULL;
+	}
+	
+	length += (size_t)snprintf(json + length, capacity - length, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	
+	for (size_t i = 0; i < count; i++) {
+		struct TraceEntry* entry = &entries[i];
+		struct TraceEntry* next = i + 1 < count && entries[i + 1].id == entry->id ? &entries[i + 1] : NULL;
+		int written;
+		
+		// Every stage is a slice from one event to the
+		// next, the last one is a mark. Timestamps are
+		// in microseconds.
+		if (next) {
+			written = snprintf(json + length, capacity - length,
+				"%s\n{\"name\":\"%s -> %s\",\"ph\":\"X\",\"pid\":1,\"tid\":%" PRIu64 ",\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"thread\":%u,\"next thread\":%u}}",
+				i > 0 ? "," : "", entry->name, next->name, entry->id,
+				(double)entry->time / 1000.0, (double)(next->time - entry->time) / 1000.0,
+				entry->thread, next->thread);
+		}
+		else {
+			written = snprintf(json + length, capacity - length,
+				"%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%" PRIu64 ",\"ts\":%.3f,\"args\":{\"thread\":%u}}",
+				i > 0 ? "," : "", entry->name, entry->id,
+				(double)entry->time / 1000.0, entry->thread);
+		}
+		
+		if (written < 0 || (size_t)written >= capacity - length)
+			break;
+		
+		length += (size_t)written;
+	}
+	
+	snprintf(json + length, capacity - length, "\n]}\n");
+	free(entries);
+	
+	return json;
+}
+
+bool TraceDumpOnSignal(const char* path)
+{
+	pthread_t thread;
+	
+	TraceDumpPath = path;
+	
+	if (pipe(TraceSignalPipe) < 0) {
+		perror("pipe");
+		return false;
+	}
+	
+	if (signal(SIGUSR1, TraceSignalHandler) == SIG_ERR) {
+		perror("signal");
+		return false;
+	}
+	
+	if (pthread_create(&thread, NULL, TraceDumpThread, NULL) != 0) {
+		perror("pthread_create");
+		return false;
+	}
+	
+	pthread_detach(thread);
+	
+	return true;
+}
+
+//
+// Orders by request, then by time
+//
+static int TraceCompareEntries(const void* a, const void* b)
+{
+	const struct TraceEntry* entryA = a;
+	const struct TraceEntry* entryB = b;
+	
+	if (entryA->id != entryB->id)
+		return entryA->id < entryB->id ? -1 : 1;
+	
+	if (entryA->time != entryB->time)
+		return entryA->time < entryB->time ? -1 : 1;
+	
+	return 0;
+}
+
+//
+// Only wakes up the dump thread, nothing else
+// is safe in a signal handler
+//
+static void TraceSignalHandler(int signal)
+{
+	char byte = (char)signal;
+	int savedErrno = errno;
+	
+	if (write(TraceSignalPipe[1], &byte, 1) < 0) {
+		// Nothing to do about it here
+	}
+	
+	errno = savedErrno;
+}
+
+static void* TraceDumpThread(void* context)
+{
+#pragma unused(context)
+	char byte;
+	
+	for (;;) {
+		ssize_t result = read(TraceSignalPipe[0], &byte, 1);
+		char* json;
+		int fd;
+		
+		if (result < 0 && errno == EINTR)
+			continue;
+		
+		if (result <= 0)
+			break;
+		
+		json = TraceCopyChromeJSON();
+		if (json == NULL)
+			continue;
+		
+		fd = open(TraceDumpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		
+		if (fd < 0) {
+			perror("open");
+		}
+		else {
+			size_t length = strlen(json);
+			
+			if (write(fd, json, length) != (ssize_t)length)
+				perror("write");
+			
+			close(fd);
+			printf("Wrote trace to %s.\n", TraceDumpPath);
+		}
+		
+		free(json);
+	}
+	
+	return NULL;
+}
@@ -0,0 +1,73 @@
+// Copyright (c) 2012, Christian Speich <christian@spei.ch>
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+// Lifecycle tracing of sampled requests. Each traced request
+// gets an id and records a monotonic timestamp whenever it
+// moves on (accepted, first byte read, dispatched...). The
+// events go to a fixed size ring that overwrites the oldest
+// ones, so tracing can stay on in production.
+//
+// The ring is dumped in the Chrome trace event format (load it
+// in chrome://tracing or Perfetto), every request is a row and
+// every stage between two events a slice.
+//
+
+//
+// Traces one of every rate requests, 0 disables
+// tracing (the default)
+//
+void TraceSetSampling(uint32_t rate);
+
+//
+// Decides whether the next request is traced. Returns its
+// trace id, or 0 if it is not traced.
+//
+uint64_t TraceSample(void);
+
+//
+// Records that the request with id reached the state
+// name. name must stay valid, use literals. Nothing is
+// recorded for id 0.
+//
+void TraceEvent(uint64_t id, const char* name);
+
+//
+// Returns the events in the ring as Chrome trace event
+// JSON. The string has to be freed.
+//
+char* TraceCopyChromeJSON(void);
+
+//
+// Writes the trace to path whenever the process gets SIGUSR1.
+// The dump is written by a thread of its own, not in the
+// signal handler.
+//
+bool TraceDumpOnSignal(const char* path);
+
+#endif /* _TRACE_H_ */